@@ -0,0 +1,883 @@
+/*
+ * kmscon - Session Recording
+ *
+ * Copyright (c) 2012 David Herrmann <dh.herrmann@googlemail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "cast.h"
+#include "shl_log.h"
+
+#define LOG_SUBSYSTEM "cast"
+
+struct kmscon_cast {
+	int fd;
+	/* timestamp of the header in usecs */
+	uint64_t start;
+
+	/* incomplete UTF-8 sequence at the end of the last output */
+	unsigned char tail[4];
+	size_t tail_len;
+
+	char *buf;
+	size_t size;
+};
+
+static uint64_t now_usec(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+	ssize_t ret;
+
+	while (len) {
+		ret = write(fd, buf, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+
+		buf += ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+/* reads the unsigned integer value of @key in the header line */
+static bool header_uint(const char *line, const char *key,
+			unsigned long long *out)
+{
+	const char *p;
+	char *end;
+
+	p = strstr(line, key);
+	if (!p)
+		return false;
+
+	p += strlen(key);
+	while (*p == ' ' || *p == '\t')
+		++p;
+	if (*p++ != ':')
+		return false;
+
+	*out = strtoull(p, &end, 10);
+	return end != p;
+}
+
+/*
+ * UTF-8 Escaping
+ * utf8_seq() returns the length of the sequence at @in, 0 if it is not valid
+ * UTF-8 and -1 if it is a valid but incomplete prefix. Overlong forms and
+ * surrogates are invalid like in JSON.
+ */
+
+static int utf8_seq(const unsigned char *in, size_t len)
+{
+	unsigned char lo = 0x80, hi = 0xbf;
+	int n, i;
+
+	if (in[0] < 0x80) {
+		return 1;
+	} else if (in[0] >= 0xc2 && in[0] <= 0xdf) {
+		n = 2;
+	} else if (in[0] >= 0xe0 && in[0] <= 0xef) {
+		n = 3;
+		if (in[0] == 0xe0)
+			lo = 0xa0;
+		else if (in[0] == 0xed)
+			hi = 0x9f;
+	} else if (in[0] >= 0xf0 && in[0] <= 0xf4) {
+		n = 4;
+		if (in[0] == 0xf0)
+			lo = 0x90;
+		else if (in[0] == 0xf4)
+			hi = 0x8f;
+	} else {
+		return 0;
+	}
+
+	for (i = 1; i < n; ++i) {
+		if ((size_t)i >= len)
+			return -1;
+		if (in[i] < lo || in[i] > hi)
+			return 0;
+		lo = 0x80;
+		hi = 0xbf;
+	}
+
+	return n;
+}
+
+/* Escapes @in as content of a JSON string into @out at @pos. Needs up to 6
+ * bytes per input byte. Returns the number of bytes consumed; an incomplete
+ * sequence at the end is left unless @flush is set. */
+static size_t escape(char *out, size_t *pos, const unsigned char *in,
+		     size_t len, bool flush)
+{
+	size_t i = 0, p = *pos;
+	int n;
+
+	while (i < len) {
+		n = utf8_seq(&in[i], len - i);
+		if (n < 0 && !flush)
+			break;
+
+		if (n <= 0) {
+			p += sprintf(&out[p], "\\udc%02x", in[i]);
+			++i;
+			continue;
+		} else if (n > 1) {
+			memcpy(&out[p], &in[i], n);
+			p += n;
+			i += n;
+			continue;
+		}
+
+		switch (in[i]) {
+		case '"':
+		case '\\':
+			out[p++] = '\\';
+			out[p++] = in[i];
+			break;
+		case '\n':
+			out[p++] = '\\';
+			out[p++] = 'n';
+			break;
+		case '\r':
+			out[p++] = '\\';
+			out[p++] = 'r';
+			break;
+		case '\t':
+			out[p++] = '\\';
+			out[p++] = 't';
+			break;
+		default:
+			if (in[i] < 0x20)
+				p += sprintf(&out[p], "\\u%04x", in[i]);
+			else
+				out[p++] = in[i];
+			break;
+		}
+		++i;
+	}
+
+	*pos = p;
+	return i;
+}
+
+/*
+ * Recording
+ */
+
+static int reserve(struct kmscon_cast *cast, size_t size)
+{
+	char *buf;
+
+	if (size <= cast->size)
+		return 0;
+
+	buf = realloc(cast->buf, size);
+	if (!buf)
+		return -ENOMEM;
+
+	cast->buf = buf;
+	cast->size = size;
+	return 0;
+}
+
+static size_t event_start(struct kmscon_cast *cast, const char *type)
+{
+	uint64_t t, now;
+
+	now = now_usec(CLOCK_REALTIME);
+	t = now > cast->start ? now - cast->start : 0;
+
+	return sprintf(cast->buf, "[%llu.%06llu, \"%s\", \"",
+		       (unsigned long long)(t / 1000000),
+		       (unsigned long long)(t % 1000000), type);
+}
+
+static void event_write(struct kmscon_cast *cast, size_t pos)
+{
+	int ret;
+
+	memcpy(&cast->buf[pos], "\"]\n", 3);
+	ret = write_all(cast->fd, cast->buf, pos + 3);
+	if (ret) {
+		log_warning("cannot write recording (%d), stopping it", ret);
+		close(cast->fd);
+		cast->fd = -1;
+	}
+}
+
+int kmscon_cast_open(struct kmscon_cast **out, const char *path,
+		     unsigned int width, unsigned int height)
+{
+	struct kmscon_cast *cast;
+	struct stat st;
+	char line[256];
+	unsigned long long version, ts;
+	ssize_t len;
+	int ret;
+
+	if (!out || !path)
+		return -EINVAL;
+
+	cast = malloc(sizeof(*cast));
+	if (!cast)
+		return -ENOMEM;
+	memset(cast, 0, sizeof(*cast));
+
+	ret = reserve(cast, 4096);
+	if (ret)
+		goto err_free;
+
+	cast->fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+	if (cast->fd < 0) {
+		ret = -errno;
+		log_error("cannot open recording %s: %m", path);
+		goto err_free;
+	}
+
+	/* events of two terminals appended to one file would be interleaved */
+	if (flock(cast->fd, LOCK_EX | LOCK_NB)) {
+		ret = -errno;
+		if (ret == -EWOULDBLOCK) {
+			ret = -EBUSY;
+			log_error("recording %s is used by another terminal",
+				  path);
+		} else {
+			log_error("cannot lock recording %s: %m", path);
+		}
+		goto err_fd;
+	}
+
+	if (fstat(cast->fd, &st)) {
+		ret = -errno;
+		log_error("cannot stat recording %s: %m", path);
+		goto err_fd;
+	}
+
+	if (st.st_size) {
+		/* continue the recording; times stay relative to its header */
+		len = pread(cast->fd, line, sizeof(line) - 1, 0);
+		if (len < 0)
+			len = 0;
+		line[len] = 0;
+
+		if (!header_uint(line, "\"version\"", &version) ||
+		    version != 2 ||
+		    !header_uint(line, "\"timestamp\"", &ts)) {
+			log_error("%s is not an asciicast v2 recording", path);
+			ret = -EINVAL;
+			goto err_fd;
+		}
+
+		cast->start = ts * 1000000;
+		kmscon_cast_resize(cast, width, height);
+		if (cast->fd < 0) {
+			ret = -EIO;
+			goto err_free;
+		}
+	} else {
+		ts = now_usec(CLOCK_REALTIME) / 1000000;
+		cast->start = ts * 1000000;
+
+		len = sprintf(line, "{\"version\": 2, \"width\": %u, \"height\": %u, \"timestamp\": %llu}\n",
+			      width, height, ts);
+		ret = write_all(cast->fd, line, len);
+		if (ret) {
+			log_error("cannot write recording %s: %d", path, ret);
+			goto err_fd;
+		}
+	}
+
+	log_debug("recording to %s", path);
+	*out = cast;
+	return 0;
+
+err_fd:
+	close(cast->fd);
+err_free:
+	free(cast->buf);
+	free(cast);
+	return ret;
+}
+
+void kmscon_cast_close(struct kmscon_cast *cast)
+{
+	size_t pos;
+
+	if (!cast)
+		return;
+
+	/* a sequence that never completed is recorded as single bytes */
+	if (cast->fd >= 0 && cast->tail_len) {
+		pos = event_start(cast, "o");
+		escape(cast->buf, &pos, cast->tail, cast->tail_len, true);
+		event_write(cast, pos);
+	}
+
+	if (cast->fd >= 0)
+		close(cast->fd);
+	free(cast->buf);
+	free(cast);
+}
+
+void kmscon_cast_output(struct kmscon_cast *cast, const char *buf, size_t len)
+{
+	const unsigned char *in = (const unsigned char*)buf;
+	size_t pos, start, num, used;
+
+	if (!cast || cast->fd < 0 || !buf || !len)
+		return;
+
+	if (reserve(cast, (cast->tail_len + len) * 6 + 64)) {
+		log_warning("cannot allocate memory, dropping recorded output");
+		return;
+	}
+
+	pos = event_start(cast, "o");
+	start = pos;
+
+	/* complete the sequence that was split by the last read first */
+	if (cast->tail_len) {
+		num = sizeof(cast->tail) - cast->tail_len;
+		if (num > len)
+			num = len;
+		memcpy(&cast->tail[cast->tail_len], in, num);
+
+		used = escape(cast->buf, &pos, cast->tail,
+			      cast->tail_len + num, false);
+		if (used < cast->tail_len) {
+			/* still incomplete, so all of @buf is in the tail */
+			cast->tail_len += num;
+			return;
+		}
+
+		in += used - cast->tail_len;
+		len -= used - cast->tail_len;
+		cast->tail_len = 0;
+	}
+
+	used = escape(cast->buf, &pos, in, len, false);
+	cast->tail_len = len - used;
+	memcpy(cast->tail, &in[used], cast->tail_len);
+
+	if (pos != start)
+		event_write(cast, pos);
+}
+
+void kmscon_cast_resize(struct kmscon_cast *cast, unsigned int width,
+			unsigned int height)
+{
+	size_t pos;
+
+	if (!cast || cast->fd < 0)
+		return;
+
+	pos = event_start(cast, "r");
+	pos += sprintf(&cast->buf[pos], "%ux%u", width, height);
+	event_write(cast, pos);
+}
+
+/*
+ * Replay
+ * Events are parsed in place; a decoded string is never longer than its
+ * escaped form. Only output events are replayed. Resize events are skipped as
+ * the size of the terminal is given by its display during a replay.
+ * A recording is loaded completely before it is played, so playing it needs
+ * neither stdio nor the allocator.
+ */
+
+static char *skip_ws(char *p)
+{
+	while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+		++p;
+	return p;
+}
+
+static int parse_hex(const char *p, unsigned int *out)
+{
+	unsigned int i, v = 0;
+
+	for (i = 0; i < 4; ++i) {
+		v <<= 4;
+		if (p[i] >= '0' && p[i] <= '9')
+			v |= p[i] - '0';
+		else if (p[i] >= 'a' && p[i] <= 'f')
+			v |= p[i] - 'a' + 10;
+		else if (p[i] >= 'A' && p[i] <= 'F')
+			v |= p[i] - 'A' + 10;
+		else
+			return -EINVAL;
+	}
+
+	*out = v;
+	return 0;
+}
+
+static size_t put_utf8(char *out, unsigned int cp)
+{
+	if (cp < 0x80) {
+		out[0] = cp;
+		return 1;
+	} else if (cp < 0x800) {
+		out[0] = 0xc0 | (cp >> 6);
+		out[1] = 0x80 | (cp & 0x3f);
+		return 2;
+	} else if (cp < 0x10000) {
+		out[0] = 0xe0 | (cp >> 12);
+		out[1] = 0x80 | ((cp >> 6) & 0x3f);
+		out[2] = 0x80 | (cp & 0x3f);
+		return 3;
+	}
+
+	out[0] = 0xf0 | (cp >> 18);
+	out[1] = 0x80 | ((cp >> 12) & 0x3f);
+	out[2] = 0x80 | ((cp >> 6) & 0x3f);
+	out[3] = 0x80 | (cp & 0x3f);
+	return 4;
+}
+
+static int parse_string(char **pos, char **out, size_t *len)
+{
+	char *p = *pos, *w;
+	unsigned int cp, lo;
+
+	if (*p++ != '"')
+		return -EINVAL;
+
+	*out = w = p;
+	while (*p != '"') {
+		if (!*p)
+			return -EINVAL;
+
+		if (*p != '\\') {
+			*w++ = *p++;
+			continue;
+		}
+
+		++p;
+		switch (*p++) {
+		case '"':
+			*w++ = '"';
+			break;
+		case '\\':
+			*w++ = '\\';
+			break;
+		case '/':
+			*w++ = '/';
+			break;
+		case 'b':
+			*w++ = '\b';
+			break;
+		case 'f':
+			*w++ = '\f';
+			break;
+		case 'n':
+			*w++ = '\n';
+			break;
+		case 'r':
+			*w++ = '\r';
+			break;
+		case 't':
+			*w++ = '\t';
+			break;
+		case 'u':
+			if (parse_hex(p, &cp))
+				return -EINVAL;
+			p += 4;
+
+			if (cp >= 0xd800 && cp <= 0xdbff && p[0] == '\\' &&
+			    p[1] == 'u' && !parse_hex(&p[2], &lo) &&
+			    lo >= 0xdc00 && lo <= 0xdfff) {
+				cp = 0x10000 + ((cp - 0xd800) << 10) +
+				     (lo - 0xdc00);
+				p += 6;
+			} else if (cp >= 0xdc80 && cp <= 0xdcff) {
+				/* raw byte, see cast.h */
+				*w++ = cp & 0xff;
+				break;
+			} else if (cp >= 0xd800 && cp <= 0xdfff) {
+				cp = 0xfffd;
+			}
+
+			w += put_utf8(w, cp);
+			break;
+		default:
+			return -EINVAL;
+		}
+	}
+
+	*pos = p + 1;
+	*len = w - *out;
+	return 0;
+}
+
+/* times are parsed by hand so they do not depend on the locale */
+/*
+ * Parses a JSON number of seconds into usecs. Other writers print small
+ * times in exponent form like 1e-05, so the digits are collected into a
+ * mantissa with a decimal exponent first. Digits below usecs are cut off.
+ */
+static int parse_time(char **pos, uint64_t *out)
+{
+	char *p = *pos;
+	uint64_t val = 0;
+	int exp = 6, e = 0, sign = 1;
+
+	if (*p < '0' || *p > '9')
+		return -EINVAL;
+
+	for ( ; *p >= '0' && *p <= '9'; ++p) {
+		if (val < UINT64_MAX / 100)
+			val = val * 10 + *p - '0';
+		else
+			++exp;
+	}
+
+	if (*p == '.') {
+		for (++p; *p >= '0' && *p <= '9'; ++p) {
+			if (val < UINT64_MAX / 100) {
+				val = val * 10 + *p - '0';
+				--exp;
+			}
+		}
+	}
+
+	if (*p == 'e' || *p == 'E') {
+		++p;
+		if (*p == '-' || *p == '+')
+			sign = *p++ == '-' ? -1 : 1;
+		if (*p < '0' || *p > '9')
+			return -EINVAL;
+		for ( ; *p >= '0' && *p <= '9'; ++p) {
+			if (e < 1000)
+				e = e * 10 + *p - '0';
+		}
+		exp += sign * e;
+	}
+
+	for ( ; exp > 0 && val; --exp) {
+		if (val > UINT64_MAX / 10)
+			return -ERANGE;
+		val *= 10;
+	}
+	for ( ; exp < 0 && val; ++exp)
+		val /= 10;
+
+	*pos = p;
+	*out = val;
+	return 0;
+}
+
+/* returns -ENOENT for empty lines */
+static int parse_event(char *line, uint64_t *time, char *type, char **data,
+		       size_t *len)
+{
+	char *p, *code;
+	size_t code_len;
+	int ret;
+
+	p = skip_ws(line);
+	if (!*p)
+		return -ENOENT;
+	if (*p++ != '[')
+		return -EINVAL;
+
+	p = skip_ws(p);
+	ret = parse_time(&p, time);
+	if (ret)
+		return ret;
+
+	p = skip_ws(p);
+	if (*p++ != ',')
+		return -EINVAL;
+
+	p = skip_ws(p);
+	ret = parse_string(&p, &code, &code_len);
+	if (ret)
+		return ret;
+
+	p = skip_ws(p);
+	if (*p++ != ',')
+		return -EINVAL;
+
+	p = skip_ws(p);
+	ret = parse_string(&p, data, len);
+	if (ret)
+		return ret;
+
+	p = skip_ws(p);
+	if (*p != ']')
+		return -EINVAL;
+
+	*type = code_len == 1 ? code[0] : 0;
+	return 0;
+}
+
+static void wait_until(uint64_t start, uint64_t time)
+{
+	struct timespec ts;
+	uint64_t t = start + time;
+
+	ts.tv_sec = t / 1000000;
+	ts.tv_nsec = t % 1000000 * 1000;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+	       EINTR)
+		;
+}
+
+struct cast_event {
+	uint64_t time;
+	size_t off;
+	size_t len;
+};
+
+struct kmscon_cast_rec {
+	unsigned long long width;
+	unsigned long long height;
+
+	struct cast_event *events;
+	size_t num;
+	size_t events_size;
+
+	/* decoded output of all events */
+	char *data;
+	size_t len;
+	size_t data_size;
+};
+
+static int rec_append(struct kmscon_cast_rec *rec, uint64_t time,
+		      const char *data, size_t len)
+{
+	struct cast_event *events;
+	char *t;
+	size_t size;
+
+	if (rec->num >= rec->events_size) {
+		size = rec->events_size ? rec->events_size * 2 : 256;
+		events = realloc(rec->events, size * sizeof(*events));
+		if (!events)
+			return -ENOMEM;
+		rec->events = events;
+		rec->events_size = size;
+	}
+
+	if (len > rec->data_size - rec->len) {
+		size = rec->data_size ? rec->data_size : 4096;
+		while (len > size - rec->len)
+			size *= 2;
+		t = realloc(rec->data, size);
+		if (!t)
+			return -ENOMEM;
+		rec->data = t;
+		rec->data_size = size;
+	}
+
+	memcpy(&rec->data[rec->len], data, len);
+	rec->events[rec->num].time = time;
+	rec->events[rec->num].off = rec->len;
+	rec->events[rec->num].len = len;
+	++rec->num;
+	rec->len += len;
+
+	return 0;
+}
+
+/*
+ * Parses the output events of the recording at @path into memory so they can
+ * be written by kmscon_cast_play() without any allocation or stdio. This
+ * keeps playing safe in a child that was forked from a threaded process.
+ */
+int kmscon_cast_load(struct kmscon_cast_rec **out, const char *path)
+{
+	struct kmscon_cast_rec *rec;
+	FILE *f;
+	char *line = NULL, *data, type;
+	size_t size = 0, len;
+	unsigned long long version;
+	unsigned long num = 1;
+	uint64_t time;
+	int ret;
+
+	if (!out || !path)
+		return -EINVAL;
+
+	rec = malloc(sizeof(*rec));
+	if (!rec)
+		return -ENOMEM;
+	memset(rec, 0, sizeof(*rec));
+
+	f = fopen(path, "re");
+	if (!f) {
+		ret = -errno;
+		log_error("cannot open recording %s: %m", path);
+		goto err_free;
+	}
+
+	if (getline(&line, &size, f) < 0 ||
+	    !header_uint(line, "\"version\"", &version) || version != 2) {
+		log_error("%s is not an asciicast v2 recording", path);
+		ret = -EINVAL;
+		goto err_file;
+	}
+
+	if (!header_uint(line, "\"width\"", &rec->width) ||
+	    !header_uint(line, "\"height\"", &rec->height))
+		rec->width = rec->height = 0;
+
+	while (getline(&line, &size, f) >= 0) {
+		++num;
+		ret = parse_event(line, &time, &type, &data, &len);
+		if (ret == -ENOENT)
+			continue;
+		if (ret) {
+			log_error("invalid event in %s:%lu", path, num);
+			goto err_file;
+		}
+
+		if (type != 'o' || !len)
+			continue;
+
+		ret = rec_append(rec, time, data, len);
+		if (ret) {
+			log_error("cannot load recording %s: %d", path, ret);
+			goto err_file;
+		}
+	}
+
+	free(line);
+	fclose(f);
+	*out = rec;
+	return 0;
+
+err_file:
+	free(line);
+	fclose(f);
+err_free:
+	kmscon_cast_free(rec);
+	return ret;
+}
+
+void kmscon_cast_free(struct kmscon_cast_rec *rec)
+{
+	if (!rec)
+		return;
+
+	free(rec->data);
+	free(rec->events);
+	free(rec);
+}
+
+/* warns if @rec was recorded at another size than @width x @height */
+void kmscon_cast_check_size(struct kmscon_cast_rec *rec, unsigned int width,
+			    unsigned int height)
+{
+	if (!rec || !rec->width || !rec->height)
+		return;
+
+	if (rec->width != width || rec->height != height)
+		log_warning("recording of %llux%llu is replayed at %ux%u",
+			    rec->width, rec->height, width, height);
+}
+
+/*
+ * Writes the output events of @rec to @fd. If @fast is false, each event is
+ * written at its recorded time relative to the start of the replay, otherwise
+ * as fast as @fd accepts it. This only calls async-signal-safe functions and
+ * does not log.
+ */
+int kmscon_cast_play(struct kmscon_cast_rec *rec, int fd, bool fast)
+{
+	struct cast_event *ev;
+	uint64_t start;
+	size_t i;
+	int ret;
+
+	if (!rec || fd < 0)
+		return -EINVAL;
+
+	start = now_usec(CLOCK_MONOTONIC);
+	for (i = 0; i < rec->num; ++i) {
+		ev = &rec->events[i];
+		if (!fast)
+			wait_until(start, ev->time);
+
+		ret = write_all(fd, &rec->data[ev->off], ev->len);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+/* loads the recording at @path and plays it to @fd, see kmscon_cast_play() */
+int kmscon_cast_replay(const char *path, int fd, bool fast)
+{
+	struct kmscon_cast_rec *rec;
+	struct winsize ws;
+	uint64_t start;
+	int ret;
+
+	if (!path || fd < 0)
+		return -EINVAL;
+
+	ret = kmscon_cast_load(&rec, path);
+	if (ret)
+		return ret;
+
+	if (!ioctl(fd, TIOCGWINSZ, &ws))
+		kmscon_cast_check_size(rec, ws.ws_col, ws.ws_row);
+
+	start = now_usec(CLOCK_MONOTONIC);
+	ret = kmscon_cast_play(rec, fd, fast);
+	if (ret)
+		log_error("cannot write replay of %s: %d", path, ret);
+	else
+		log_info("replayed %s in %llu ms", path,
+			 (unsigned long long)(now_usec(CLOCK_MONOTONIC) -
+					      start) / 1000);
+
+	kmscon_cast_free(rec);
+	return ret;
+}
@@ -0,0 +1,67 @@
+/*
+ * kmscon - Session Recording
+ *
+ * Copyright (c) 2012 David Herrmann <dh.herrmann@googlemail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Session Recording
+ * A cast object appends the output of a child process and the resize events
+ * of its terminal to a file in the asciicast v2 format. Each line after the
+ * header is an event of the form [time, "o", data] or [time, "r", "WxH"]
+ * where time is in seconds since the timestamp of the header. If the file
+ * already contains a recording, new events are appended to it. A file is
+ * only recorded to by one cast object at a time, a second open fails with
+ * -EBUSY.
+ *
+ * JSON strings must be valid UTF-8 but the output of a child is an arbitrary
+ * byte stream. UTF-8 sequences that are split across reads are kept until
+ * the next event and bytes that are not valid UTF-8 are escaped as the lone
+ * surrogates \udc80 to \udcff. Other players show them as replacement
+ * characters, kmscon_cast_replay() restores the original bytes so a replay
+ * feeds exactly the recorded stream into the terminal.
+ */
+
+#ifndef KMSCON_CAST_H
+#define KMSCON_CAST_H
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+struct kmscon_cast;
+struct kmscon_cast_rec;
+
+int kmscon_cast_open(struct kmscon_cast **out, const char *path,
+		     unsigned int width, unsigned int height);
+void kmscon_cast_close(struct kmscon_cast *cast);
+void kmscon_cast_output(struct kmscon_cast *cast, const char *buf, size_t len);
+void kmscon_cast_resize(struct kmscon_cast *cast, unsigned int width,
+			unsigned int height);
+
+int kmscon_cast_load(struct kmscon_cast_rec **out, const char *path);
+void kmscon_cast_free(struct kmscon_cast_rec *rec);
+void kmscon_cast_check_size(struct kmscon_cast_rec *rec, unsigned int width,
+			    unsigned int height);
+int kmscon_cast_play(struct kmscon_cast_rec *rec, int fd, bool fast);
+int kmscon_cast_replay(const char *path, int fd, bool fast);
+
+#endif /* KMSCON_CAST_H */
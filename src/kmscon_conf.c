@@ -98,6 +98,22 @@ static void print_help()
 		"\t                              Select the used color palette\n"
 		"\t    --sb-size <num>         [1000]\n"
 		"\t                              Size of the scrollback-buffer in lines\n"
+		"\t    --pty-read-budget <usecs> [5000]\n"
+		"\t                              Time spent reading output of the child\n"
+		"\t                              process per wakeup\n"
+		"\t    --pty-backlog <KiB>     [0]\n"
+		"\t                              Stop reading from the child process if\n"
+		"\t                              more output is not yet shown, 0 to\n"
+		"\t                              disable\n"
+		"\t    --record <file>         [-]\n"
+		"\t                              Append output of the child process to\n"
+		"\t                              an asciicast file\n"
+		"\t    --replay <file>         [-]\n"
+		"\t                              Replay an asciicast file instead of\n"
+		"\t                              running the child process\n"
+		"\t    --replay-fast           [off]\n"
+		"\t                              Replay as fast as possible instead of\n"
+		"\t                              at recorded speed\n"
 		"\n"
 		"Input Options:\n"
 		"\t    --xkb-model <model>        [-]  Set XkbModel for input devices\n"
@@ -144,7 +160,27 @@ static void print_help()
 		"\t    --hwaccel               [off]   Use 3D hardware-acceleration if\n"
 		"\t                                    available\n"
 		"\t    --gpus={all,aux,primary}[all]   GPU selection mode\n"
+		"\t    --mem-video <spec>      [-]     Add virtual displays in system\n"
+		"\t                                    memory, e.g. 800x600:rgb565@30\n"
 		"\t    --render-engine <eng>   [-]     Console renderer\n"
+		"\t    --max-fps <fps>         [0]     Maximum frames per second, 0 to\n"
+		"\t                                    redraw once per vblank\n"
+		"\t    --render-budget <ms>    [0]     Lower the frame rate while frames\n"
+		"\t                                    take longer to render, 0 to\n"
+		"\t                                    disable\n"
+		"\t    --fb-shadow={auto,on,off}[auto] Render fbdev output into a\n"
+		"\t                                    shadow buffer in system RAM\n"
+		"\t    --fb-dither             [on]    Dither colors on fbdev devices\n"
+		"\t                                    with less than 24bit color\n"
+		"\t    --drm-dirty-only        [off]   Render into the DRM front buffer\n"
+		"\t                                    and flush only modified areas\n"
+		"\t    --render-threads <num>  [0]     Number of threads used for\n"
+		"\t                                    blending, 0 to use all CPUs but\n"
+		"\t                                    at most 4\n"
+		"\t    --async-render          [off]   Render on a separate thread per\n"
+		"\t                                    terminal, software renderers only\n"
+		"\t    --glyph-cache <KiB>     [2048]  Memory for blended glyphs of the\n"
+		"\t                                    bblit/bbulk renderers, 0 to disable\n"
 		"\t    --render-timing         [off]   Print renderer timing information\n"
 		"\n"
 		"Font Options:\n"
@@ -360,6 +396,58 @@ static int file_login(struct conf_option *opt, bool on, const char *arg)
 	return 0;
 }
 
+/*
+ * Framebuffer shadow type
+ * The shadow buffer mode is a simple string to enum parser.
+ */
+
+static void conf_default_fb_shadow(struct conf_option *opt)
+{
+	conf_uint.set_default(opt);
+}
+
+static void conf_free_fb_shadow(struct conf_option *opt)
+{
+	conf_uint.free(opt);
+}
+
+static int conf_parse_fb_shadow(struct conf_option *opt, bool on,
+				const char *arg)
+{
+	struct kmscon_conf_t *conf = KMSCON_CONF_FROM_FIELD(opt->mem,
+							    fb_shadow);
+	unsigned int mode;
+
+	if (!strcmp(arg, "auto")) {
+		mode = KMSCON_FB_SHADOW_AUTO;
+	} else if (!strcmp(arg, "on")) {
+		mode = KMSCON_FB_SHADOW_ON;
+	} else if (!strcmp(arg, "off")) {
+		mode = KMSCON_FB_SHADOW_OFF;
+	} else {
+		log_error("invalid shadow buffer mode --fb-shadow='%s'", arg);
+		return -EFAULT;
+	}
+
+	opt->type->free(opt);
+	conf->fb_shadow = mode;
+	return 0;
+}
+
+static int conf_copy_fb_shadow(struct conf_option *opt,
+			       const struct conf_option *src)
+{
+	return conf_uint.copy(opt, src);
+}
+
+static const struct conf_type conf_fb_shadow = {
+	.flags = CONF_HAS_ARG,
+	.set_default = conf_default_fb_shadow,
+	.free = conf_free_fb_shadow,
+	.parse = conf_parse_fb_shadow,
+	.copy = conf_copy_fb_shadow,
+};
+
 /*
  * GPU selection type
  * The GPU selection mode is a simple string to enum parser.
@@ -579,6 +667,11 @@ int kmscon_conf_new(struct conf_ctx **out)
 		CONF_OPTION_BOOL(0, "reset-env", &conf->reset_env, true),
 		CONF_OPTION_STRING(0, "palette", &conf->palette, NULL),
 		CONF_OPTION_UINT(0, "sb-size", &conf->sb_size, 1000),
+		CONF_OPTION_UINT(0, "pty-read-budget", &conf->pty_read_budget, 5000),
+		CONF_OPTION_UINT(0, "pty-backlog", &conf->pty_backlog, 0),
+		CONF_OPTION_STRING(0, "record", &conf->record, NULL),
+		CONF_OPTION_STRING(0, "replay", &conf->replay, NULL),
+		CONF_OPTION_BOOL(0, "replay-fast", &conf->replay_fast, false),
 
 		/* Input Options */
 		CONF_OPTION_STRING(0, "xkb-model", &conf->xkb_model, ""),
@@ -609,7 +702,16 @@ int kmscon_conf_new(struct conf_ctx **out)
 		CONF_OPTION_BOOL_FULL(0, "drm", aftercheck_drm, NULL, NULL, &conf->drm, true),
 		CONF_OPTION_BOOL(0, "hwaccel", &conf->hwaccel, false),
 		CONF_OPTION(0, 0, "gpus", &conf_gpus, NULL, NULL, NULL, &conf->gpus, KMSCON_GPU_ALL),
+		CONF_OPTION_STRING(0, "mem-video", &conf->mem_video, NULL),
 		CONF_OPTION_STRING(0, "render-engine", &conf->render_engine, NULL),
+		CONF_OPTION_UINT(0, "max-fps", &conf->max_fps, 0),
+		CONF_OPTION_UINT(0, "render-budget", &conf->render_budget, 0),
+		CONF_OPTION(0, 0, "fb-shadow", &conf_fb_shadow, NULL, NULL, NULL, &conf->fb_shadow, KMSCON_FB_SHADOW_AUTO),
+		CONF_OPTION_BOOL(0, "fb-dither", &conf->fb_dither, true),
+		CONF_OPTION_BOOL(0, "drm-dirty-only", &conf->drm_dirty_only, false),
+		CONF_OPTION_UINT(0, "render-threads", &conf->render_threads, 0),
+		CONF_OPTION_BOOL(0, "async-render", &conf->async_render, false),
+		CONF_OPTION_UINT(0, "glyph-cache", &conf->glyph_cache, 2048),
 
 		/* Font Options */
 		CONF_OPTION_STRING(0, "font-engine", &conf->font_engine, "pango"),
@@ -43,6 +43,12 @@ enum kmscon_conf_gpu_selection {
 	KMSCON_GPU_PRIMARY,
 };
 
+enum kmscon_conf_fb_shadow {
+	KMSCON_FB_SHADOW_AUTO,
+	KMSCON_FB_SHADOW_ON,
+	KMSCON_FB_SHADOW_OFF,
+};
+
 struct kmscon_conf_t {
 	/* header information */
 	bool seat_config;
@@ -92,6 +98,16 @@ struct kmscon_conf_t {
 	char *palette;
 	/* terminal scroll-back buffer size */
 	unsigned int sb_size;
+	/* time in usecs spent reading from the pty per wakeup */
+	unsigned int pty_read_budget;
+	/* parsed but not presented output in KiB before pausing the pty; 0 off */
+	unsigned int pty_backlog;
+	/* file the output of the child process is recorded to */
+	char *record;
+	/* recording that is replayed instead of running the child process */
+	char *replay;
+	/* replay as fast as possible instead of at recorded speed */
+	bool replay_fast;
 
 	/* Input Options */
 	/* input KBD model */
@@ -146,8 +162,26 @@ struct kmscon_conf_t {
 	bool hwaccel;
 	/* gpu selection mode */
 	unsigned int gpus;
+	/* virtual displays in system memory */
+	char *mem_video;
 	/* render engine */
 	char *render_engine;
+	/* maximum frames per second; 0 for vblank only */
+	unsigned int max_fps;
+	/* render time per frame in ms before lowering the frame rate; 0 off */
+	unsigned int render_budget;
+	/* fbdev shadow buffer mode */
+	unsigned int fb_shadow;
+	/* dither colors on fbdev devices with less than 8bit per channel */
+	bool fb_dither;
+	/* render into the DRM front buffer and flush only damaged areas */
+	bool drm_dirty_only;
+	/* render threads per video device; 0 for auto */
+	unsigned int render_threads;
+	/* render terminals on a separate thread */
+	bool async_render;
+	/* glyph tile cache size in KiB; 0 to disable */
+	unsigned int glyph_cache;
 
 	/* Font Options */
 	/* font engine */
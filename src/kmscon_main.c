@@ -31,6 +31,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/signalfd.h>
+#include <unistd.h>
 #include "conf.h"
 #include "eloop.h"
 #include "kmscon_conf.h"
@@ -152,6 +153,10 @@ static int app_seat_event(struct kmscon_seat *s, unsigned int event,
 	return 0;
 }
 
+static int app_seat_add_mem_video(struct app_seat *seat, const char *spec);
+static void app_seat_remove_video(struct app_seat *seat,
+				  struct app_video *vid);
+
 static int app_seat_new(struct kmscon_app *app, const char *sname,
 			struct uterm_monitor_seat *useat)
 {
@@ -231,6 +236,9 @@ static int app_seat_new(struct kmscon_app *app, const char *sname,
 
 	kmscon_seat_startup(seat->seat);
 
+	if (seat->conf->mem_video)
+		app_seat_add_mem_video(seat, seat->conf->mem_video);
+
 	return 0;
 
 err_name:
@@ -242,8 +250,18 @@ err_free:
 
 static void app_seat_free(struct app_seat *seat)
 {
+	struct app_video *vid;
+
 	log_debug("free seat %s", seat->name);
 
+	/* The monitor removes its devices before the seat, so only virtual
+	 * video devices are left. */
+	while (!shl_dlist_empty(&seat->videos)) {
+		vid = shl_dlist_entry(seat->videos.next, struct app_video,
+				      list);
+		app_seat_remove_video(seat, vid);
+	}
+
 	shl_dlist_unlink(&seat->list);
 	uterm_monitor_set_seat_data(seat->useat, NULL);
 	kmscon_seat_free(seat->seat);
@@ -318,6 +336,52 @@ static bool app_seat_gpu_is_ignored(struct app_seat *seat,
 	return false;
 }
 
+static int app_seat_setup_video(struct app_seat *seat,
+				struct app_video *vid)
+{
+	int ret;
+	long cpus;
+	unsigned int threads;
+
+	switch (seat->conf->fb_shadow) {
+	case KMSCON_FB_SHADOW_ON:
+		uterm_video_set_shadow(vid->video, UTERM_SHADOW_ON);
+		break;
+	case KMSCON_FB_SHADOW_OFF:
+		uterm_video_set_shadow(vid->video, UTERM_SHADOW_OFF);
+		break;
+	default:
+		uterm_video_set_shadow(vid->video, UTERM_SHADOW_AUTO);
+		break;
+	}
+
+	uterm_video_set_dithering(vid->video, seat->conf->fb_dither);
+	uterm_video_set_dirty_only(vid->video, seat->conf->drm_dirty_only);
+
+	threads = seat->conf->render_threads;
+	if (!threads) {
+		cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cpus > 0 ? cpus : 1;
+		if (threads > 4)
+			threads = 4;
+	}
+	uterm_video_set_render_threads(vid->video, threads);
+
+	ret = uterm_video_register_cb(vid->video, app_seat_video_event, vid);
+	if (ret) {
+		log_error("cannot register video callback for device %s on seat %s: %d",
+			  vid->node, seat->name, ret);
+		return ret;
+	}
+
+	if (seat->awake)
+		uterm_video_wake_up(vid->video);
+
+	uterm_monitor_set_dev_data(vid->udev, vid);
+	shl_dlist_link(&seat->videos, &vid->list);
+	return 0;
+}
+
 static int app_seat_add_video(struct app_seat *seat,
 			      unsigned int type,
 			      unsigned int flags,
@@ -381,18 +445,62 @@ static int app_seat_add_video(struct app_seat *seat,
 		}
 	}
 
-	ret = uterm_video_register_cb(vid->video, app_seat_video_event, vid);
-	if (ret) {
-		log_error("cannot register video callback for device %s on seat %s: %d",
-			  vid->node, seat->name, ret);
+	ret = app_seat_setup_video(seat, vid);
+	if (ret)
 		goto err_video;
+
+	return 0;
+
+err_video:
+	uterm_video_unref(vid->video);
+err_node:
+	free(vid->node);
+err_free:
+	free(vid);
+	return ret;
+}
+
+/*
+ * Virtual displays in system memory are not announced by the device monitor,
+ * so we add them ourselves when a seat is created. They have no monitor device
+ * attached and are removed with the seat.
+ */
+static int app_seat_add_mem_video(struct app_seat *seat, const char *spec)
+{
+	int ret;
+	struct app_video *vid;
+
+	log_debug("new virtual video device %s on seat %s", spec, seat->name);
+
+	vid = malloc(sizeof(*vid));
+	if (!vid) {
+		log_error("cannot allocate memory for video device %s on seat %s",
+			  spec, seat->name);
+		return -ENOMEM;
 	}
+	memset(vid, 0, sizeof(*vid));
+	vid->seat = seat;
 
-	if (seat->awake)
-		uterm_video_wake_up(vid->video);
+	vid->node = strdup(spec);
+	if (!vid->node) {
+		log_error("cannot copy video device name %s on seat %s",
+			  spec, seat->name);
+		ret = -ENOMEM;
+		goto err_free;
+	}
+
+	ret = uterm_video_new(&vid->video, seat->app->eloop, spec,
+			      UTERM_VIDEO_MEM);
+	if (ret) {
+		log_error("cannot create virtual video device %s on seat %s: %d",
+			  spec, seat->name, ret);
+		goto err_node;
+	}
+
+	ret = app_seat_setup_video(seat, vid);
+	if (ret)
+		goto err_video;
 
-	uterm_monitor_set_dev_data(vid->udev, vid);
-	shl_dlist_link(&seat->videos, &vid->list);
 	return 0;
 
 err_video:
@@ -1068,6 +1068,18 @@ bool kmscon_session_is_registered(struct kmscon_session *sess)
 	return sess && sess->seat;
 }
 
+/* returns the data that was passed to kmscon_seat_register_session() */
+void *kmscon_session_get_data(struct kmscon_session *sess)
+{
+	return sess ? sess->data : NULL;
+}
+
+/* returns the callback that was passed to kmscon_seat_register_session() */
+kmscon_session_cb_t kmscon_session_get_cb(struct kmscon_session *sess)
+{
+	return sess ? sess->cb : NULL;
+}
+
 bool kmscon_session_is_active(struct kmscon_session *sess)
 {
 	return sess && sess->seat && sess->seat->current_sess == sess;
@@ -109,6 +109,8 @@ void kmscon_session_ref(struct kmscon_session *sess);
 void kmscon_session_unref(struct kmscon_session *sess);
 void kmscon_session_unregister(struct kmscon_session *sess);
 bool kmscon_session_is_registered(struct kmscon_session *sess);
+void *kmscon_session_get_data(struct kmscon_session *sess);
+kmscon_session_cb_t kmscon_session_get_cb(struct kmscon_session *sess);
 
 bool kmscon_session_is_active(struct kmscon_session *sess);
 int kmscon_session_set_foreground(struct kmscon_session *sess);
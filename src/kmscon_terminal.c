@@ -33,6 +33,9 @@
 #include <errno.h>
 #include <inttypes.h>
 #include <libtsm.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/sysinfo.h>
@@ -47,6 +50,8 @@
 #include "shl_dlist.h"
 #include "shl_array.h"
 #include "shl_log.h"
+#include "shl_spsc.h"
+#include "shl_timer.h"
 #include "text.h"
 #include "uterm_input.h"
 #include "uterm_video.h"
@@ -61,6 +66,53 @@
 #endif
 
 #define	SPY_PORT	7788
+
+/* maximum number of back-buffers we track the frame-age of */
+#define SCREEN_BUFFERS 2
+
+/* maximum number of cells for the fast path */
+#define FAST_CELLS 16
+
+/* maximum number of characters of copied cells */
+#define CELL_CHARS 4
+
+/* maximum number of frames queued for the render thread */
+#define RENDER_QUEUE 16
+
+/* copy of a console cell, see tsm_screen_draw_cb */
+struct cell_copy {
+	uint32_t id;
+	uint32_t ch[CELL_CHARS];
+	size_t len;
+	unsigned int width;
+	unsigned int posx;
+	unsigned int posy;
+	struct tsm_screen_attr attr;
+	tsm_age_t age;
+};
+
+/* copy of all visible console cells in drawing order */
+struct snapshot {
+	tsm_age_t age;
+	bool overflow;
+	size_t num;
+	size_t size;
+	struct cell_copy *cells;
+};
+
+/* result of rendering a frame; applied by finish_frame() */
+struct frame_result {
+	bool rendered;
+	int ret;
+	int buf;
+	bool valid;
+	bool fast;
+	bool shift;
+	tsm_age_t age;
+	tsm_age_t prev;
+	uint64_t cost;
+};
+
 struct screen {
 	struct shl_dlist list;
 	struct kmscon_terminal *term;
@@ -69,6 +121,45 @@ struct screen {
 
 	bool swapping;
 	bool pending;
+	/* time since the last frame was rendered */
+	struct shl_timer frame;
+
+	/* frame-rate governor level, consecutive frames over the render
+	 * budget, render time of the last frame, frames dropped by the
+	 * governor and whether the pending frame was delayed by it */
+	unsigned int gov_level;
+	unsigned int gov_slow;
+	uint64_t gov_cost;
+	uint64_t gov_dropped;
+	bool gov_delayed;
+
+	/* age of the last frame presented in each back-buffer; 0 if unknown */
+	tsm_age_t age[SCREEN_BUFFERS];
+
+	/* Hash of each row of the console and of the rows in each back-buffer,
+	 * used to detect scrolling. The back-buffer hashes are only valid if
+	 * its age is known. 0 is never a valid hash. */
+	unsigned int hash_rows;
+	uint64_t *hashes;
+	uint64_t *buf_hashes[SCREEN_BUFFERS];
+	/* rows of the target buffer after moving scrolled rows into place */
+	uint64_t *moved;
+
+	/* cells that changed since the target buffer was drawn, collected
+	 * while hashing; only valid if not overflowed */
+	tsm_age_t fast_age;
+	bool fast_overflow;
+	unsigned int fast_num;
+	struct cell_copy fast[FAST_CELLS];
+
+	/* Frames are rendered on the render thread if @threaded is set.
+	 * While @in_flight, the render thread owns the text-renderer, the
+	 * display and all render state of this screen. */
+	bool threaded;
+	bool in_flight;
+	uint64_t flight_elapsed;
+	struct snapshot snap;
+	struct frame_result result;
 };
 
 struct kmscon_terminal {
@@ -95,6 +186,36 @@ struct kmscon_terminal {
 	struct kmscon_font *font;
 	struct kmscon_font *bold_font;
 
+	/* frame scheduling */
+	bool redraw_scheduled;
+	bool control_pending;
+	bool frame_timer_armed;
+	struct ev_timer *frame_timer;
+	/* time since the last key was passed to the application */
+	struct shl_timer input_time;
+	/* bytes parsed since the last frame was presented */
+	size_t backlog;
+	/* frame statistics of all screens, including removed ones, see
+	 * kmscon_terminal_get_stats() */
+	uint64_t gov_dropped;
+	uint64_t frames;
+	uint64_t fast_frames;
+	uint64_t scroll_frames;
+	uint64_t threaded_frames;
+	uint64_t render_usec;
+
+	/* render thread, see "Render Thread" below */
+	bool render_running;
+	bool render_exit;
+	pthread_t render_tid;
+	sem_t render_sem;
+	pthread_mutex_t render_mutex;
+	pthread_cond_t render_cond;
+	unsigned int render_busy;
+	struct shl_spsc render_queue;
+	struct shl_spsc render_done;
+	struct ev_counter *render_counter;
+
 /*
  *  输入法及输入法状态
  */
@@ -291,40 +412,910 @@ void im_candidates_draw_callback(struct im *_im, int index, uint32_t id, uint32_
 				0, 10 + index * width + i, txt->rows - 1, &attr);
 }
 
-static void do_redraw_screen(struct screen *scr)
+static void invalidate_screen(struct screen *scr)
 {
-	int ret;
+	memset(scr->age, 0, sizeof(scr->age));
+}
 
-	if (!scr->term->awake)
+static void render_sync(struct kmscon_terminal *term);
+
+static void invalidate_all(struct kmscon_terminal *term)
+{
+	struct shl_dlist *iter;
+	struct screen *scr;
+
+	render_sync(term);
+	shl_dlist_for_each(iter, &term->screens) {
+		scr = shl_dlist_entry(iter, struct screen, list);
+		invalidate_screen(scr);
+	}
+}
+
+/*
+ * Scroll Detection
+ * When the console scrolls, every cell changes and the age of all cells is
+ * reset, so the whole screen would be drawn again. Instead, we hash each row
+ * of the console before drawing and compare the hashes with the rows that the
+ * target buffer contains. If the content moved, the matching rows are moved
+ * inside the buffer via kmscon_text_move() and only the remaining rows are
+ * drawn. Rows are compared by their 64bit hashes only; a collision would leave
+ * a stale row on screen until it changes again, which we accept.
+ * This is only done for backends that keep the content of their buffers. The
+ * OpenGL backends redraw everything each frame anyway.
+ */
+
+static void free_hashes(struct screen *scr)
+{
+	free(scr->hashes);
+	scr->hashes = NULL;
+	scr->hash_rows = 0;
+}
+
+static int alloc_hashes(struct screen *scr)
+{
+	unsigned int rows = scr->txt->rows, i;
+	uint64_t *h;
+
+	if (scr->hashes && scr->hash_rows == rows)
+		return 0;
+
+	free_hashes(scr);
+	invalidate_screen(scr);
+
+	h = calloc((SCREEN_BUFFERS + 2) * rows, sizeof(*h));
+	if (!h)
+		return -ENOMEM;
+
+	scr->hashes = h;
+	scr->moved = &h[rows];
+	for (i = 0; i < SCREEN_BUFFERS; ++i)
+		scr->buf_hashes[i] = &h[(i + 2) * rows];
+	scr->hash_rows = rows;
+
+	return 0;
+}
+
+static inline uint64_t hash_step(uint64_t h, uint64_t v)
+{
+	h = (h ^ v) * 0x9e3779b97f4a7c15ULL;
+	return h ^ (h >> 29);
+}
+
+static void collect_cell(struct screen *scr,
+			 uint32_t id, const uint32_t *ch, size_t len,
+			 unsigned int width,
+			 unsigned int posx, unsigned int posy,
+			 const struct tsm_screen_attr *attr,
+			 tsm_age_t age)
+{
+	struct cell_copy *cell;
+
+	if (scr->fast_overflow)
+		return;
+	if (age && age <= scr->fast_age)
 		return;
 
-	scr->pending = false;
-	do_clear_margins(scr);
+	if (scr->fast_num >= FAST_CELLS || len > CELL_CHARS) {
+		scr->fast_overflow = true;
+		return;
+	}
+
+	cell = &scr->fast[scr->fast_num++];
+	cell->id = id;
+	memcpy(cell->ch, ch, len * sizeof(*ch));
+	cell->len = len;
+	cell->width = width;
+	cell->posx = posx;
+	cell->posy = posy;
+	cell->attr = *attr;
+	cell->age = age;
+}
+
+static int hash_cb(struct tsm_screen *con,
+		   uint32_t id, const uint32_t *ch, size_t len,
+		   unsigned int width,
+		   unsigned int posx, unsigned int posy,
+		   const struct tsm_screen_attr *attr,
+		   tsm_age_t age, void *data)
+{
+	struct screen *scr = data;
+	uint64_t h, fc, bc, flags;
+
+	collect_cell(scr, id, ch, len, width, posx, posy, attr, age);
+
+	if (posy >= scr->hash_rows)
+		return 0;
+
+	fc = (attr->fr << 16) | (attr->fg << 8) | attr->fb;
+	bc = (attr->br << 16) | (attr->bg << 8) | attr->bb;
+	flags = attr->bold | (attr->underline << 1) | (attr->inverse << 2) |
+		(attr->blink << 3) | (attr->protect << 4);
+
+	h = scr->hashes[posy];
+	if (!h)
+		h = 0xcbf29ce484222325ULL;
+	h = hash_step(h, ((uint64_t)id << 32) | (width << 8) | flags);
+	h = hash_step(h, (fc << 32) | bc);
+	if (!h)
+		h = 1;
+	scr->hashes[posy] = h;
+
+	return 0;
+}
+
+/*
+ * Finds the vertical shift of the console content relative to @old that saves
+ * the most rows from being drawn again. On success, rows [@dst, @dst + @num)
+ * can be moved into place from row @dst + shift. We only move rows if more
+ * than half of them would have to be redrawn otherwise.
+ * Returns the shift or 0 if moving does not pay off.
+ */
+static int find_scroll(const uint64_t *old, const uint64_t *new,
+		       unsigned int rows, unsigned int *dst, unsigned int *num)
+{
+	int d, best = 0;
+	unsigned int y, start = 0, len, kept, gain, best_gain = 0;
+
+	for (d = 1 - (int)rows; d < (int)rows; ++d) {
+		if (!d)
+			continue;
+
+		len = 0;
+		kept = 0;
+		for (y = d < 0 ? -d : 0; y < rows && y + d < rows; ++y) {
+			if (!new[y] || new[y] != old[y + d]) {
+				len = 0;
+				continue;
+			}
+
+			if (!len) {
+				start = y;
+				kept = 0;
+			}
+			++len;
+			if (new[y] == old[y])
+				++kept;
+
+			gain = len - kept;
+			if (gain > best_gain && gain * 2 > len) {
+				best = d;
+				best_gain = gain;
+				*dst = start;
+				*num = len;
+			}
+		}
+	}
+
+	return best;
+}
+
+static int scroll_draw_cb(struct tsm_screen *con,
+			  uint32_t id, const uint32_t *ch, size_t len,
+			  unsigned int width,
+			  unsigned int posx, unsigned int posy,
+			  const struct tsm_screen_attr *attr,
+			  tsm_age_t age, void *data)
+{
+	struct screen *scr = data;
+
+	/* skip rows that are already in place */
+	if (posy < scr->hash_rows && scr->hashes[posy] &&
+	    scr->hashes[posy] == scr->moved[posy])
+		return 0;
+
+	return kmscon_text_draw(scr->txt, id, ch, len, width, posx, posy,
+				attr);
+}
+
+/*
+ * Fast Path
+ * Moving the cursor or echoing a single key changes only a few cells. While
+ * hashing the rows, we also collect the cells that changed since the target
+ * buffer was drawn. If these are only a handful, we draw them directly and
+ * skip scroll detection and the second traversal of the console. As the
+ * cells are selected by the age of the target buffer, this also repairs the
+ * cells that changed in the other buffer since.
+ * The hashing traversal itself cannot be skipped. libtsm reports the age of a
+ * cell only while drawing it and offers no way to find the changed cells or
+ * even the current age counter without walking the whole screen. A single
+ * write may also scroll or erase any number of rows, so the amount of parsed
+ * output does not bound the number of changed cells either.
+ */
+
+/* errors of single cells are ignored like tsm_screen_draw() does */
+static void draw_fast(struct screen *scr)
+{
+	struct cell_copy *cell;
+	unsigned int i;
+
+	for (i = 0; i < scr->fast_num; ++i) {
+		cell = &scr->fast[i];
+		kmscon_text_draw(scr->txt, cell->id, cell->ch, cell->len,
+				 cell->width, cell->posx, cell->posy,
+				 &cell->attr);
+	}
+}
+
+/*
+ * Backpressure
+ * Output of the child is parsed as soon as it is read but only rendered once
+ * per frame. If --pty-backlog is set and more output than that was parsed
+ * since the last frame was presented, we stop reading from the pty until the
+ * next frame is presented. The child is then throttled by the kernel pty buffer
+ * instead of flooding us, so the parsed-but-not-shown backlog and thus the
+ * latency of keystroke echo stays bounded. Whenever no frame can be presented,
+ * reading is resumed right away so the child never gets stuck.
+ */
+
+static void backpressure_release(struct kmscon_terminal *term)
+{
+	term->backlog = 0;
+	kmscon_pty_resume(term->pty);
+}
+
+static void backpressure_add(struct kmscon_terminal *term, size_t len)
+{
+	if (!term->conf->pty_backlog || !term->awake ||
+	    shl_dlist_empty(&term->screens))
+		return;
 
-	kmscon_text_prepare(scr->txt);
-	tsm_screen_draw(scr->term->console, kmscon_text_draw_cb, scr->txt);
-	if (im_isactive( scr->term->im))
+	term->backlog += len;
+	if (term->backlog >= (size_t)term->conf->pty_backlog * 1024)
+		kmscon_pty_pause(term->pty);
+}
+
+/*
+ * Draws the console via @cb. If @snap is given, its cells are replayed instead
+ * so this can be called without access to the console. The callbacks must not
+ * make use of their console argument.
+ */
+static tsm_age_t screen_draw(struct screen *scr, struct snapshot *snap,
+			     tsm_screen_draw_cb cb, void *data)
+{
+	struct cell_copy *cell;
+	size_t i;
+
+	if (!snap)
+		return tsm_screen_draw(scr->term->console, cb, data);
+
+	for (i = 0; i < snap->num; ++i) {
+		cell = &snap->cells[i];
+		cb(NULL, cell->id, cell->ch, cell->len, cell->width,
+		   cell->posx, cell->posy, &cell->attr, cell->age, data);
+	}
+
+	return snap->age;
+}
+
+/*
+ * Renders a frame into the next back-buffer of the screen but does not
+ * present it. The result is stored in scr->result and must be applied via
+ * finish_frame() on the event loop. If @snap is NULL, the frame is drawn
+ * directly from the console.
+ * This runs on the render thread for threaded frames, so it must not touch
+ * anything but the render state of this screen.
+ */
+static void render_frame(struct screen *scr, struct snapshot *snap)
+{
+	struct frame_result *res = &scr->result;
+	int ret, buf, shift = 0;
+	bool opengl = false, valid, hashing, reset = false, fast = false;
+	bool im = !snap && im_isactive(scr->term->im);
+	tsm_age_t age, prev = 0;
+	unsigned int dst = 0, num = 0, rows;
+
+	res->rendered = false;
+
+	/* Skip all cells that did not change since the back-buffer we are
+	 * going to draw into was presented the last time. */
+	buf = uterm_display_use(scr->disp, &opengl);
+	valid = buf >= 0 && buf < SCREEN_BUFFERS;
+	hashing = valid && !opengl && !alloc_hashes(scr);
+	if (valid)
+		prev = scr->age[buf];
+
+	/* The backend knows whether the buffer was cleared or recreated since
+	 * we drew into it, e.g., during a mode-set or VT switch. */
+	if (prev && !uterm_display_get_buffer_age(scr->disp))
+		prev = 0;
+
+	rows = scr->hash_rows;
+	if (hashing) {
+		memset(scr->hashes, 0, rows * sizeof(*scr->hashes));
+		scr->fast_age = prev;
+		scr->fast_num = 0;
+		scr->fast_overflow = !prev || scr->txt->redraw;
+		age = screen_draw(scr, snap, hash_cb, scr);
+
+		/* a reset of the age counter is reported only once */
+		if (!age)
+			reset = true;
+		else if (!scr->fast_overflow)
+			fast = true;
+		else if (prev && !scr->txt->redraw)
+			shift = find_scroll(scr->buf_hashes[buf], scr->hashes,
+					    rows, &dst, &num);
+	}
+
+	/* OpenGL back-buffers are undefined after a swap */
+	if (!prev || opengl)
+		do_clear_margins(scr);
+
+	/* scrolling changes the age of all cells, so we draw every row that
+	 * is not in place after moving the content */
+	ret = kmscon_text_prepare_age(scr->txt, shift ? 0 : prev);
+	if (ret) {
+		log_warning("cannot prepare text-renderer for display %p",
+			    scr->disp);
+		return;
+	}
+
+	if (fast) {
+		draw_fast(scr);
+	} else if (shift) {
+		memcpy(scr->moved, scr->buf_hashes[buf],
+		       rows * sizeof(*scr->moved));
+		ret = kmscon_text_move(scr->txt, dst + shift, dst, num);
+		if (!ret)
+			memcpy(&scr->moved[dst],
+			       &scr->buf_hashes[buf][dst + shift],
+			       num * sizeof(*scr->moved));
+		else
+			memset(scr->moved, 0, rows * sizeof(*scr->moved));
+
+		age = screen_draw(scr, snap, scroll_draw_cb, scr);
+	} else {
+		age = screen_draw(scr, snap, kmscon_text_draw_cb, scr->txt);
+	}
+	if (reset)
+		age = 0;
+
+	if (im)
 		im_draw(scr->term->im, im_preedit_draw_callback, im_candidates_draw_callback, scr->txt->cols, scr->txt);
-	kmscon_text_render(scr->txt);
+	ret = kmscon_text_render(scr->txt);
+
+	if (hashing && !ret) {
+		memcpy(scr->buf_hashes[buf], scr->hashes,
+		       rows * sizeof(*scr->hashes));
+		/* the input method draws over the last row */
+		if (im && rows)
+			scr->buf_hashes[buf][rows - 1] = 0;
+	}
+
+	res->rendered = true;
+	res->ret = ret;
+	res->buf = buf;
+	res->valid = valid;
+	res->fast = fast;
+	res->shift = shift != 0;
+	res->age = age;
+	res->prev = prev;
+}
+
+static void finish_frame(struct screen *scr)
+{
+	struct frame_result *res = &scr->result;
+	bool wrapped = false;
+	int ret;
+
+	if (!res->rendered) {
+		backpressure_release(scr->term);
+		return;
+	}
+	res->rendered = false;
+
+	if (res->ret && res->shift) {
+		/* the content was moved but not completely redrawn */
+		scr->age[res->buf] = 0;
+	} else if (!res->ret && res->valid) {
+		/* The age counter of the console wrapped around. We cannot
+		 * trust any buffer anymore so redraw everything. */
+		if (res->age < res->prev) {
+			invalidate_all(scr->term);
+			wrapped = true;
+		} else {
+			scr->age[res->buf] = res->age;
+		}
+	}
 
 	ret = uterm_display_swap(scr->disp, false);
 	if (ret) {
 		log_warning("cannot swap display %p", scr->disp);
+		backpressure_release(scr->term);
 		return;
 	}
 
 	scr->swapping = true;
+	if (wrapped)
+		scr->pending = true;
+
+	++scr->term->frames;
+	if (res->fast)
+		++scr->term->fast_frames;
+	else if (res->shift && !res->ret)
+		++scr->term->scroll_frames;
 }
 
-static void redraw_screen(struct screen *scr)
+static void do_redraw_screen(struct screen *scr)
 {
 	if (!scr->term->awake)
 		return;
 
-	if (scr->swapping)
-		scr->pending = true;
+	scr->pending = false;
+	render_frame(scr, NULL);
+	finish_frame(scr);
+}
+
+/*
+ * Frame scheduling
+ * Console updates only mark the screens as pending. The frames are rendered
+ * from an idle-callback so all data that is available on the pty is parsed
+ * before we render a single frame. Screens that are still waiting for a
+ * page-flip are rendered when the page-flip event arrives, so each screen
+ * renders at most one frame per vblank. If --max-fps is given, we
+ * additionally delay frames via a timer.
+ */
+
+/*
+ * Frame-rate governor
+ * On slow machines, rendering a full frame on each vblank during output floods
+ * keeps the event loop busy so input and the pty are starved. If --render-budget
+ * is set, we measure the time spent rendering each frame and lower the frame
+ * rate of the display step by step if it repeatedly exceeds the budget. Once
+ * the output goes idle, the full rate is restored. Frames rendered shortly
+ * after a keypress are never delayed so interactive echo stays responsive.
+ */
+
+static const unsigned int governor_fps[] = { 0, 30, 10 };
+
+#define GOVERNOR_LEVELS (sizeof(governor_fps) / sizeof(*governor_fps))
+#define GOVERNOR_SLOW_FRAMES 3
+#define GOVERNOR_BASE_FPS 60
+#define GOVERNOR_IDLE_USEC 250000ULL
+#define GOVERNOR_ECHO_USEC 100000ULL
+
+static void governor_set(struct screen *scr, unsigned int level)
+{
+	if (level == scr->gov_level)
+		return;
+
+	scr->gov_level = level;
+	scr->gov_slow = 0;
+
+	if (level)
+		log_info("rendering on display %p exceeds budget, limiting to %u fps (%" PRIu64 " frames dropped)",
+			 scr->disp, governor_fps[level], scr->gov_dropped);
 	else
-		do_redraw_screen(scr);
+		log_info("output on display %p idle, restoring full frame rate (%" PRIu64 " frames dropped)",
+			 scr->disp, scr->gov_dropped);
+}
+
+/* returns the minimal time between frames the governor enforces */
+static uint64_t governor_interval(struct screen *scr, uint64_t elapsed)
+{
+	struct kmscon_terminal *term = scr->term;
+
+	if (!term->conf->render_budget || !scr->gov_level)
+		return 0;
+
+	/* nothing was pending for a while after the last frame */
+	if (elapsed >= scr->gov_cost + GOVERNOR_IDLE_USEC) {
+		governor_set(scr, 0);
+		return 0;
+	}
+
+	if (shl_timer_elapsed(&term->input_time) < GOVERNOR_ECHO_USEC)
+		return 0;
+
+	return 1000000ULL / governor_fps[scr->gov_level];
+}
+
+static void governor_update(struct screen *scr, uint64_t elapsed,
+			    uint64_t cost)
+{
+	struct kmscon_terminal *term = scr->term;
+	uint64_t base;
+
+	if (!term->conf->render_budget)
+		return;
+
+	scr->gov_cost = cost;
+
+	/* estimate the frames we would have rendered without the governor */
+	if (scr->gov_delayed) {
+		scr->gov_delayed = false;
+		if (term->conf->max_fps &&
+		    term->conf->max_fps < GOVERNOR_BASE_FPS)
+			base = 1000000ULL / term->conf->max_fps;
+		else
+			base = 1000000ULL / GOVERNOR_BASE_FPS;
+		if (elapsed > base) {
+			scr->gov_dropped += elapsed / base - 1;
+			term->gov_dropped += elapsed / base - 1;
+		}
+	}
+
+	if (cost <= term->conf->render_budget * 1000ULL) {
+		scr->gov_slow = 0;
+		return;
+	}
+
+	if (++scr->gov_slow >= GOVERNOR_SLOW_FRAMES &&
+	    scr->gov_level + 1 < GOVERNOR_LEVELS)
+		governor_set(scr, scr->gov_level + 1);
+}
+
+static void frame_timer_arm(struct kmscon_terminal *term, uint64_t usecs)
+{
+	struct itimerspec spec;
+	int ret;
+
+	if (term->frame_timer_armed)
+		return;
+
+	memset(&spec, 0, sizeof(spec));
+	spec.it_value.tv_sec = usecs / 1000000;
+	spec.it_value.tv_nsec = (usecs % 1000000) * 1000;
+	if (!spec.it_value.tv_sec && !spec.it_value.tv_nsec)
+		spec.it_value.tv_nsec = 1000;
+
+	ret = ev_timer_update(term->frame_timer, &spec);
+	if (ret) {
+		log_warning("cannot arm frame timer: %d", ret);
+		return;
+	}
+
+	term->frame_timer_armed = true;
+}
+
+/*
+ * Render Thread
+ * With --async-render, each terminal starts a render thread. Instead of
+ * rendering a frame on the event loop, the visible cells of the console are
+ * copied into a snapshot of the screen and the screen is passed to the thread
+ * via a lock-free single-producer/single-consumer queue. The thread renders
+ * the frame from the snapshot and passes the screen back via a second queue
+ * and an eventfd-counter. The event loop then presents the frame. Page-flips
+ * and their events belong to the event loop, so only rasterization happens on
+ * the thread.
+ * Each screen has at most one frame in flight. While in flight, the thread owns
+ * the text-renderer, the display and the render state of the screen, so
+ * everything on the event loop that touches them calls render_sync() first.
+ * This is only used for displays without OpenGL as EGL contexts are bound to
+ * the thread that created them. Frames that cannot be copied, e.g., while the
+ * input method is active, are rendered on the event loop as before.
+ */
+
+static int snapshot_cb(struct tsm_screen *con,
+		       uint32_t id, const uint32_t *ch, size_t len,
+		       unsigned int width,
+		       unsigned int posx, unsigned int posy,
+		       const struct tsm_screen_attr *attr,
+		       tsm_age_t age, void *data)
+{
+	struct snapshot *snap = data;
+	struct cell_copy *cell;
+	size_t size;
+
+	if (snap->overflow)
+		return 0;
+
+	if (len > CELL_CHARS) {
+		snap->overflow = true;
+		return 0;
+	}
+
+	if (snap->num >= snap->size) {
+		size = snap->size ? snap->size * 2 : 4096;
+		cell = realloc(snap->cells, size * sizeof(*cell));
+		if (!cell) {
+			snap->overflow = true;
+			return -ENOMEM;
+		}
+		snap->cells = cell;
+		snap->size = size;
+	}
+
+	cell = &snap->cells[snap->num++];
+	cell->id = id;
+	memcpy(cell->ch, ch, len * sizeof(*ch));
+	cell->len = len;
+	cell->width = width;
+	cell->posx = posx;
+	cell->posy = posy;
+	cell->attr = *attr;
+	cell->age = age;
+
+	return 0;
+}
+
+static void *render_thread(void *data)
+{
+	struct kmscon_terminal *term = data;
+	struct screen *scr;
+	struct shl_timer cost;
+
+	while (true) {
+		if (sem_wait(&term->render_sem))
+			continue;
+
+		scr = shl_spsc_pop(&term->render_queue);
+		if (!scr) {
+			if (__atomic_load_n(&term->render_exit,
+					    __ATOMIC_ACQUIRE))
+				break;
+			continue;
+		}
+
+		shl_timer_reset(&cost);
+		render_frame(scr, &scr->snap);
+		scr->result.cost = shl_timer_elapsed(&cost);
+
+		/* cannot fail as each screen is queued at most once */
+		shl_spsc_push(&term->render_done, scr);
+		ev_counter_inc(term->render_counter, 1);
+
+		pthread_mutex_lock(&term->render_mutex);
+		if (!--term->render_busy)
+			pthread_cond_broadcast(&term->render_cond);
+		pthread_mutex_unlock(&term->render_mutex);
+	}
+
+	return NULL;
+}
+
+static void render_finish_all(struct kmscon_terminal *term)
+{
+	struct screen *scr;
+
+	while ((scr = shl_spsc_pop(&term->render_done))) {
+		scr->in_flight = false;
+		if (scr->result.rendered) {
+			++term->threaded_frames;
+			term->render_usec += scr->result.cost;
+		}
+		finish_frame(scr);
+		governor_update(scr, scr->flight_elapsed, scr->result.cost);
+
+		/* the console changed while the frame was rendered */
+		if (scr->pending && !scr->swapping)
+			frame_timer_arm(term, 0);
+	}
+}
+
+/* waits for all frames in flight and presents them */
+static void render_sync(struct kmscon_terminal *term)
+{
+	if (!term->render_running)
+		return;
+
+	pthread_mutex_lock(&term->render_mutex);
+	while (term->render_busy)
+		pthread_cond_wait(&term->render_cond, &term->render_mutex);
+	pthread_mutex_unlock(&term->render_mutex);
+
+	render_finish_all(term);
+}
+
+static void render_counter_event(struct ev_counter *cnt, uint64_t num,
+				 void *data)
+{
+	struct kmscon_terminal *term = data;
+
+	render_finish_all(term);
+}
+
+/*
+ * Passes the next frame of @scr to the render thread. Returns 0 on success or
+ * a negative error code if the frame must be rendered on the event loop.
+ */
+static int render_submit(struct screen *scr, uint64_t elapsed)
+{
+	struct kmscon_terminal *term = scr->term;
+	struct snapshot *snap = &scr->snap;
+
+	/* the input method draws directly into the text-renderer */
+	if (im_isactive(term->im))
+		return -EAGAIN;
+
+	snap->num = 0;
+	snap->overflow = false;
+	snap->age = tsm_screen_draw(term->console, snapshot_cb, snap);
+	if (snap->overflow)
+		return -ENOMEM;
+
+	pthread_mutex_lock(&term->render_mutex);
+	++term->render_busy;
+	pthread_mutex_unlock(&term->render_mutex);
+
+	if (!shl_spsc_push(&term->render_queue, scr)) {
+		pthread_mutex_lock(&term->render_mutex);
+		if (!--term->render_busy)
+			pthread_cond_broadcast(&term->render_cond);
+		pthread_mutex_unlock(&term->render_mutex);
+		return -EAGAIN;
+	}
+
+	scr->pending = false;
+	scr->in_flight = true;
+	scr->flight_elapsed = elapsed;
+	sem_post(&term->render_sem);
+
+	return 0;
+}
+
+static int render_start(struct kmscon_terminal *term)
+{
+	sigset_t mask, omask;
+	int ret;
+
+	ret = shl_spsc_init(&term->render_queue, RENDER_QUEUE);
+	if (ret)
+		return ret;
+
+	ret = shl_spsc_init(&term->render_done, RENDER_QUEUE);
+	if (ret)
+		goto err_queue;
+
+	ret = ev_eloop_new_counter(term->eloop, &term->render_counter,
+				   render_counter_event, term);
+	if (ret)
+		goto err_done;
+
+	if (sem_init(&term->render_sem, 0, 0)) {
+		ret = -errno;
+		goto err_counter;
+	}
+
+	pthread_mutex_init(&term->render_mutex, NULL);
+	pthread_cond_init(&term->render_cond, NULL);
+	term->render_busy = 0;
+	term->render_exit = false;
+
+	/* leave all signals to the signalfd of the event loop */
+	sigfillset(&mask);
+	pthread_sigmask(SIG_SETMASK, &mask, &omask);
+	ret = -pthread_create(&term->render_tid, NULL, render_thread, term);
+	pthread_sigmask(SIG_SETMASK, &omask, NULL);
+	if (ret)
+		goto err_sem;
+
+	term->render_running = true;
+	return 0;
+
+err_sem:
+	pthread_cond_destroy(&term->render_cond);
+	pthread_mutex_destroy(&term->render_mutex);
+	sem_destroy(&term->render_sem);
+err_counter:
+	ev_eloop_rm_counter(term->render_counter);
+err_done:
+	shl_spsc_destroy(&term->render_done);
+err_queue:
+	shl_spsc_destroy(&term->render_queue);
+	return ret;
+}
+
+static void render_stop(struct kmscon_terminal *term)
+{
+	if (!term->render_running)
+		return;
+
+	render_sync(term);
+
+	__atomic_store_n(&term->render_exit, true, __ATOMIC_RELEASE);
+	sem_post(&term->render_sem);
+	pthread_join(term->render_tid, NULL);
+	term->render_running = false;
+
+	pthread_cond_destroy(&term->render_cond);
+	pthread_mutex_destroy(&term->render_mutex);
+	sem_destroy(&term->render_sem);
+	ev_eloop_rm_counter(term->render_counter);
+	shl_spsc_destroy(&term->render_done);
+	shl_spsc_destroy(&term->render_queue);
+}
+
+static void flush_screen(struct screen *scr)
+{
+	struct kmscon_terminal *term = scr->term;
+	uint64_t interval = 0, elapsed, gov, cost_usec;
+	struct shl_timer cost;
+
+	if (!scr->pending || scr->swapping || scr->in_flight)
+		return;
+
+	elapsed = shl_timer_elapsed(&scr->frame);
+	if (term->conf->max_fps)
+		interval = 1000000ULL / term->conf->max_fps;
+
+	gov = governor_interval(scr, elapsed);
+	if (gov > interval) {
+		interval = gov;
+		if (elapsed < interval)
+			scr->gov_delayed = true;
+	}
+
+	if (elapsed < interval) {
+		frame_timer_arm(term, interval - elapsed);
+		return;
+	}
+
+	shl_timer_reset(&scr->frame);
+	if (scr->threaded && !render_submit(scr, elapsed))
+		return;
+
+	/* the render thread may share the display with other screens */
+	render_sync(term);
+	shl_timer_reset(&cost);
+	do_redraw_screen(scr);
+	cost_usec = shl_timer_elapsed(&cost);
+	term->render_usec += cost_usec;
+	governor_update(scr, elapsed, cost_usec);
+}
+
+static void flush_all(struct kmscon_terminal *term)
+{
+	struct shl_dlist *iter;
+	struct screen *scr;
+
+	if (!term->awake)
+		return;
+
+	shl_dlist_for_each(iter, &term->screens) {
+		scr = shl_dlist_entry(iter, struct screen, list);
+		flush_screen(scr);
+	}
+
+	if (term->control_pending) {
+		term->control_pending = false;
+		if (term->controled)
+			control_event(term);
+	}
+}
+
+static void redraw_idle(struct ev_eloop *eloop, void *unused, void *data)
+{
+	struct kmscon_terminal *term = data;
+
+	term->redraw_scheduled = false;
+	flush_all(term);
+}
+
+static void frame_timer_event(struct ev_timer *timer, uint64_t num,
+			      void *data)
+{
+	struct kmscon_terminal *term = data;
+
+	term->frame_timer_armed = false;
+	flush_all(term);
+}
+
+static void schedule_redraw(struct kmscon_terminal *term)
+{
+	int ret;
+
+	if (term->redraw_scheduled)
+		return;
+
+	ret = ev_eloop_register_idle_cb(term->eloop, redraw_idle, term,
+					EV_ONESHOT | EV_SINGLE);
+	if (ret) {
+		log_warning("cannot schedule redraw: %d", ret);
+		flush_all(term);
+		return;
+	}
+
+	term->redraw_scheduled = true;
+}
+
+static void redraw_screen(struct screen *scr)
+{
+	if (!scr->term->awake)
+		return;
+
+	scr->pending = true;
+	schedule_redraw(scr->term);
 }
 
 static void redraw_all(struct kmscon_terminal *term)
@@ -337,10 +1328,11 @@ static void redraw_all(struct kmscon_terminal *term)
 
 	shl_dlist_for_each(iter, &term->screens) {
 		scr = shl_dlist_entry(iter, struct screen, list);
-		redraw_screen(scr);
+		scr->pending = true;
 	}
-	if (term->controled )
-		control_event (term);
+
+	term->control_pending = true;
+	schedule_redraw(term);
 }
 
 static void redraw_all_test(struct kmscon_terminal *term)
@@ -351,10 +1343,12 @@ static void redraw_all_test(struct kmscon_terminal *term)
 	if (!term->awake)
 		return;
 
+	render_sync(term);
 	shl_dlist_for_each(iter, &term->screens) {
 		scr = shl_dlist_entry(iter, struct screen, list);
 		if (uterm_display_is_swapping(scr->disp))
 			scr->swapping = true;
+		invalidate_screen(scr);
 		redraw_screen(scr);
 	}
 }
@@ -367,9 +1361,11 @@ static void display_event(struct uterm_display *disp,
 	if (ev->action != UTERM_PAGE_FLIP)
 		return;
 
+	/* if nothing is pending, the frame shows all parsed output */
 	scr->swapping = false;
-	if (scr->pending)
-		do_redraw_screen(scr);
+	if (!scr->pending)
+		backpressure_release(scr->term);
+	flush_screen(scr);
 }
 
 /*
@@ -406,6 +1402,7 @@ static void terminal_resize(struct kmscon_terminal *term,
 		return;
 
 	tsm_screen_resize(term->console, term->min_cols, im_isactive(term->im) ? term->min_rows - 1: term->min_rows);
+	invalidate_all(term);
 
 	kmscon_pty_resize(term->pty, term->min_cols, term->min_rows);
 	redraw_all(term);
@@ -438,6 +1435,7 @@ static int font_set(struct kmscon_terminal *term)
 	term->font = font;
 	term->bold_font = bold_font;
 
+	render_sync(term);
 	term->min_cols = 0;
 	term->min_rows = 0;
 	shl_dlist_for_each(iter, &term->screens) {
@@ -447,6 +1445,7 @@ static int font_set(struct kmscon_terminal *term)
 		if (ret)
 			log_warning("cannot change text-renderer font: %d",
 				    ret);
+		invalidate_screen(ent);
 
 		terminal_resize(term,
 				kmscon_text_get_cols(ent->txt),
@@ -480,6 +1479,7 @@ static int add_display(struct kmscon_terminal *term, struct uterm_display *disp)
 	memset(scr, 0, sizeof(*scr));
 	scr->term = term;
 	scr->disp = disp;
+	shl_timer_reset(&scr->frame);
 
 	ret = uterm_display_register_cb(scr->disp, display_event, scr);
 	if (ret) {
@@ -488,6 +1488,7 @@ static int add_display(struct kmscon_terminal *term, struct uterm_display *disp)
 	}
 
 	ret = uterm_display_use(scr->disp, &opengl);
+	scr->threaded = term->render_running && !(ret >= 0 && opengl);
 	if (term->conf->render_engine)
 		be = term->conf->render_engine;
 	else if (ret >= 0 && opengl)
@@ -500,6 +1501,8 @@ static int add_display(struct kmscon_terminal *term, struct uterm_display *disp)
 		log_error("cannot create text-renderer");
 		goto err_cb;
 	}
+	kmscon_text_set_cache_size(scr->txt,
+				   (size_t)term->conf->glyph_cache * 1024);
 
 	ret = kmscon_text_set(scr->txt, term->font, term->bold_font,
 			      scr->disp);
@@ -536,11 +1539,18 @@ static void free_screen(struct screen *scr, bool update)
 	struct kmscon_terminal *term = scr->term;
 
 	log_debug("destroying terminal screen %p", scr);
+	if (scr->gov_dropped)
+		log_debug("governor dropped %" PRIu64 " frames on display %p",
+			  scr->gov_dropped, scr->disp);
+	render_sync(term);
 	shl_dlist_unlink(&scr->list);
 	kmscon_text_unref(scr->txt);
 	uterm_display_unregister_cb(scr->disp, display_event, scr);
 	uterm_display_unref(scr->disp);
+	free_hashes(scr);
+	free(scr->snap.cells);
 	free(scr);
+	backpressure_release(term);
 
 	if (!update)
 		return;
@@ -576,6 +1586,43 @@ static void rm_display(struct kmscon_terminal *term, struct uterm_display *disp)
 	free_screen(scr, true);
 }
 
+/*
+ * Video backends refresh a display after it was changed behind our back, like
+ * fbdev when another VT changed the mode while we were asleep. The buffers the
+ * text renderer got may be gone then, so it is set up again on the display.
+ */
+static void refresh_display(struct kmscon_terminal *term,
+			    struct uterm_display *disp)
+{
+	struct shl_dlist *iter;
+	struct screen *scr;
+	int ret;
+
+	render_sync(term);
+	term->min_cols = 0;
+	term->min_rows = 0;
+	shl_dlist_for_each(iter, &term->screens) {
+		scr = shl_dlist_entry(iter, struct screen, list);
+
+		if (scr->disp == disp) {
+			ret = kmscon_text_set(scr->txt, term->font,
+					      term->bold_font, scr->disp);
+			if (ret)
+				log_warning("cannot set up text-renderer again on display %p: %d",
+					    disp, ret);
+			invalidate_screen(scr);
+		}
+
+		terminal_resize(term,
+				kmscon_text_get_cols(scr->txt),
+				kmscon_text_get_rows(scr->txt),
+				false, false);
+	}
+
+	terminal_resize(term, 0, 0, true, true);
+	redraw_all_test(term);
+}
+
 static void input_event(struct uterm_input *input,
 			struct uterm_input_event *ev,
 			void *data)
@@ -673,12 +1720,14 @@ static void input_event(struct uterm_input *input,
 
 	if (ev->handled)
 	{
+		shl_timer_reset(&term->input_time);
 		redraw_all(term);
 		return;
 	}
 
 	if (tsm_vte_handle_keyboard(term->vte, ev->keysyms[0], ev->ascii,
 				    ev->mods, ev->codepoints[0])) {
+		shl_timer_reset(&term->input_time);
 		tsm_screen_sb_reset(term->console);
 		redraw_all(term);
 		ev->handled = true;
@@ -715,6 +1764,7 @@ static int terminal_open(struct kmscon_terminal *term)
 		return ret;
 
 	term->opened = true;
+	term->backlog = 0;
 	redraw_all(term);
 	return 0;
 }
@@ -731,6 +1781,9 @@ static void terminal_destroy(struct kmscon_terminal *term)
 
 	terminal_close(term);
 	rm_all_screens(term);
+	render_stop(term);
+	ev_eloop_unregister_idle_cb(term->eloop, redraw_idle, term, EV_SINGLE);
+	ev_eloop_rm_timer(term->frame_timer);
 	uterm_input_unregister_cb(term->input, input_event, term);
 	ev_eloop_rm_fd(term->ptyfd);
 	kmscon_pty_unref(term->pty);
@@ -760,7 +1813,7 @@ static int session_event(struct kmscon_session *session,
 		rm_display(term, ev->disp);
 		break;
 	case KMSCON_SESSION_DISPLAY_REFRESH:
-		redraw_all_test(term);
+		refresh_display(term, ev->disp);
 		break;
 	case KMSCON_SESSION_ACTIVATE:
 		term->awake = true;
@@ -769,7 +1822,9 @@ static int session_event(struct kmscon_session *session,
 		redraw_all_test(term);
 		break;
 	case KMSCON_SESSION_DEACTIVATE:
+		render_sync(term);
 		term->awake = false;
+		backpressure_release(term);
 		break;
 	case KMSCON_SESSION_UNREGISTER:
 		terminal_destroy(term);
@@ -789,6 +1844,7 @@ static void pty_input(struct kmscon_pty *pty, const char *u8, size_t len, void *
 	} else {
 		tsm_vte_input(term->vte, u8, len);
 		redraw_all(term);
+		backpressure_add(term, len);
 	}
 }
 
@@ -807,6 +1863,48 @@ static void pty_event(struct ev_fd *fd, int mask, void *data)
 	kmscon_pty_dispatch(term->pty);
 }
 
+int kmscon_terminal_get_stats(struct kmscon_session *session,
+			      struct kmscon_terminal_stats *out)
+{
+	struct kmscon_terminal *term;
+	struct shl_dlist *iter;
+	struct screen *scr;
+	unsigned int fps;
+
+	if (!session || !out)
+		return -EINVAL;
+
+	/* only terminal sessions carry a kmscon_terminal as their data */
+	if (kmscon_session_get_cb(session) != session_event)
+		return -EINVAL;
+
+	term = kmscon_session_get_data(session);
+	if (!term)
+		return -EINVAL;
+
+	/* collect the frames still on the render thread so their counters
+	 * are included */
+	render_sync(term);
+
+	memset(out, 0, sizeof(*out));
+	out->frames_dropped = term->gov_dropped;
+	out->frames = term->frames;
+	out->fast_frames = term->fast_frames;
+	out->scroll_frames = term->scroll_frames;
+	out->threaded_frames = term->threaded_frames;
+	out->render_usec = term->render_usec;
+	kmscon_pty_get_stats(term->pty, &out->pty);
+
+	shl_dlist_for_each(iter, &term->screens) {
+		scr = shl_dlist_entry(iter, struct screen, list);
+		fps = governor_fps[scr->gov_level];
+		if (fps && (!out->fps_limit || fps < out->fps_limit))
+			out->fps_limit = fps;
+	}
+
+	return 0;
+}
+
 int kmscon_terminal_register(struct kmscon_session **out,
 			     struct kmscon_seat *seat, unsigned int vtnr)
 {
@@ -859,6 +1957,16 @@ int kmscon_terminal_register(struct kmscon_session **out,
 		goto err_font;
 
 	kmscon_pty_set_env_reset(term->pty, term->conf->reset_env);
+	kmscon_pty_set_read_budget(term->pty, term->conf->pty_read_budget);
+
+	ret = kmscon_pty_set_record(term->pty, term->conf->record);
+	if (ret)
+		goto err_pty;
+
+	ret = kmscon_pty_set_replay(term->pty, term->conf->replay,
+				    term->conf->replay_fast);
+	if (ret)
+		goto err_pty;
 
 	ret = kmscon_pty_set_term(term->pty, term->conf->term);
 	if (ret)
@@ -888,10 +1996,22 @@ int kmscon_terminal_register(struct kmscon_session **out,
 	if (ret)
 		goto err_pty;
 
-	ret = uterm_input_register_cb(term->input, input_event, term);
+	ret = ev_eloop_new_timer(term->eloop, &term->frame_timer, NULL,
+				 frame_timer_event, term);
 	if (ret)
 		goto err_ptyfd;
 
+	if (term->conf->async_render) {
+		ret = render_start(term);
+		if (ret)
+			log_warning("cannot start render thread, rendering on the event loop: %d",
+				    ret);
+	}
+
+	ret = uterm_input_register_cb(term->input, input_event, term);
+	if (ret)
+		goto err_render;
+
 	ret = kmscon_seat_register_session(seat, &term->session, session_event,
 					   term);
 	if (ret) {
@@ -940,6 +2060,9 @@ err_uterm:
 
 err_input:
 	uterm_input_unregister_cb(term->input, input_event, term);
+err_render:
+	render_stop(term);
+	ev_eloop_rm_timer(term->frame_timer);
 err_ptyfd:
 	ev_eloop_rm_fd(term->ptyfd);
 err_pty:
@@ -34,14 +34,38 @@
 #define KMSCON_TERMINAL_H
 
 #include <errno.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include "kmscon_seat.h"
+#include "pty.h"
+
+struct kmscon_terminal_stats {
+	/* frame rate the governor limits the slowest display to; 0 if the
+	 * displays run at their full rate */
+	unsigned int fps_limit;
+	/* estimated frames the governor dropped on all displays */
+	uint64_t frames_dropped;
+	/* frames presented on all displays */
+	uint64_t frames;
+	/* frames that only redrew the few changed cells */
+	uint64_t fast_frames;
+	/* frames that moved scrolled rows instead of redrawing them */
+	uint64_t scroll_frames;
+	/* frames rendered on the render thread */
+	uint64_t threaded_frames;
+	/* time in usecs spent rendering frames */
+	uint64_t render_usec;
+	/* read statistics of the pty */
+	struct kmscon_pty_stats pty;
+};
 
 #ifdef BUILD_ENABLE_SESSION_TERMINAL
 
 int kmscon_terminal_register(struct kmscon_session **out,
 			     struct kmscon_seat *seat,
 			     unsigned int vtnr);
+int kmscon_terminal_get_stats(struct kmscon_session *session,
+			      struct kmscon_terminal_stats *out);
 
 #else /* !BUILD_ENABLE_SESSION_TERMINAL */
 
@@ -52,6 +76,12 @@ static inline int kmscon_terminal_register(struct kmscon_session **out,
 	return -EOPNOTSUPP;
 }
 
+static inline int kmscon_terminal_get_stats(struct kmscon_session *session,
+					    struct kmscon_terminal_stats *out)
+{
+	return -EOPNOTSUPP;
+}
+
 #endif /* BUILD_ENABLE_SESSION_TERMINAL */
 
 #endif /* KMSCON_TERMINAL_H */
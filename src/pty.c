@@ -26,6 +26,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <poll.h>
 #include <pthread.h>
 #include <pty.h>
 #include <signal.h>
@@ -34,18 +35,24 @@
 #include <string.h>
 #include <sys/ioctl.h>
 #include <sys/signalfd.h>
+#include <sys/uio.h>
 #include <termios.h>
 #include <unistd.h>
+#include "cast.h"
 #include "eloop.h"
 #include "pty.h"
 #include "shl_log.h"
 #include "shl_misc.h"
 #include "shl_ring.h"
+#include "shl_timer.h"
 
 #define LOG_SUBSYSTEM "pty"
 
 #define KMSCON_NREAD 16384
 
+/* default time in usecs we read from the pty per wakeup */
+#define KMSCON_READ_BUDGET 5000
+
 struct kmscon_pty {
 	unsigned long ref;
 	struct ev_eloop *eloop;
@@ -54,7 +61,12 @@ struct kmscon_pty {
 	pid_t child;
 	struct ev_fd *efd;
 	struct shl_ring *msgbuf;
+
 	char io_buf[KMSCON_NREAD];
+	uint64_t read_budget;
+	struct kmscon_pty_stats stats;
+	bool paused;
+	struct kmscon_cast *cast;
 
 	kmscon_pty_input_cb input_cb;
 	void *data;
@@ -65,6 +77,9 @@ struct kmscon_pty {
 	char *seat;
 	char *vtnr;
 	bool env_reset;
+	char *record;
+	char *replay;
+	bool replay_fast;
 };
 
 int kmscon_pty_new(struct kmscon_pty **out, kmscon_pty_input_cb input_cb,
@@ -85,6 +100,7 @@ int kmscon_pty_new(struct kmscon_pty **out, kmscon_pty_input_cb input_cb,
 	pty->ref = 1;
 	pty->input_cb = input_cb;
 	pty->data = data;
+	pty->read_budget = KMSCON_READ_BUDGET;
 
 	ret = ev_eloop_new(&pty->eloop, log_llog, NULL);
 	if (ret)
@@ -120,6 +136,8 @@ void kmscon_pty_unref(struct kmscon_pty *pty)
 
 	log_debug("free pty object");
 	kmscon_pty_close(pty);
+	free(pty->replay);
+	free(pty->record);
 	free(pty->vtnr);
 	free(pty->seat);
 	free(pty->argv);
@@ -220,6 +238,65 @@ void kmscon_pty_set_env_reset(struct kmscon_pty *pty, bool do_reset)
 	pty->env_reset = do_reset;
 }
 
+void kmscon_pty_set_read_budget(struct kmscon_pty *pty, uint64_t usecs)
+{
+	if (!pty)
+		return;
+
+	pty->read_budget = usecs;
+}
+
+/* records the output of the child to @path; NULL stops recording */
+int kmscon_pty_set_record(struct kmscon_pty *pty, const char *path)
+{
+	char *t = NULL;
+
+	if (!pty)
+		return -EINVAL;
+
+	if (path) {
+		t = strdup(path);
+		if (!t)
+			return -ENOMEM;
+	}
+
+	free(pty->record);
+	pty->record = t;
+
+	return 0;
+}
+
+/* spawns a child that replays the recording at @path instead of the login
+ * process; NULL spawns the login process again */
+int kmscon_pty_set_replay(struct kmscon_pty *pty, const char *path, bool fast)
+{
+	char *t = NULL;
+
+	if (!pty)
+		return -EINVAL;
+
+	if (path) {
+		t = strdup(path);
+		if (!t)
+			return -ENOMEM;
+	}
+
+	free(pty->replay);
+	pty->replay = t;
+	pty->replay_fast = fast;
+
+	return 0;
+}
+
+void kmscon_pty_get_stats(struct kmscon_pty *pty,
+			  struct kmscon_pty_stats *out)
+{
+	if (!pty || !out)
+		return;
+
+	*out = pty->stats;
+}
+
 int kmscon_pty_get_fd(struct kmscon_pty *pty)
 {
 	if (!pty)
@@ -241,6 +318,19 @@ static bool pty_is_open(struct kmscon_pty *pty)
 	return pty->fd >= 0;
 }
 
+/* We are edge-triggered, so updating the mask also re-arms the fd and we get
+ * the events again if the condition is still true. */
+static void update_mask(struct kmscon_pty *pty, bool writeable)
+{
+	int mask = EV_ET;
+
+	if (!pty->paused)
+		mask |= EV_READABLE;
+	if (writeable)
+		mask |= EV_WRITEABLE;
+	ev_fd_update(pty->efd, mask);
+}
+
 static void __attribute__((noreturn))
 exec_child(const char *term, const char *colorterm, char **argv,
 	   const char *seat, const char *vtnr, bool env_reset)
@@ -374,6 +464,70 @@ err_out:
 	exit(EXIT_FAILURE);
 }
 
+/*
+ * The replay child writes the recorded output to the slave. The slave is put
+ * into raw mode first so the line discipline neither post-processes the
+ * output, which already was when it was recorded, nor echoes our replies to
+ * the child back as output.
+ * Output still buffered in the pty is lost once the child exits, because the
+ * terminal closes the pty then. So before exiting, the child requests a device
+ * status report and waits for the answer. The terminal parses output in
+ * order, so at that point it consumed all of the replay. Keys typed during
+ * the replay arrive on the same stdin, so only the full reply ends the wait.
+ * The child was forked from a threaded process and is not exec'ed, so it only
+ * calls async-signal-safe functions and leaves with _exit(). The recording is
+ * loaded by the parent before the fork.
+ */
+static void replay_sync(void)
+{
+	static const char reply[] = "\e[0n";
+	struct pollfd pfd;
+	char buf[64];
+	ssize_t len, i;
+	size_t matched = 0;
+
+	if (write(STDOUT_FILENO, "\e[5n", 4) != 4)
+		return;
+
+	memset(&pfd, 0, sizeof(pfd));
+	pfd.fd = STDIN_FILENO;
+	pfd.events = POLLIN;
+
+	while (poll(&pfd, 1, 10000) > 0) {
+		len = read(STDIN_FILENO, buf, sizeof(buf));
+		if (len <= 0)
+			return;
+
+		for (i = 0; i < len; ++i) {
+			if (buf[i] == reply[matched])
+				++matched;
+			else
+				matched = buf[i] == reply[0];
+
+			if (matched == sizeof(reply) - 1)
+				return;
+		}
+	}
+}
+
+static void __attribute__((noreturn))
+replay_child(struct kmscon_cast_rec *rec, bool fast)
+{
+	struct termios attr;
+	int ret;
+
+	if (tcgetattr(STDOUT_FILENO, &attr) < 0)
+		_exit(EXIT_FAILURE);
+
+	cfmakeraw(&attr);
+	if (tcsetattr(STDOUT_FILENO, TCSANOW, &attr) < 0)
+		_exit(EXIT_FAILURE);
+
+	ret = kmscon_cast_play(rec, STDOUT_FILENO, fast);
+	replay_sync();
+	_exit(ret ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
 /*
  * This is functionally equivalent to forkpty(3). We do it manually to obtain
  * a little bit more control of the process, and as a bonus avoid linking to
@@ -384,18 +538,31 @@ static int pty_spawn(struct kmscon_pty *pty, int master,
 {
 	pid_t pid;
 	struct winsize ws;
+	struct kmscon_cast_rec *rec = NULL;
+	int ret;
 
 	memset(&ws, 0, sizeof(ws));
 	ws.ws_col = width;
 	ws.ws_row = height;
 
+	if (pty->replay) {
+		ret = kmscon_cast_load(&rec, pty->replay);
+		if (ret)
+			return ret;
+		kmscon_cast_check_size(rec, width, height);
+	}
+
 	pid = fork();
 	switch (pid) {
 	case -1:
+		ret = -errno;
 		log_err("cannot fork: %m");
-		return -errno;
+		kmscon_cast_free(rec);
+		return ret;
 	case 0:
 		setup_child(master, &ws);
+		if (rec)
+			replay_child(rec, pty->replay_fast);
 		exec_child(pty->term, pty->colorterm, pty->argv, pty->seat,
 			   pty->vtnr, pty->env_reset);
 		exit(EXIT_FAILURE);
@@ -403,6 +570,7 @@ static int pty_spawn(struct kmscon_pty *pty, int master,
 		log_debug("forking child %d", pid);
 		pty->fd = master;
 		pty->child = pid;
+		kmscon_cast_free(rec);
 		break;
 	}
 
@@ -411,12 +579,12 @@ static int pty_spawn(struct kmscon_pty *pty, int master,
 
 static int send_buf(struct kmscon_pty *pty)
 {
-	const char *buf;
-	size_t len;
-	int ret;
+	struct iovec vec[2];
+	size_t num;
+	ssize_t ret;
 
-	while ((buf = shl_ring_peek(pty->msgbuf, &len, 0))) {
-		ret = write(pty->fd, buf, len);
+	while ((num = shl_ring_peek(pty->msgbuf, vec))) {
+		ret = writev(pty->fd, vec, num);
 		if (ret > 0) {
 			shl_ring_drop(pty->msgbuf, ret);
 			continue;
@@ -432,44 +600,75 @@ static int send_buf(struct kmscon_pty *pty)
 		return 0;
 	}
 
-	ev_fd_update(pty->efd, EV_READABLE | EV_ET);
+	update_mask(pty, false);
 	return 0;
 }
 
+/*
+ * Read Policy
+ * Each wakeup reads from the pty until it would block or until the read budget
+ * is used up. In the latter case, the fd is re-armed so we continue with the
+ * next dispatch and other sources, like input and rendering, get a chance to
+ * run in between. At least one read is done per wakeup, so a budget of 0 keeps
+ * the latency low on interactive consoles while large budgets favor throughput
+ * on log consoles.
+ * The read buffer has a fixed size. The kernel returns at most one page per
+ * read() on a pty master, however full the slave side is, so a larger buffer
+ * only costs memory.
+ */
+
 static int read_buf(struct kmscon_pty *pty)
 {
-	ssize_t len, num;
-	int mask;
+	struct shl_timer budget;
+	ssize_t len;
+	size_t total = 0;
+	bool again = false;
 
-	/* Use a maximum of 50 steps to avoid staying here forever.
-	 * TODO: recheck where else a user might flush our queues and try to
-	 * install an explicit policy. */
-	num = 50;
-	do {
+	shl_timer_reset(&budget);
+	while (true) {
 		len = read(pty->fd, pty->io_buf, sizeof(pty->io_buf));
 		if (len > 0) {
+			++pty->stats.reads;
+			total += len;
+
+			kmscon_cast_output(pty->cast, pty->io_buf, len);
 			if (pty->input_cb)
 				pty->input_cb(pty, pty->io_buf, len, pty->data);
 		} else if (len == 0) {
 			log_debug("HUP during read on pty of child %d",
 				  pty->child);
 			break;
-		} else if (errno != EWOULDBLOCK) {
-			log_debug("cannot read from pty of child %d (%d): %m",
-				  pty->child, errno);
+		} else {
+			if (errno != EWOULDBLOCK)
+				log_debug("cannot read from pty of child %d (%d): %m",
+					  pty->child, errno);
+			break;
+		}
+
+		/* the input callback may have paused us */
+		if (pty->paused || !pty_is_open(pty))
+			break;
+
+		if (shl_timer_elapsed(&budget) >= pty->read_budget) {
+			again = true;
 			break;
 		}
-	} while (len > 0 && --num);
+	}
+
+	if (total) {
+		++pty->stats.wakeups;
+		pty->stats.bytes += total;
+		if (total > pty->stats.max_wakeup)
+			pty->stats.max_wakeup = total;
+	}
 
-	if (!num) {
-		log_debug("cannot read application data fast enough");
+	if (again) {
+		/* counted instead of logged as this happens on every wakeup
+		 * under load; the totals are logged when the pty is closed */
+		++pty->stats.budget_hits;
 
-		/* We are edge-triggered so update the mask to get the
-		 * EV_READABLE event again next round. */
-		mask = EV_READABLE | EV_ET;
-		if (!shl_ring_is_empty(pty->msgbuf))
-			mask |= EV_WRITEABLE;
-		ev_fd_update(pty->efd, mask);
+		/* get the EV_READABLE event again next round */
+		update_mask(pty, !shl_ring_is_empty(pty->msgbuf));
 	}
 
 	return 0;
@@ -531,6 +730,7 @@ int kmscon_pty_open(struct kmscon_pty *pty, unsigned short width,
 	if (pty_is_open(pty))
 		return -EALREADY;
 
+	pty->paused = false;
 	master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC | O_NONBLOCK);
 	if (master < 0) {
 		log_err("cannot open master: %m");
@@ -546,13 +746,20 @@ int kmscon_pty_open(struct kmscon_pty *pty, unsigned short width,
 	if (ret)
 		goto err_fd;
 
+	/* a recording that cannot be opened does not stop the terminal */
+	if (pty->record && kmscon_cast_open(&pty->cast, pty->record,
+					    width, height))
+		log_warn("cannot record output of child to %s", pty->record);
+
 	ret = pty_spawn(pty, master, width, height);
 	if (ret)
-		goto err_sig;
+		goto err_cast;
 
 	return 0;
 
-err_sig:
+err_cast:
+	kmscon_cast_close(pty->cast);
+	pty->cast = NULL;
 	ev_eloop_unregister_child_cb(pty->eloop, sig_child, pty);
 err_fd:
 	ev_eloop_rm_fd(pty->efd);
@@ -567,11 +774,20 @@ void kmscon_pty_close(struct kmscon_pty *pty)
 	if (!pty || !pty_is_open(pty))
 		return;
 
+	if (pty->stats.wakeups)
+		log_debug("read %" PRIu64 " bytes in %" PRIu64 " wakeups (%" PRIu64 " bytes per wakeup, at most %" PRIu64 ", %" PRIu64 " over budget, %" PRIu64 " pauses)",
+			  pty->stats.bytes, pty->stats.wakeups,
+			  pty->stats.bytes / pty->stats.wakeups,
+			  pty->stats.max_wakeup, pty->stats.budget_hits,
+			  pty->stats.pauses);
+
 	ev_eloop_rm_fd(pty->efd);
 	pty->efd = NULL;
 	ev_eloop_unregister_child_cb(pty->eloop, sig_child, pty);
 	close(pty->fd);
 	pty->fd = -1;
+	kmscon_cast_close(pty->cast);
+	pty->cast = NULL;
 }
 
 int kmscon_pty_write(struct kmscon_pty *pty, const char *u8, size_t len)
@@ -597,7 +813,7 @@ int kmscon_pty_write(struct kmscon_pty *pty, const char *u8, size_t len)
 		u8 = &u8[ret];
 	}
 
-	ev_fd_update(pty->efd, EV_READABLE | EV_WRITEABLE | EV_ET);
+	update_mask(pty, true);
 
 buf:
 	ret = shl_ring_write(pty->msgbuf, u8, len);
@@ -607,6 +823,31 @@ buf:
 	return 0;
 }
 
+/*
+ * Flow Control
+ * While paused, we stop reading from the pty. Once the kernel buffer of the
+ * pty is full, writes of the child block, so the child is throttled to the
+ * rate we consume its output. Writing to the child is not affected.
+ */
+void kmscon_pty_pause(struct kmscon_pty *pty)
+{
+	if (!pty || !pty_is_open(pty) || pty->paused)
+		return;
+
+	pty->paused = true;
+	++pty->stats.pauses;
+	update_mask(pty, !shl_ring_is_empty(pty->msgbuf));
+}
+
+void kmscon_pty_resume(struct kmscon_pty *pty)
+{
+	if (!pty || !pty_is_open(pty) || !pty->paused)
+		return;
+
+	pty->paused = false;
+	update_mask(pty, !shl_ring_is_empty(pty->msgbuf));
+}
+
 void kmscon_pty_signal(struct kmscon_pty *pty, int signum)
 {
 	int ret;
@@ -645,4 +886,6 @@ void kmscon_pty_resize(struct kmscon_pty *pty,
 		log_warn("cannot set window size");
 		return;
 	}
+
+	kmscon_cast_resize(pty->cast, width, height);
 }
@@ -43,10 +43,27 @@
 #define KMSCON_PTY_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 
 struct kmscon_pty;
 
+/* read statistics of a pty; all counters are cumulative */
+struct kmscon_pty_stats {
+	/* wakeups that read any data */
+	uint64_t wakeups;
+	/* read() calls that returned data */
+	uint64_t reads;
+	/* bytes read */
+	uint64_t bytes;
+	/* most bytes read during a single wakeup */
+	uint64_t max_wakeup;
+	/* wakeups that stopped because the read budget was used up */
+	uint64_t budget_hits;
+	/* times reading was paused via kmscon_pty_pause() */
+	uint64_t pauses;
+};
+
 typedef void (*kmscon_pty_input_cb)
 	(struct kmscon_pty *pty, const char *u8, size_t len, void *data);
 
@@ -60,6 +77,11 @@ int kmscon_pty_set_argv(struct kmscon_pty *pty, char **argv);
 int kmscon_pty_set_seat(struct kmscon_pty *pty, const char *seat);
 int kmscon_pty_set_vtnr(struct kmscon_pty *pty, unsigned int vtnr);
 void kmscon_pty_set_env_reset(struct kmscon_pty *pty, bool do_reset);
+void kmscon_pty_set_read_budget(struct kmscon_pty *pty, uint64_t usecs);
+int kmscon_pty_set_record(struct kmscon_pty *pty, const char *path);
+int kmscon_pty_set_replay(struct kmscon_pty *pty, const char *path, bool fast);
+void kmscon_pty_get_stats(struct kmscon_pty *pty,
+			  struct kmscon_pty_stats *out);
 
 int kmscon_pty_get_fd(struct kmscon_pty *pty);
 void kmscon_pty_dispatch(struct kmscon_pty *pty);
@@ -69,6 +91,8 @@ int kmscon_pty_open(struct kmscon_pty *pty, unsigned short width,
 void kmscon_pty_close(struct kmscon_pty *pty);
 
 int kmscon_pty_write(struct kmscon_pty *pty, const char *u8, size_t len);
+void kmscon_pty_pause(struct kmscon_pty *pty);
+void kmscon_pty_resume(struct kmscon_pty *pty);
 void kmscon_pty_signal(struct kmscon_pty *pty, int signum);
 void kmscon_pty_resize(struct kmscon_pty *pty,
 			unsigned short width, unsigned short height);
@@ -165,6 +165,7 @@ static inline void shl_hashtable_remove(struct shl_hashtable *tbl, void *key)
 	     entry = htable_nextval(&tbl->tbl, &i, hash)) {
 		if (tbl->equal_cb(key, entry->key)) {
 			htable_delval(&tbl->tbl, &i);
+			free(entry);
 			return;
 		}
 	}
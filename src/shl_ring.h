@@ -26,27 +26,34 @@
 
 /*
  * A circular memory ring implementation
+ * The ring is a single contiguous buffer whose size is a power of two. Data is
+ * appended at the end and dropped from the front without moving any memory.
+ * The used bytes are exposed as up to two iovecs so they can be passed to
+ * writev() directly. The buffer grows on demand
+ * and is released once a large ring runs empty.
  */
 
 #ifndef SHL_RING_H
 #define SHL_RING_H
 
+#include <errno.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
 
-#define SHL_RING_SIZE 512
-
-struct shl_ring_entry {
-	struct shl_ring_entry *next;
-	size_t len;
-	char buf[];
-};
+/* initial size of the buffer */
+#define SHL_RING_SIZE 4096
+/* buffers up to this size are kept when the ring runs empty */
+#define SHL_RING_KEEP (64 * 1024)
 
 struct shl_ring {
-	struct shl_ring_entry *first;
-	struct shl_ring_entry *last;
+	char *buf;
+	size_t size;
+	size_t start;
+	size_t used;
 };
 
 static inline int shl_ring_new(struct shl_ring **out)
@@ -68,16 +75,10 @@ static inline int shl_ring_new(struct shl_ring **out)
 
 static inline void shl_ring_free(struct shl_ring *ring)
 {
-	struct shl_ring_entry *tmp;
-
 	if (!ring)
 		return;
 
-	while (ring->first) {
-		tmp = ring->first;
-		ring->first = tmp->next;
-		free(tmp);
-	}
+	free(ring->buf);
 	free(ring);
 }
 
@@ -86,117 +87,128 @@ static inline bool shl_ring_is_empty(struct shl_ring *ring)
 	if (!ring)
 		return true;
 
-	return ring->first == NULL;
+	return ring->used == 0;
+}
+
+static inline size_t shl_ring_get_used(struct shl_ring *ring)
+{
+	if (!ring)
+		return 0;
+
+	return ring->used;
+}
+
+/* makes room for at least @len more bytes without losing any data */
+static inline int shl_ring__grow(struct shl_ring *ring, size_t len)
+{
+	size_t need, size, wrap;
+	char *buf;
+
+	if (ring->size - ring->used >= len)
+		return 0;
+
+	need = ring->used + len;
+	if (need < len)
+		return -ENOMEM;
+
+	size = ring->size ? ring->size : SHL_RING_SIZE;
+	while (size < need) {
+		size <<= 1;
+		if (!size)
+			return -ENOMEM;
+	}
+
+	buf = realloc(ring->buf, size);
+	if (!buf)
+		return -ENOMEM;
+
+	/* The buffer at least doubled, so the wrapped part of the data fits
+	 * right behind the old end. */
+	if (ring->start + ring->used > ring->size) {
+		wrap = ring->start + ring->used - ring->size;
+		memcpy(&buf[ring->size], buf, wrap);
+	}
+
+	ring->buf = buf;
+	ring->size = size;
+	return 0;
 }
 
 static inline int shl_ring_write(struct shl_ring *ring, const char *val,
 				 size_t len)
 {
-	struct shl_ring_entry *ent;
-	size_t space, cp;
+	size_t end, cp;
+	int ret;
 
 	if (!ring || !val || !len)
 		return -EINVAL;
 
-next:
-	ent = ring->last;
-	if (!ent || ent->len >= SHL_RING_SIZE) {
-		ent = malloc(sizeof(*ent) + SHL_RING_SIZE);
-		if (!ent)
-			return -ENOMEM;
-
-		ent->len = 0;
-		ent->next = NULL;
-		if (ring->last)
-			ring->last->next = ent;
-		else
-			ring->first = ent;
-		ring->last = ent;
-	}
+	ret = shl_ring__grow(ring, len);
+	if (ret)
+		return ret;
 
-	space = SHL_RING_SIZE - ent->len;
-	if (len >= space)
-		cp = space;
-	else
+	end = (ring->start + ring->used) & (ring->size - 1);
+	cp = ring->size - end;
+	if (cp > len)
 		cp = len;
 
-	memcpy(&ent->buf[ent->len], val, cp);
-	ent->len += cp;
-
-	val = &val[cp];
-	len -= cp;
-	if (len > 0)
-		goto next;
+	memcpy(&ring->buf[end], val, cp);
+	memcpy(ring->buf, &val[cp], len - cp);
+	ring->used += len;
 
 	return 0;
 }
 
-static inline const char *shl_ring_peek(struct shl_ring *ring, size_t *len,
-					size_t offset)
+/*
+ * Fills @vec, which must have room for two entries, with the used bytes in
+ * order. Returns the number of entries, 0 if the ring is empty.
+ */
+static inline size_t shl_ring_peek(struct shl_ring *ring, struct iovec *vec)
 {
-	struct shl_ring_entry *iter;
-
-	if (!ring || !ring->first || !len) {
-		if (len)
-			*len = 0;
-		return NULL;
-	}
+	size_t first;
 
-	iter = ring->first;
-	while (iter->len <= offset) {
-		if (!iter->next) {
-			*len = 0;
-			return NULL;
-		}
+	if (!ring || !ring->used || !vec)
+		return 0;
 
-		offset -= iter->len;
-		iter = iter->next;
+	first = ring->size - ring->start;
+	vec[0].iov_base = &ring->buf[ring->start];
+	if (first >= ring->used) {
+		vec[0].iov_len = ring->used;
+		return 1;
 	}
 
-	*len = ring->first->len - offset;
-	return &ring->first->buf[offset];
+	vec[0].iov_len = first;
+	vec[1].iov_base = ring->buf;
+	vec[1].iov_len = ring->used - first;
+	return 2;
 }
 
-static inline void shl_ring_drop(struct shl_ring *ring, size_t len)
+static inline void shl_ring_flush(struct shl_ring *ring)
 {
-	struct shl_ring_entry *ent;
-
-	if (!ring || !len)
-		return;
-
-next:
-	ent = ring->first;
-	if (!ent)
+	if (!ring)
 		return;
 
-	if (len >= ent->len) {
-		len -= ent->len;
-		ring->first = ent->next;
-		free(ent);
-		if (!ring->first)
-			ring->last = NULL;
-
-		if (len)
-			goto next;
-	} else {
-		memmove(ent->buf, &ent->buf[len], ent->len - len);
-		ent->len -= len;
+	ring->start = 0;
+	ring->used = 0;
+	if (ring->size > SHL_RING_KEEP) {
+		free(ring->buf);
+		ring->buf = NULL;
+		ring->size = 0;
 	}
 }
 
-static inline void shl_ring_flush(struct shl_ring *ring)
+static inline void shl_ring_drop(struct shl_ring *ring, size_t len)
 {
-	struct shl_ring_entry *tmp;
-
-	if (!ring)
+	if (!ring || !len)
 		return;
 
-	while (ring->first) {
-		tmp = ring->first;
-		ring->first = tmp->next;
-		free(tmp);
+	if (len >= ring->used) {
+		shl_ring_flush(ring);
+		return;
 	}
-	ring->last = NULL;
+
+	ring->start = (ring->start + len) & (ring->size - 1);
+	ring->used -= len;
 }
 
 #endif /* SHL_RING_H */
@@ -0,0 +1,107 @@
+/*
+ * shl - Single-Producer/Single-Consumer Queue
+ *
+ * Copyright (c) 2011-2013 David Herrmann <dh.herrmann@googlemail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Single-Producer/Single-Consumer Queue
+ * A bounded lock-free queue of pointers between exactly one producer thread
+ * and one consumer thread. The size must be a power of two. Neither push nor
+ * pop ever block; waking up the consumer is up to the caller. Everything the
+ * producer wrote before pushing an entry is visible to the consumer once it
+ * popped that entry.
+ */
+
+#ifndef SHL_SPSC_H
+#define SHL_SPSC_H
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+struct shl_spsc {
+	unsigned int mask;
+	void **slots;
+
+	/* written by the producer only */
+	unsigned int head;
+	/* written by the consumer only */
+	unsigned int tail;
+};
+
+static inline int shl_spsc_init(struct shl_spsc *q, unsigned int size)
+{
+	if (!q || !size || (size & (size - 1)))
+		return -EINVAL;
+
+	q->slots = calloc(size, sizeof(*q->slots));
+	if (!q->slots)
+		return -ENOMEM;
+
+	q->mask = size - 1;
+	q->head = 0;
+	q->tail = 0;
+	return 0;
+}
+
+static inline void shl_spsc_destroy(struct shl_spsc *q)
+{
+	if (!q)
+		return;
+
+	free(q->slots);
+	q->slots = NULL;
+}
+
+/* returns false if the queue is full */
+static inline bool shl_spsc_push(struct shl_spsc *q, void *entry)
+{
+	unsigned int head, tail;
+
+	head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+	tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+	if (head - tail > q->mask)
+		return false;
+
+	q->slots[head & q->mask] = entry;
+	__atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+/* returns NULL if the queue is empty */
+static inline void *shl_spsc_pop(struct shl_spsc *q)
+{
+	unsigned int head, tail;
+	void *entry;
+
+	tail = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+	head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+	if (head == tail)
+		return NULL;
+
+	entry = q->slots[tail & q->mask];
+	__atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+	return entry;
+}
+
+#endif /* SHL_SPSC_H */
@@ -0,0 +1,204 @@
+/*
+ * shl - Worker Threads
+ *
+ * Copyright (c) 2011-2013 David Herrmann <dh.herrmann@googlemail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Worker Threads
+ * A small fork-join thread pool. shl_worker_run() calls the callback once for
+ * each job index and returns only after all jobs are done. The calling thread
+ * works on jobs, too, so a pool of @num threads spawns @num - 1 helpers.
+ * Helper threads block all signals so they never steal signals from the
+ * signalfd of the event loop.
+ */
+
+#ifndef SHL_WORKER_H
+#define SHL_WORKER_H
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef void (*shl_worker_cb) (void *data, unsigned int job);
+
+struct shl_worker {
+	pthread_mutex_t mutex;
+	pthread_cond_t start_cond;
+	pthread_cond_t done_cond;
+	unsigned int num;
+	pthread_t *threads;
+	bool exit;
+
+	shl_worker_cb cb;
+	void *data;
+	unsigned int jobs;
+	unsigned int next;
+	unsigned int pending;
+};
+
+/* must be called with the mutex held; drops it while running the job */
+static inline bool shl_worker__do_job(struct shl_worker *w)
+{
+	shl_worker_cb cb;
+	void *data;
+	unsigned int job;
+
+	if (w->next >= w->jobs)
+		return false;
+
+	job = w->next++;
+	cb = w->cb;
+	data = w->data;
+
+	pthread_mutex_unlock(&w->mutex);
+	cb(data, job);
+	pthread_mutex_lock(&w->mutex);
+
+	if (!--w->pending)
+		pthread_cond_signal(&w->done_cond);
+
+	return true;
+}
+
+static inline void *shl_worker__thread(void *arg)
+{
+	struct shl_worker *w = arg;
+
+	pthread_mutex_lock(&w->mutex);
+	while (!w->exit) {
+		if (!shl_worker__do_job(w))
+			pthread_cond_wait(&w->start_cond, &w->mutex);
+	}
+	pthread_mutex_unlock(&w->mutex);
+
+	return NULL;
+}
+
+static inline void shl_worker_free(struct shl_worker *w)
+{
+	unsigned int i;
+
+	if (!w)
+		return;
+
+	pthread_mutex_lock(&w->mutex);
+	w->exit = true;
+	pthread_cond_broadcast(&w->start_cond);
+	pthread_mutex_unlock(&w->mutex);
+
+	for (i = 1; i < w->num; ++i)
+		pthread_join(w->threads[i], NULL);
+
+	pthread_cond_destroy(&w->done_cond);
+	pthread_cond_destroy(&w->start_cond);
+	pthread_mutex_destroy(&w->mutex);
+	free(w->threads);
+	free(w);
+}
+
+static inline int shl_worker_new(struct shl_worker **out, unsigned int num)
+{
+	struct shl_worker *w;
+	sigset_t mask, omask;
+	int ret;
+
+	if (!out || !num)
+		return -EINVAL;
+
+	w = malloc(sizeof(*w));
+	if (!w)
+		return -ENOMEM;
+	memset(w, 0, sizeof(*w));
+
+	w->threads = malloc(sizeof(*w->threads) * num);
+	if (!w->threads) {
+		free(w);
+		return -ENOMEM;
+	}
+
+	pthread_mutex_init(&w->mutex, NULL);
+	pthread_cond_init(&w->start_cond, NULL);
+	pthread_cond_init(&w->done_cond, NULL);
+
+	/* index 0 is the calling thread */
+	w->num = 1;
+	sigfillset(&mask);
+	pthread_sigmask(SIG_SETMASK, &mask, &omask);
+	for ( ; w->num < num; ++w->num) {
+		ret = pthread_create(&w->threads[w->num], NULL,
+				     shl_worker__thread, w);
+		if (ret)
+			break;
+	}
+	pthread_sigmask(SIG_SETMASK, &omask, NULL);
+
+	if (w->num < num) {
+		shl_worker_free(w);
+		return -ret;
+	}
+
+	*out = w;
+	return 0;
+}
+
+static inline unsigned int shl_worker_get_num(struct shl_worker *w)
+{
+	return w ? w->num : 1;
+}
+
+static inline void shl_worker_run(struct shl_worker *w, shl_worker_cb cb,
+				  void *data, unsigned int jobs)
+{
+	unsigned int i;
+
+	if (!jobs)
+		return;
+
+	if (!w) {
+		for (i = 0; i < jobs; ++i)
+			cb(data, i);
+		return;
+	}
+
+	pthread_mutex_lock(&w->mutex);
+	w->cb = cb;
+	w->data = data;
+	w->jobs = jobs;
+	w->next = 0;
+	w->pending = jobs;
+	pthread_cond_broadcast(&w->start_cond);
+
+	while (shl_worker__do_job(w))
+		/* empty */ ;
+	while (w->pending)
+		pthread_cond_wait(&w->done_cond, &w->mutex);
+
+	w->jobs = 0;
+	w->next = 0;
+	pthread_mutex_unlock(&w->mutex);
+}
+
+#endif /* SHL_WORKER_H */
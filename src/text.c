@@ -263,6 +263,7 @@ int kmscon_text_set(struct kmscon_text *txt,
 	kmscon_font_ref(txt->font);
 	kmscon_font_ref(txt->bold_font);
 	uterm_display_ref(txt->disp);
+	txt->redraw = true;
 
 	return 0;
 }
@@ -295,6 +296,23 @@ void kmscon_text_unset(struct kmscon_text *txt)
 	txt->rendering = false;
 }
 
+/**
+ * kmscon_text_set_cache_size:
+ * @txt: valid text renderer
+ * @size: memory limit in bytes or 0
+ *
+ * Backends that support it keep a cache of blended glyph tiles of at most
+ * @size bytes. 0 disables the cache. This takes effect on the next call to
+ * kmscon_text_set().
+ */
+void kmscon_text_set_cache_size(struct kmscon_text *txt, size_t size)
+{
+	if (!txt)
+		return;
+
+	txt->cache_size = size;
+}
+
 /**
  * kmscon_text_get_cols:
  * @txt: valid text renderer
@@ -344,20 +362,116 @@ unsigned int kmscon_text_get_rows(struct kmscon_text *txt)
  * between, you need to restart rendering by calling kmscon_text_prepare() again
  * and redoing everything from the beginning.
  *
+ * This always redraws the whole screen. See kmscon_text_prepare_age() if you
+ * want unchanged cells to be skipped.
+ *
  * Returns: 0 on success, negative error code on failure.
  */
 int kmscon_text_prepare(struct kmscon_text *txt)
+{
+	return kmscon_text_prepare_age(txt, 0);
+}
+
+/**
+ * kmscon_text_prepare_age:
+ * @txt: valid text renderer
+ * @age: age of the frame that the target buffer currently contains
+ *
+ * Same as kmscon_text_prepare() but tells the renderer that the buffer we are
+ * going to draw into already contains the frame of age @age. Cells that are
+ * passed to kmscon_text_draw_cb() with an age not newer than @age are skipped.
+ * Pass 0 if the content of the buffer is unknown. The backend may reset the
+ * age during preparation if it cannot make use of it. The first frame after
+ * kmscon_text_set() is always fully redrawn.
+ *
+ * Returns: 0 on success, negative error code on failure.
+ */
+int kmscon_text_prepare_age(struct kmscon_text *txt, tsm_age_t age)
 {
 	int ret = 0;
 
 	if (!txt || !txt->font || !txt->disp)
 		return -EINVAL;
 
+	if (txt->redraw)
+		age = 0;
+
+	txt->age = age;
+	txt->run_len = 0;
 	txt->rendering = true;
 	if (txt->ops->prepare)
 		ret = txt->ops->prepare(txt);
 	if (ret)
 		txt->rendering = false;
+	else
+		txt->redraw = false;
+
+	return ret;
+}
+
+/*
+ * Blank Runs
+ * Most cells of a typical console are empty or contain a space. Their glyphs
+ * are blank, so drawing them only paints the background color. If the backend
+ * supports it, horizontal runs of such cells with equal background are
+ * collected here and passed to the backend as a single fill instead of being
+ * blended one by one. A run ends at the first cell that does not continue it
+ * and before the frame is rendered.
+ */
+
+static bool cell_is_blank(const uint32_t *ch, size_t len, unsigned int width,
+			  const struct tsm_screen_attr *attr)
+{
+	if (width != 1 || attr->underline)
+		return false;
+
+	return !len || (len == 1 && *ch == ' ');
+}
+
+static int flush_run(struct kmscon_text *txt)
+{
+	unsigned int len = txt->run_len;
+
+	if (!len)
+		return 0;
+
+	txt->run_len = 0;
+	return txt->ops->fill(txt, txt->run_x, txt->run_y, len,
+			      txt->run_r, txt->run_g, txt->run_b);
+}
+
+static int add_to_run(struct kmscon_text *txt,
+		      unsigned int posx, unsigned int posy,
+		      const struct tsm_screen_attr *attr)
+{
+	uint8_t r, g, b;
+	int ret;
+
+	if (attr->inverse) {
+		r = attr->fr;
+		g = attr->fg;
+		b = attr->fb;
+	} else {
+		r = attr->br;
+		g = attr->bg;
+		b = attr->bb;
+	}
+
+	if (txt->run_len && posy == txt->run_y &&
+	    posx == txt->run_x + txt->run_len &&
+	    r == txt->run_r && g == txt->run_g && b == txt->run_b) {
+		++txt->run_len;
+		return 0;
+	}
+
+	ret = flush_run(txt);
+
+	txt->run_x = posx;
+	txt->run_y = posy;
+	txt->run_len = 1;
+	txt->run_r = r;
+	txt->run_g = g;
+	txt->run_b = b;
 
 	return ret;
 }
@@ -377,6 +491,8 @@ int kmscon_text_prepare(struct kmscon_text *txt)
  * console position, not a pixel position! You must precede this call with
  * kmscon_text_prepare(). Use this function to feed all glyphs into the
  * rendering pipeline and finally call kmscon_text_render().
+ * Blank cells may be drawn only when the current run of blank cells ends, so
+ * errors of earlier cells can be reported by later calls.
  *
  * Returns: 0 on success or negative error code if this glyph couldn't be drawn.
  */
@@ -386,14 +502,68 @@ int kmscon_text_draw(struct kmscon_text *txt,
 		     unsigned int posx, unsigned int posy,
 		     const struct tsm_screen_attr *attr)
 {
+	int ret;
+
 	if (!txt || !txt->rendering)
 		return -EINVAL;
 	if (posx >= txt->cols || posy >= txt->rows || !attr)
 		return -EINVAL;
 
+	if (txt->ops->fill && cell_is_blank(ch, len, width, attr))
+		return add_to_run(txt, posx, posy, attr);
+
+	ret = flush_run(txt);
+	if (ret)
+		return ret;
+
 	return txt->ops->draw(txt, id, ch, len, width, posx, posy, attr);
 }
 
+/**
+ * kmscon_text_move:
+ * @txt: valid text renderer
+ * @src: first row to move
+ * @dst: row that @src is moved to
+ * @num: number of rows to move
+ *
+ * Moves @num rows of the frame that is currently rendered from row @src to row
+ * @dst. The rows may overlap. This must be called between
+ * kmscon_text_prepare() and the first kmscon_text_draw(). It allows scrolling
+ * the console without drawing every moved cell again. Backends that render
+ * into the display buffers directly use uterm_display_copy(), others have to
+ * provide their own implementation.
+ *
+ * Returns: 0 on success, -EOPNOTSUPP if the backend cannot move rows and any
+ * other negative error code on failure. The rows must be drawn again in both
+ * cases.
+ */
+int kmscon_text_move(struct kmscon_text *txt, unsigned int src,
+		     unsigned int dst, unsigned int num)
+{
+	unsigned int fw, fh;
+	int ret;
+
+	if (!txt || !txt->rendering)
+		return -EINVAL;
+	if (src >= txt->rows || dst >= txt->rows ||
+	    num > txt->rows - src || num > txt->rows - dst)
+		return -EINVAL;
+	if (!num || src == dst)
+		return 0;
+
+	ret = flush_run(txt);
+	if (ret)
+		return ret;
+
+	if (txt->ops->move)
+		return txt->ops->move(txt, src, dst, num);
+
+	fw = txt->font->attr.width;
+	fh = txt->font->attr.height;
+	return uterm_display_copy(txt->disp, 0, src * fh, 0, dst * fh,
+				  txt->cols * fw, num * fh);
+}
+
 /**
  * kmscon_text_render:
  * @txt: valid text renderer
@@ -410,7 +580,8 @@ int kmscon_text_render(struct kmscon_text *txt)
 	if (!txt || !txt->rendering)
 		return -EINVAL;
 
-	if (txt->ops->render)
+	ret = flush_run(txt);
+	if (!ret && txt->ops->render)
 		ret = txt->ops->render(txt);
 	txt->rendering = false;
 
@@ -432,6 +603,7 @@ void kmscon_text_abort(struct kmscon_text *txt)
 	if (!txt || !txt->rendering)
 		return;
 
+	txt->run_len = 0;
 	if (txt->ops->abort)
 		txt->ops->abort(txt);
 	txt->rendering = false;
@@ -444,5 +616,11 @@ int kmscon_text_draw_cb(struct tsm_screen *con,
 			const struct tsm_screen_attr *attr,
 			tsm_age_t age, void *data)
 {
-	return kmscon_text_draw(data, id, ch, len, width, posx, posy, attr);
+	struct kmscon_text *txt = data;
+
+	/* age 0 means the cell must always be redrawn */
+	if (age && txt->age && age <= txt->age)
+		return 0;
+
+	return kmscon_text_draw(txt, id, ch, len, width, posx, posy, attr);
 }
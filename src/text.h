@@ -57,6 +57,22 @@ struct kmscon_text {
 	unsigned int cols;
 	unsigned int rows;
 	bool rendering;
+
+	/* age of the frame that the current target already contains; cells
+	 * that did not change since then can be skipped. 0 means unknown. */
+	tsm_age_t age;
+	bool redraw;
+
+	/* memory limit of the tile cache in bytes; 0 disables it */
+	size_t cache_size;
+
+	/* run of blank cells that is not passed to the backend, yet */
+	unsigned int run_x;
+	unsigned int run_y;
+	unsigned int run_len;
+	uint8_t run_r;
+	uint8_t run_g;
+	uint8_t run_b;
 };
 
 struct kmscon_text_ops {
@@ -74,6 +90,11 @@ struct kmscon_text_ops {
 		     const struct tsm_screen_attr *attr);
 	int (*render) (struct kmscon_text *txt);
 	void (*abort) (struct kmscon_text *txt);
+	int (*move) (struct kmscon_text *txt, unsigned int src,
+		     unsigned int dst, unsigned int num);
+	int (*fill) (struct kmscon_text *txt,
+		     unsigned int posx, unsigned int posy, unsigned int num,
+		     uint8_t r, uint8_t g, uint8_t b);
 };
 
 int kmscon_text_register(const struct kmscon_text_ops *ops);
@@ -88,15 +109,19 @@ int kmscon_text_set(struct kmscon_text *txt,
 		    struct kmscon_font *bold_font,
 		    struct uterm_display *disp);
 void kmscon_text_unset(struct kmscon_text *txt);
+void kmscon_text_set_cache_size(struct kmscon_text *txt, size_t size);
 unsigned int kmscon_text_get_cols(struct kmscon_text *txt);
 unsigned int kmscon_text_get_rows(struct kmscon_text *txt);
 
 int kmscon_text_prepare(struct kmscon_text *txt);
+int kmscon_text_prepare_age(struct kmscon_text *txt, tsm_age_t age);
 int kmscon_text_draw(struct kmscon_text *txt,
 		     uint32_t id, const uint32_t *ch, size_t len,
 		     unsigned int width,
 		     unsigned int posx, unsigned int posy,
 		     const struct tsm_screen_attr *attr);
+int kmscon_text_move(struct kmscon_text *txt, unsigned int src,
+		     unsigned int dst, unsigned int num);
 int kmscon_text_render(struct kmscon_text *txt);
 void kmscon_text_abort(struct kmscon_text *txt);
 
@@ -107,6 +132,19 @@ int kmscon_text_draw_cb(struct tsm_screen *con,
 			const struct tsm_screen_attr *attr,
 			tsm_age_t age, void *data);
 
+/* tile cache for the bit-blitting backends */
+
+struct kmscon_text_cache;
+
+int kmscon_text_cache_new(struct kmscon_text_cache **out, size_t max);
+void kmscon_text_cache_free(struct kmscon_text_cache *cache);
+void kmscon_text_cache_flush(struct kmscon_text_cache *cache);
+const struct uterm_video_buffer *
+kmscon_text_cache_get(struct kmscon_text_cache *cache,
+		      const struct kmscon_glyph *glyph,
+		      uint8_t fr, uint8_t fg, uint8_t fb,
+		      uint8_t br, uint8_t bg, uint8_t bb);
+
 /* modularized backends */
 
 extern struct kmscon_text_ops kmscon_text_bblit_ops;
@@ -29,7 +29,8 @@
  * @include: text.h
  *
  * The bit-blitting renderer requires framebuffer access to the output device
- * and simply blits the glyphs into the buffer.
+ * and simply blits the glyphs into the buffer. If a tile cache is enabled,
+ * blended glyphs are cached and copied instead of being blended again.
  */
 
 #include <errno.h>
@@ -42,10 +43,37 @@
 
 #define LOG_SUBSYSTEM "text_bblit"
 
+struct bblit {
+	struct kmscon_text_cache *cache;
+	bool use_cache;
+};
+
+static int bblit_init(struct kmscon_text *txt)
+{
+	struct bblit *bl;
+
+	bl = malloc(sizeof(*bl));
+	if (!bl)
+		return -ENOMEM;
+	memset(bl, 0, sizeof(*bl));
+
+	txt->data = bl;
+	return 0;
+}
+
+static void bblit_destroy(struct kmscon_text *txt)
+{
+	struct bblit *bl = txt->data;
+
+	free(bl);
+}
+
 static int bblit_set(struct kmscon_text *txt)
 {
+	struct bblit *bl = txt->data;
 	unsigned int sw, sh, fw, fh;
 	struct uterm_mode *mode;
+	int ret;
 
 	fw = txt->font->attr.width;
 	fh = txt->font->attr.height;
@@ -58,6 +86,40 @@ static int bblit_set(struct kmscon_text *txt)
 	txt->cols = sw / fw;
 	txt->rows = sh / fh;
 
+	if (txt->cache_size) {
+		ret = kmscon_text_cache_new(&bl->cache, txt->cache_size);
+		if (ret)
+			log_warning("cannot create tile cache (%d), blending all glyphs",
+				    ret);
+	}
+
+	return 0;
+}
+
+static void bblit_unset(struct kmscon_text *txt)
+{
+	struct bblit *bl = txt->data;
+
+	kmscon_text_cache_free(bl->cache);
+	bl->cache = NULL;
+}
+
+static int bblit_prepare(struct kmscon_text *txt)
+{
+	struct bblit *bl = txt->data;
+	int ret;
+	bool opengl;
+
+	/* OpenGL back-buffers are undefined after a swap so we cannot rely on
+	 * their content and need to redraw everything. */
+	ret = uterm_display_use(txt->disp, &opengl);
+	if (ret < 0 || opengl)
+		txt->age = 0;
+
+	/* blits are uploaded as textures on OpenGL displays so caching them
+	 * does not save anything */
+	bl->use_cache = bl->cache && ret >= 0 && !opengl;
+
 	return 0;
 }
 
@@ -67,9 +129,13 @@ static int bblit_draw(struct kmscon_text *txt,
 		      unsigned int posx, unsigned int posy,
 		      const struct tsm_screen_attr *attr)
 {
+	struct bblit *bl = txt->data;
 	const struct kmscon_glyph *glyph;
 	int ret;
 	struct kmscon_font *font;
+	const struct uterm_video_buffer *tile;
+	unsigned int x, y;
+	uint8_t fr, fg, fb, br, bg, bb;
 
 	if (!width)
 		return 0;
@@ -91,33 +157,58 @@ static int bblit_draw(struct kmscon_text *txt,
 			return ret;
 	}
 
-	/* draw glyph */
+	x = posx * txt->font->attr.width;
+	y = posy * txt->font->attr.height;
 	if (attr->inverse) {
-		ret = uterm_display_fake_blend(txt->disp, &glyph->buf,
-					       posx * txt->font->attr.width,
-					       posy * txt->font->attr.height,
-					       attr->br, attr->bg, attr->bb,
-					       attr->fr, attr->fg, attr->fb);
+		fr = attr->br;
+		fg = attr->bg;
+		fb = attr->bb;
+		br = attr->fr;
+		bg = attr->fg;
+		bb = attr->fb;
 	} else {
-		ret = uterm_display_fake_blend(txt->disp, &glyph->buf,
-					       posx * txt->font->attr.width,
-					       posy * txt->font->attr.height,
-					       attr->fr, attr->fg, attr->fb,
-					       attr->br, attr->bg, attr->bb);
+		fr = attr->fr;
+		fg = attr->fg;
+		fb = attr->fb;
+		br = attr->br;
+		bg = attr->bg;
+		bb = attr->bb;
 	}
 
-	return ret;
+	if (bl->use_cache) {
+		tile = kmscon_text_cache_get(bl->cache, glyph,
+					     fr, fg, fb, br, bg, bb);
+		if (tile)
+			return uterm_display_blit(txt->disp, tile, x, y);
+	}
+
+	/* draw glyph */
+	return uterm_display_fake_blend(txt->disp, &glyph->buf, x, y,
+					fr, fg, fb, br, bg, bb);
+}
+
+static int bblit_fill(struct kmscon_text *txt,
+		      unsigned int posx, unsigned int posy, unsigned int num,
+		      uint8_t r, uint8_t g, uint8_t b)
+{
+	unsigned int fw = txt->font->attr.width;
+	unsigned int fh = txt->font->attr.height;
+
+	return uterm_display_fill(txt->disp, r, g, b, posx * fw, posy * fh,
+				  num * fw, fh);
 }
 
 struct kmscon_text_ops kmscon_text_bblit_ops = {
 	.name = "bblit",
 	.owner = NULL,
-	.init = NULL,
-	.destroy = NULL,
+	.init = bblit_init,
+	.destroy = bblit_destroy,
 	.set = bblit_set,
-	.unset = NULL,
-	.prepare = NULL,
+	.unset = bblit_unset,
+	.prepare = bblit_prepare,
 	.draw = bblit_draw,
 	.render = NULL,
 	.abort = NULL,
+	.move = NULL,
+	.fill = bblit_fill,
 };
@@ -29,7 +29,11 @@
  * @include: text.h
  *
  * Similar to the bblit renderer but assembles an array of blit-requests and
- * pushes all of them at once to the video device.
+ * pushes all of them at once to the video device. Only cells that are actually
+ * drawn during a frame are queued, so skipped cells cost nothing.
+ * If a tile cache is enabled, cells are blitted from the cache instead of
+ * being queued for blending. Queued requests are blended before anything is
+ * written to the framebuffer directly, so later draws of a cell always win.
  */
 
 #include <errno.h>
@@ -44,6 +48,11 @@
 
 struct bbulk {
 	struct uterm_video_blend_req *reqs;
+	unsigned int size;
+	unsigned int num;
+
+	struct kmscon_text_cache *cache;
+	bool use_cache;
 };
 
 #define FONT_WIDTH(txt) ((txt)->font->attr.width)
@@ -71,9 +80,9 @@ static void bbulk_destroy(struct kmscon_text *txt)
 static int bbulk_set(struct kmscon_text *txt)
 {
 	struct bbulk *bb = txt->data;
-	unsigned int sw, sh, i, j;
-	struct uterm_video_blend_req *req;
+	unsigned int sw, sh;
 	struct uterm_mode *mode;
+	int ret;
 
 	memset(bb, 0, sizeof(*bb));
 
@@ -86,17 +95,17 @@ static int bbulk_set(struct kmscon_text *txt)
 	txt->cols = sw / FONT_WIDTH(txt);
 	txt->rows = sh / FONT_HEIGHT(txt);
 
-	bb->reqs = malloc(sizeof(*bb->reqs) * txt->cols * txt->rows);
+	bb->size = txt->cols * txt->rows;
+	bb->reqs = malloc(sizeof(*bb->reqs) * bb->size);
 	if (!bb->reqs)
 		return -ENOMEM;
-	memset(bb->reqs, 0, sizeof(*bb->reqs) * txt->cols * txt->rows);
+	memset(bb->reqs, 0, sizeof(*bb->reqs) * bb->size);
 
-	for (i = 0; i < txt->rows; ++i) {
-		for (j = 0; j < txt->cols; ++j) {
-			req = &bb->reqs[i * txt->cols + j];
-			req->x = j * FONT_WIDTH(txt);
-			req->y = i * FONT_HEIGHT(txt);
-		}
+	if (txt->cache_size) {
+		ret = kmscon_text_cache_new(&bb->cache, txt->cache_size);
+		if (ret)
+			log_warning("cannot create tile cache (%d), blending all glyphs",
+				    ret);
 	}
 
 	return 0;
@@ -106,8 +115,45 @@ static void bbulk_unset(struct kmscon_text *txt)
 {
 	struct bbulk *bb = txt->data;
 
+	kmscon_text_cache_free(bb->cache);
+	bb->cache = NULL;
 	free(bb->reqs);
 	bb->reqs = NULL;
+	bb->size = 0;
+}
+
+static int bbulk_prepare(struct kmscon_text *txt)
+{
+	struct bbulk *bb = txt->data;
+	int ret;
+	bool opengl;
+
+	bb->num = 0;
+
+	/* OpenGL back-buffers are undefined after a swap so we cannot rely on
+	 * their content and need to redraw everything. */
+	ret = uterm_display_use(txt->disp, &opengl);
+	if (ret < 0 || opengl)
+		txt->age = 0;
+
+	/* blits are uploaded as textures on OpenGL displays, which is slower
+	 * than blending the glyphs in one go */
+	bb->use_cache = bb->cache && ret >= 0 && !opengl;
+
+	return 0;
+}
+
+/* blends all queued requests */
+static int flush_reqs(struct kmscon_text *txt)
+{
+	struct bbulk *bb = txt->data;
+	unsigned int num = bb->num;
+
+	if (!num)
+		return 0;
+
+	bb->num = 0;
+	return uterm_display_fake_blendv(txt->disp, bb->reqs, num);
 }
 
 static int bbulk_draw(struct kmscon_text *txt,
@@ -121,11 +167,12 @@ static int bbulk_draw(struct kmscon_text *txt,
 	int ret;
 	struct uterm_video_blend_req *req;
 	struct kmscon_font *font;
+	const struct uterm_video_buffer *tile;
 
-	if (!width) {
-		bb->reqs[posy * txt->cols + posx].buf = NULL;
+	if (!width)
 		return 0;
-	}
+	if (bb->num >= bb->size)
+		return -ERANGE;
 
 	if (attr->bold)
 		font = txt->bold_font;
@@ -144,8 +191,10 @@ static int bbulk_draw(struct kmscon_text *txt,
 			return ret;
 	}
 
-	req = &bb->reqs[posy * txt->cols + posx];
+	req = &bb->reqs[bb->num];
 	req->buf = &glyph->buf;
+	req->x = posx * FONT_WIDTH(txt);
+	req->y = posy * FONT_HEIGHT(txt);
 	if (attr->inverse) {
 		req->fr = attr->br;
 		req->fg = attr->bg;
@@ -162,15 +211,43 @@ static int bbulk_draw(struct kmscon_text *txt,
 		req->bb = attr->bb;
 	}
 
+	if (bb->use_cache) {
+		tile = kmscon_text_cache_get(bb->cache, glyph,
+					     req->fr, req->fg, req->fb,
+					     req->br, req->bg, req->bb);
+		if (tile) {
+			ret = flush_reqs(txt);
+			if (ret)
+				return ret;
+			return uterm_display_blit(txt->disp, tile,
+						  req->x, req->y);
+		}
+	}
+
+	++bb->num;
 	return 0;
 }
 
 static int bbulk_render(struct kmscon_text *txt)
 {
-	struct bbulk *bb = txt->data;
+	return flush_reqs(txt);
+}
+
+static int bbulk_fill(struct kmscon_text *txt,
+		      unsigned int posx, unsigned int posy, unsigned int num,
+		      uint8_t r, uint8_t g, uint8_t b)
+{
+	int ret;
+
+	/* glyphs queued for these cells must not be blended over the fill */
+	ret = flush_reqs(txt);
+	if (ret)
+		return ret;
 
-	return uterm_display_fake_blendv(txt->disp, bb->reqs,
-					 txt->cols * txt->rows);
+	return uterm_display_fill(txt->disp, r, g, b,
+				  posx * FONT_WIDTH(txt),
+				  posy * FONT_HEIGHT(txt),
+				  num * FONT_WIDTH(txt), FONT_HEIGHT(txt));
 }
 
 struct kmscon_text_ops kmscon_text_bbulk_ops = {
@@ -180,8 +257,10 @@ struct kmscon_text_ops kmscon_text_bbulk_ops = {
 	.destroy = bbulk_destroy,
 	.set = bbulk_set,
 	.unset = bbulk_unset,
-	.prepare = NULL,
+	.prepare = bbulk_prepare,
 	.draw = bbulk_draw,
 	.render = bbulk_render,
 	.abort = NULL,
+	.move = NULL,
+	.fill = bbulk_fill,
 };
@@ -0,0 +1,258 @@
+/*
+ * kmscon - Text Renderer Tile Cache
+ *
+ * Copyright (c) 2012-2013 David Herrmann <dh.herrmann@googlemail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * SECTION:text_cache
+ * @short_description: Text Renderer Tile Cache
+ * @include: text.h
+ *
+ * The bit-blitting renderers blend the same GREY glyphs with the same colors
+ * over and over again. The tile cache keeps fully blended XRGB32 copies of
+ * glyphs, keyed by glyph and color pair, so they can be blitted with
+ * uterm_display_blit() instead of being blended again.
+ *
+ * Glyphs are owned by their fonts, so the glyph pointer identifies both the
+ * symbol and the font (and thus bold/regular). The cache must be flushed
+ * whenever the fonts change. Tiles are evicted in LRU order once the cache
+ * exceeds its memory limit.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "font.h"
+#include "shl_dlist.h"
+#include "shl_hashtable.h"
+#include "shl_log.h"
+#include "shl_misc.h"
+#include "text.h"
+#include "uterm_blend_internal.h"
+#include "uterm_video.h"
+
+#define LOG_SUBSYSTEM "text_cache"
+
+struct tile_key {
+	const struct kmscon_glyph *glyph;
+	uint32_t fg;
+	uint32_t bg;
+};
+
+struct tile {
+	struct shl_dlist list;
+	struct tile_key key;
+	size_t size;
+	struct uterm_video_buffer buf;
+};
+
+struct kmscon_text_cache {
+	struct shl_hashtable *tiles;
+	struct shl_dlist lru;
+	size_t size;
+	size_t max;
+};
+
+static unsigned int tile_hash(const void *data)
+{
+	const struct tile_key *key = data;
+	uint64_t h;
+
+	h = (uint64_t)(unsigned long)key->glyph;
+	h ^= ((uint64_t)key->fg << 32) | key->bg;
+	h *= 0x9e3779b97f4a7c15ULL;
+
+	return (unsigned int)(h >> 32);
+}
+
+static bool tile_equal(const void *data1, const void *data2)
+{
+	const struct tile_key *k1 = data1;
+	const struct tile_key *k2 = data2;
+
+	return k1->glyph == k2->glyph && k1->fg == k2->fg && k1->bg == k2->bg;
+}
+
+static void tile_free(struct kmscon_text_cache *cache, struct tile *tile)
+{
+	shl_hashtable_remove(cache->tiles, &tile->key);
+	shl_dlist_unlink(&tile->list);
+	cache->size -= tile->size;
+	free(tile);
+}
+
+/**
+ * kmscon_text_cache_new:
+ * @out: Storage for the new cache
+ * @max: Memory limit in bytes
+ *
+ * Returns: 0 on success, negative error code on failure.
+ */
+SHL_EXPORT
+int kmscon_text_cache_new(struct kmscon_text_cache **out, size_t max)
+{
+	struct kmscon_text_cache *cache;
+	int ret;
+
+	if (!out || !max)
+		return -EINVAL;
+
+	cache = malloc(sizeof(*cache));
+	if (!cache)
+		return -ENOMEM;
+	memset(cache, 0, sizeof(*cache));
+	shl_dlist_init(&cache->lru);
+	cache->max = max;
+
+	ret = shl_hashtable_new(&cache->tiles, tile_hash, tile_equal,
+				NULL, NULL);
+	if (ret) {
+		free(cache);
+		return ret;
+	}
+
+	*out = cache;
+	return 0;
+}
+
+SHL_EXPORT
+void kmscon_text_cache_free(struct kmscon_text_cache *cache)
+{
+	if (!cache)
+		return;
+
+	kmscon_text_cache_flush(cache);
+	shl_hashtable_free(cache->tiles);
+	free(cache);
+}
+
+/**
+ * kmscon_text_cache_flush:
+ * @cache: Valid tile cache
+ *
+ * Drops all tiles. This must be called before any cached glyph is freed.
+ */
+SHL_EXPORT
+void kmscon_text_cache_flush(struct kmscon_text_cache *cache)
+{
+	struct tile *tile;
+
+	if (!cache)
+		return;
+
+	while (!shl_dlist_empty(&cache->lru)) {
+		tile = shl_dlist_last(&cache->lru, struct tile, list);
+		tile_free(cache, tile);
+	}
+}
+
+/**
+ * kmscon_text_cache_get:
+ * @cache: Valid tile cache
+ * @glyph: GREY glyph to blend
+ * @fr: foreground red
+ * @fg: foreground green
+ * @fb: foreground blue
+ * @br: background red
+ * @bg: background green
+ * @bb: background blue
+ *
+ * Returns the XRGB32 tile of @glyph blended with the given colors. The tile is
+ * created if it is not cached, yet. The returned buffer is valid until the next
+ * call on @cache.
+ *
+ * Returns: Tile buffer or NULL if the glyph cannot be cached.
+ */
+SHL_EXPORT
+const struct uterm_video_buffer *
+kmscon_text_cache_get(struct kmscon_text_cache *cache,
+		      const struct kmscon_glyph *glyph,
+		      uint8_t fr, uint8_t fg, uint8_t fb,
+		      uint8_t br, uint8_t bg, uint8_t bb)
+{
+	struct tile_key key;
+	struct tile *tile;
+	const struct uterm_blend_ops *ops;
+	const uint8_t *src;
+	uint8_t *dst;
+	unsigned int i, stride;
+	size_t size;
+	int ret;
+
+	if (!cache || !glyph || glyph->buf.format != UTERM_FORMAT_GREY)
+		return NULL;
+
+	key.glyph = glyph;
+	key.fg = (fr << 16) | (fg << 8) | fb;
+	key.bg = (br << 16) | (bg << 8) | bb;
+
+	if (shl_hashtable_find(cache->tiles, (void**)&tile, &key)) {
+		shl_dlist_unlink(&tile->list);
+		shl_dlist_link(&cache->lru, &tile->list);
+		return &tile->buf;
+	}
+
+	stride = glyph->buf.width * 4;
+	size = sizeof(*tile) + (size_t)stride * glyph->buf.height;
+	if (size > cache->max)
+		return NULL;
+
+	while (cache->size + size > cache->max) {
+		tile = shl_dlist_last(&cache->lru, struct tile, list);
+		tile_free(cache, tile);
+	}
+
+	tile = malloc(size);
+	if (!tile)
+		return NULL;
+	memset(tile, 0, sizeof(*tile));
+	tile->key = key;
+	tile->size = size;
+	tile->buf.width = glyph->buf.width;
+	tile->buf.height = glyph->buf.height;
+	tile->buf.stride = stride;
+	tile->buf.format = UTERM_FORMAT_XRGB32;
+	tile->buf.data = (uint8_t*)&tile[1];
+
+	ret = shl_hashtable_insert(cache->tiles, &tile->key, tile);
+	if (ret) {
+		free(tile);
+		return NULL;
+	}
+
+	ops = uterm_blend_get();
+	src = glyph->buf.data;
+	dst = tile->buf.data;
+	for (i = 0; i < glyph->buf.height; ++i) {
+		ops->blend255((uint32_t*)dst, src, glyph->buf.width,
+			      key.fg, key.bg);
+		dst += stride;
+		src += glyph->buf.stride;
+	}
+
+	shl_dlist_link(&cache->lru, &tile->list);
+	cache->size += size;
+
+	return &tile->buf;
+}
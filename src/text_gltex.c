@@ -30,10 +30,21 @@
  *
  * Uses OpenGL textures to store glyph information and draws these textures with
  * a custom fragment shader.
- * Glyphs are stored in texture-atlases. OpenGL has heavy restrictions on
- * texture sizes so we need to use multiple atlases. As there is no way to pass
- * a varying amount of textures to a shader, we need to render the screen for
- * each atlas we have.
+ * Glyphs are stored in texture-atlases. Each atlas is a square texture of the
+ * maximum supported size and glyphs are packed onto shelves: horizontal strips
+ * that are filled from left to right. A new atlas is only created if the
+ * current one is full. As there is no way to pass a varying amount of textures
+ * to a shader, we need to render the screen for each atlas we have, but this
+ * is a single draw call for all but the most glyph-heavy sessions.
+ * Each atlas has a copy in system memory. New glyphs are only written into
+ * this copy while drawing and are uploaded with a single glTexSubImage2D() per
+ * atlas when the frame is rendered.
+ * All cells are kept in a single vertex buffer object that stays on the GPU.
+ * Each cell has 6 interleaved vertices that carry the grid position, atlas
+ * position, colors as normalized bytes and the index of the atlas. The vertex
+ * shader computes the screen position from the grid position and moves
+ * vertices of other atlases out of the clip space. Only cells that changed
+ * since the last frame are rewritten with glBufferSubData().
  */
 
 #define GL_GLEXT_PROTOTYPES
@@ -43,8 +54,10 @@
 #include <GLES2/gl2ext.h>
 #include <limits.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include "shl_array.h"
 #include "shl_dlist.h"
 #include "shl_gl.h"
 #include "shl_hashtable.h"
@@ -60,30 +73,61 @@
 #  define GL_UNPACK_ROW_LENGTH GL_UNPACK_ROW_LENGTH_EXT
 #endif
 
+/* atlas indices are stored in a single byte of each vertex; the last index
+ * marks runs of blank cells */
+#define MAX_ATLASES 255
+#define BLANK_ATLAS 255
+
+struct shelf {
+	unsigned int y;
+	unsigned int height;
+	unsigned int fill;
+};
+
 struct atlas {
 	struct shl_dlist list;
 
 	GLuint tex;
+	unsigned int id;
 	unsigned int height;
 	unsigned int width;
-	unsigned int count;
-	unsigned int fill;
 
-	unsigned int cache_size;
-	unsigned int cache_num;
-	GLfloat *cache_pos;
-	GLfloat *cache_texpos;
-	GLfloat *cache_fgcol;
-	GLfloat *cache_bgcol;
+	struct shl_array *shelves;
+	unsigned int top;
 
-	GLfloat advance_htex;
-	GLfloat advance_vtex;
+	/* CPU copy of the texture and the area not uploaded, yet */
+	uint8_t *data;
+	unsigned int up_x0;
+	unsigned int up_y0;
+	unsigned int up_x1;
+	unsigned int up_y1;
 };
 
 struct glyph {
 	const struct kmscon_glyph *glyph;
 	struct atlas *atlas;
-	unsigned int texoff;
+	unsigned int tex_x;
+	unsigned int tex_y;
+};
+
+struct cell {
+	struct glyph *glyph;
+	unsigned int width;
+	uint32_t fg;
+	uint32_t bg;
+};
+
+struct vertex {
+	GLushort pos[2];
+	GLushort texpos[2];
+	GLubyte fgcol[3];
+	GLubyte atlas;
+	GLubyte bgcol[4];
+};
+
+struct dirty {
+	unsigned int start;
+	unsigned int end;
 };
 
 #define GLYPH_WIDTH(gly) ((gly)->glyph->buf.width)
@@ -98,15 +142,20 @@ struct gltex {
 	bool supports_rowlen;
 
 	struct shl_dlist atlases;
+	unsigned int atlas_num;
+	struct cell *cells;
 
-	GLfloat advance_x;
-	GLfloat advance_y;
+	/* CPU copy of the VBO and the range of changed cells per row */
+	GLuint vbo;
+	struct vertex *verts;
+	struct dirty *dirty;
 
 	struct gl_shader *shader;
-	GLuint uni_proj;
 	GLuint uni_atlas;
-	GLuint uni_advance_htex;
-	GLuint uni_advance_vtex;
+	GLuint uni_advance;
+	GLuint uni_tex_scale;
+	GLuint uni_current;
+	GLuint uni_blank;
 
 	unsigned int sw;
 	unsigned int sh;
@@ -152,11 +201,13 @@ static int gltex_set(struct kmscon_text *txt)
 	int ret, vlen, flen;
 	const char *vert, *frag;
 	static char *attr[] = { "position", "texture_position",
-				"fgcolor", "bgcolor" };
+				"fgcolor", "bgcolor", "atlas_index" };
 	GLint s;
 	const char *ext;
 	struct uterm_mode *mode;
 	bool opengl;
+	GLenum err;
+	size_t nverts;
 
 	memset(gt, 0, sizeof(*gt));
 	shl_dlist_init(&gt->atlases);
@@ -186,17 +237,16 @@ static int gltex_set(struct kmscon_text *txt)
 	flen = _binary_src_text_gltex_atlas_frag_bin_end - frag;
 	gl_clear_error();
 
-	ret = gl_shader_new(&gt->shader, vert, vlen, frag, flen, attr, 4,
+	ret = gl_shader_new(&gt->shader, vert, vlen, frag, flen, attr, 5,
 			    log_llog, NULL);
 	if (ret)
 		goto err_bold_htable;
 
-	gt->uni_proj = gl_shader_get_uniform(gt->shader, "projection");
 	gt->uni_atlas = gl_shader_get_uniform(gt->shader, "atlas");
-	gt->uni_advance_htex = gl_shader_get_uniform(gt->shader,
-						     "advance_htex");
-	gt->uni_advance_vtex = gl_shader_get_uniform(gt->shader,
-						     "advance_vtex");
+	gt->uni_advance = gl_shader_get_uniform(gt->shader, "advance");
+	gt->uni_tex_scale = gl_shader_get_uniform(gt->shader, "tex_scale");
+	gt->uni_current = gl_shader_get_uniform(gt->shader, "current_atlas");
+	gt->uni_blank = gl_shader_get_uniform(gt->shader, "draw_blank");
 
 	if (gl_has_error(gt->shader)) {
 		log_warning("cannot create shader");
@@ -210,6 +260,45 @@ static int gltex_set(struct kmscon_text *txt)
 	txt->cols = gt->sw / FONT_WIDTH(txt);
 	txt->rows = gt->sh / FONT_HEIGHT(txt);
 
+	gt->cells = malloc(sizeof(*gt->cells) * txt->cols * txt->rows);
+	if (!gt->cells) {
+		ret = -ENOMEM;
+		goto err_shader;
+	}
+	memset(gt->cells, 0, sizeof(*gt->cells) * txt->cols * txt->rows);
+
+	nverts = txt->cols * txt->rows * 6;
+	gt->verts = malloc(sizeof(*gt->verts) * nverts);
+	if (!gt->verts) {
+		ret = -ENOMEM;
+		goto err_cells;
+	}
+	memset(gt->verts, 0, sizeof(*gt->verts) * nverts);
+
+	gt->dirty = malloc(sizeof(*gt->dirty) * txt->rows);
+	if (!gt->dirty) {
+		ret = -ENOMEM;
+		goto err_verts;
+	}
+	memset(gt->dirty, 0, sizeof(*gt->dirty) * txt->rows);
+
+	gl_clear_error();
+
+	glGenBuffers(1, &gt->vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, gt->vbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(*gt->verts) * nverts, gt->verts,
+		     GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	err = glGetError();
+	if (err != GL_NO_ERROR) {
+		gl_clear_error();
+		log_warning("cannot create vertex buffer (%d: %s)",
+			    err, gl_err_to_str(err));
+		ret = -EFAULT;
+		goto err_vbo;
+	}
+
 	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &s);
 	if (s <= 0)
 		s = 64;
@@ -228,6 +317,13 @@ static int gltex_set(struct kmscon_text *txt)
 
 	return 0;
 
+err_vbo:
+	glDeleteBuffers(1, &gt->vbo);
+	free(gt->dirty);
+err_verts:
+	free(gt->verts);
+err_cells:
+	free(gt->cells);
 err_shader:
 	gl_shader_unref(gt->shader);
 err_bold_htable:
@@ -251,6 +347,9 @@ static void gltex_unset(struct kmscon_text *txt)
 		log_warning("cannot activate OpenGL-CTX during destruction");
 	}
 
+	free(gt->dirty);
+	free(gt->verts);
+	free(gt->cells);
 	shl_hashtable_free(gt->bold_glyphs);
 	shl_hashtable_free(gt->glyphs);
 
@@ -259,46 +358,93 @@ static void gltex_unset(struct kmscon_text *txt)
 		shl_dlist_unlink(iter);
 		atlas = shl_dlist_entry(iter, struct atlas, list);
 
-		free(atlas->cache_pos);
-		free(atlas->cache_texpos);
-		free(atlas->cache_fgcol);
-		free(atlas->cache_bgcol);
-
 		if (gl)
 			gl_tex_free(&atlas->tex, 1);
+		shl_array_free(atlas->shelves);
+		free(atlas->data);
 		free(atlas);
 	}
 
 	if (gl) {
+		glDeleteBuffers(1, &gt->vbo);
 		gl_shader_unref(gt->shader);
 
 		gl_clear_error();
 	}
 }
 
-/* returns an atlas with at least 1 free glyph position; NULL on error */
-static struct atlas *get_atlas(struct kmscon_text *txt, unsigned int num)
+/* Reserves a @width x @height area in @atlas. Glyphs go onto the shelf that
+ * wastes the least height; a new shelf is opened below the last one if none
+ * fits. */
+static bool atlas_alloc(struct atlas *atlas, unsigned int width,
+			unsigned int height, unsigned int *x, unsigned int *y)
+{
+	struct shelf *shelf, *best = NULL, new_shelf;
+	size_t i, num;
+
+	num = shl_array_get_length(atlas->shelves);
+	for (i = 0; i < num; ++i) {
+		shelf = SHL_ARRAY_AT(atlas->shelves, struct shelf, i);
+		if (shelf->height < height || shelf->fill + width > atlas->width)
+			continue;
+		if (!best || shelf->height < best->height)
+			best = shelf;
+	}
+
+	if (!best) {
+		if (width > atlas->width || atlas->top + height > atlas->height)
+			return false;
+
+		new_shelf.y = atlas->top;
+		new_shelf.height = height;
+		new_shelf.fill = 0;
+		if (shl_array_push(atlas->shelves, &new_shelf))
+			return false;
+
+		atlas->top += height;
+		best = SHL_ARRAY_AT(atlas->shelves, struct shelf, num);
+	}
+
+	*x = best->fill;
+	*y = best->y;
+	best->fill += width;
+	return true;
+}
+
+/* returns an atlas with a free @width x @height area at @x/@y; NULL on error */
+static struct atlas *get_atlas(struct kmscon_text *txt, unsigned int width,
+			       unsigned int height, unsigned int *x,
+			       unsigned int *y)
 {
 	struct gltex *gt = txt->data;
 	struct atlas *atlas;
-	size_t newsize;
-	unsigned int width, height, nsize;
+	unsigned int size;
 	GLenum err;
+	int ret;
 
-	/* check whether the last added atlas has still room for one glyph */
+	/* only the last added atlas can have room left */
 	if (!shl_dlist_empty(&gt->atlases)) {
 		atlas = shl_dlist_entry(gt->atlases.next, struct atlas,
 					   list);
-		if (atlas->fill + num <= atlas->count)
+		if (atlas_alloc(atlas, width, height, x, y))
 			return atlas;
 	}
 
 	/* all atlases are full so we have to create a new atlas */
+	if (gt->atlas_num >= MAX_ATLASES) {
+		log_warning("too many glyph atlases");
+		return NULL;
+	}
+
 	atlas = malloc(sizeof(*atlas));
 	if (!atlas)
 		return NULL;
 	memset(atlas, 0, sizeof(*atlas));
 
+	ret = shl_array_new(&atlas->shelves, sizeof(struct shelf), 0);
+	if (ret)
+		goto err_free;
+
 	gl_clear_error();
 
 	gl_tex_new(&atlas->tex, 1);
@@ -306,30 +452,23 @@ static struct atlas *get_atlas(struct kmscon_text *txt, unsigned int num)
 	if (err != GL_NO_ERROR || !atlas->tex) {
 		gl_clear_error();
 		log_warning("cannot create new OpenGL texture: %d", err);
-		goto err_free;
+		goto err_shelves;
 	}
 
-	newsize = gt->max_tex_size / FONT_WIDTH(txt);
-	if (newsize < 1)
-		newsize = 1;
-
-	/* OpenGL texture sizes are heavily restricted so we need to find a
-	 * valid texture size that is big enough to hold as many glyphs as
-	 * possible but at least 1 */
+	/* GL_MAX_TEXTURE_SIZE is only an upper bound so we may have to try
+	 * smaller sizes until the driver accepts one */
+	size = gt->max_tex_size;
 try_next:
-	width = shl_next_pow2(FONT_WIDTH(txt) * newsize);
-	height = shl_next_pow2(FONT_HEIGHT(txt));
-
 	gl_clear_error();
 
 	glBindTexture(GL_TEXTURE_2D, atlas->tex);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, width, height,
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, size, size,
 		     0, GL_ALPHA, GL_UNSIGNED_BYTE, NULL);
 
 	err = glGetError();
 	if (err != GL_NO_ERROR) {
-		if (newsize > 1) {
-			--newsize;
+		if (size / 2 >= width && size / 2 >= height) {
+			size /= 2;
 			goto try_next;
 		}
 		gl_clear_error();
@@ -338,43 +477,32 @@ try_next:
 		goto err_tex;
 	}
 
-	log_debug("new atlas of size %ux%u for %zu", width, height, newsize);
+	log_debug("new atlas of size %ux%u", size, size);
 
-	nsize = txt->cols * txt->rows;
+	atlas->width = size;
+	atlas->height = size;
 
-	atlas->cache_pos = malloc(sizeof(GLfloat) * nsize * 2 * 6);
-	if (!atlas->cache_pos)
-		goto err_mem;
-
-	atlas->cache_texpos = malloc(sizeof(GLfloat) * nsize * 2 * 6);
-	if (!atlas->cache_texpos)
-		goto err_mem;
-
-	atlas->cache_fgcol = malloc(sizeof(GLfloat) * nsize * 3 * 6);
-	if (!atlas->cache_fgcol)
-		goto err_mem;
-
-	atlas->cache_bgcol = malloc(sizeof(GLfloat) * nsize * 3 * 6);
-	if (!atlas->cache_bgcol)
-		goto err_mem;
+	if (!atlas_alloc(atlas, width, height, x, y)) {
+		log_warning("glyph of size %ux%u does not fit into an atlas",
+			    width, height);
+		goto err_tex;
+	}
 
-	atlas->cache_size = nsize;
-	atlas->count = newsize;
-	atlas->width = width;
-	atlas->height = height;
-	atlas->advance_htex = 1.0 / atlas->width * FONT_WIDTH(txt);
-	atlas->advance_vtex = 1.0 / atlas->height * FONT_HEIGHT(txt);
+	/* zeroed so the padding around glyphs is transparent */
+	atlas->data = calloc(size, size);
+	if (!atlas->data) {
+		log_warning("cannot allocate memory for glyph atlas");
+		goto err_tex;
+	}
 
+	atlas->id = gt->atlas_num++;
 	shl_dlist_link(&gt->atlases, &atlas->list);
 	return atlas;
 
-err_mem:
-	free(atlas->cache_pos);
-	free(atlas->cache_texpos);
-	free(atlas->cache_fgcol);
-	free(atlas->cache_bgcol);
 err_tex:
 	gl_tex_free(&atlas->tex, 1);
+err_shelves:
+	shl_array_free(atlas->shelves);
 err_free:
 	free(atlas);
 	return NULL;
@@ -387,11 +515,12 @@ static int find_glyph(struct kmscon_text *txt, struct glyph **out,
 	struct atlas *atlas;
 	struct glyph *glyph;
 	bool res;
-	int ret, i;
-	GLenum err;
-	uint8_t *packed_data, *dst, *src;
+	int ret;
+	unsigned int i;
+	uint8_t *dst, *src;
 	struct shl_hashtable *gtable;
 	struct kmscon_font *font;
+	unsigned int x, y, w, h;
 
 	if (bold) {
 		gtable = gt->bold_glyphs;
@@ -424,93 +553,63 @@ static int find_glyph(struct kmscon_text *txt, struct glyph **out,
 			goto err_free;
 	}
 
-	atlas = get_atlas(txt, glyph->glyph->width);
+	/* reserve the whole cell area that is sampled during rendering */
+	w = glyph->glyph->width * FONT_WIDTH(txt);
+	if (w < GLYPH_WIDTH(glyph))
+		w = GLYPH_WIDTH(glyph);
+	h = FONT_HEIGHT(txt);
+	if (h < GLYPH_HEIGHT(glyph))
+		h = GLYPH_HEIGHT(glyph);
+
+	atlas = get_atlas(txt, w, h, &x, &y);
 	if (!atlas) {
 		ret = -EFAULT;
 		goto err_free;
 	}
 
-	/* Funnily, not all OpenGLESv2 implementations support specifying the
-	 * stride of a texture. Therefore, we then need to create a
-	 * temporary image with a stride equal to the image width for loading
-	 * the texture. This may slow down loading new glyphs but doesn't affect
-	 * overall rendering performance. But driver developers should really
-	 * add this! */
-
-	gl_clear_error();
-
-	glBindTexture(GL_TEXTURE_2D, atlas->tex);
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-	if (!gt->supports_rowlen) {
-		if (GLYPH_STRIDE(glyph) == GLYPH_WIDTH(glyph)) {
-			glTexSubImage2D(GL_TEXTURE_2D, 0,
-					FONT_WIDTH(txt) * atlas->fill, 0,
-					GLYPH_WIDTH(glyph),
-					GLYPH_HEIGHT(glyph),
-					GL_ALPHA, GL_UNSIGNED_BYTE,
-					GLYPH_DATA(glyph));
-		} else {
-			packed_data = malloc(GLYPH_WIDTH(glyph) * GLYPH_HEIGHT(glyph));
-			if (!packed_data) {
-				log_error("cannot allocate memory for glyph storage");
-				ret = -ENOMEM;
-				goto err_free;
-			}
-
-			src = GLYPH_DATA(glyph);
-			dst = packed_data;
-			for (i = 0; i < GLYPH_HEIGHT(glyph); ++i) {
-				memcpy(dst, src, GLYPH_WIDTH(glyph));
-				dst += GLYPH_WIDTH(glyph);
-				src += GLYPH_STRIDE(glyph);
-			}
-
-			glTexSubImage2D(GL_TEXTURE_2D, 0,
-					FONT_WIDTH(txt) * atlas->fill, 0,
-					GLYPH_WIDTH(glyph),
-					GLYPH_HEIGHT(glyph),
-					GL_ALPHA, GL_UNSIGNED_BYTE,
-					packed_data);
-			free(packed_data);
-		}
-	} else {
-		glPixelStorei(GL_UNPACK_ROW_LENGTH, GLYPH_STRIDE(glyph));
-		glTexSubImage2D(GL_TEXTURE_2D, 0,
-				FONT_WIDTH(txt) * atlas->fill, 0,
-				GLYPH_WIDTH(glyph),
-				GLYPH_HEIGHT(glyph),
-				GL_ALPHA, GL_UNSIGNED_BYTE,
-				GLYPH_DATA(glyph));
-		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	/* The texture is not touched here. The glyph is copied into the CPU
+	 * copy of the atlas and uploaded together with all other new glyphs
+	 * during gltex_render(). The whole reserved area is cleared and
+	 * uploaded, as the texture content is undefined until then and the
+	 * padding around smaller glyphs is sampled at the cell edges. */
+	dst = &atlas->data[y * atlas->width + x];
+	for (i = 0; i < h; ++i) {
+		memset(dst, 0, w);
+		dst += atlas->width;
 	}
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 
-	/* Check for GL-errors
-	 * As OpenGL is a state-machine, we cannot really tell which call failed
-	 * without adding a glGetError() after each call. This is totally
-	 * overkill so let us at least catch the error afterwards.
-	 * We also add a hint to disable OpenGL if this does not work. This
-	 * should _always_ work but OpenGL is kind of a black-box that isn't
-	 * verbose at all and many things can go wrong. */
+	src = GLYPH_DATA(glyph);
+	dst = &atlas->data[y * atlas->width + x];
+	for (i = 0; i < GLYPH_HEIGHT(glyph); ++i) {
+		memcpy(dst, src, GLYPH_WIDTH(glyph));
+		dst += atlas->width;
+		src += GLYPH_STRIDE(glyph);
+	}
 
-	err = glGetError();
-	if (err != GL_NO_ERROR) {
-		gl_clear_error();
-		log_warning("cannot load glyph data into OpenGL texture (%d: %s); disable the GL-renderer if this does not work reliably",
-			    err, gl_err_to_str(err));
-		ret = -EFAULT;
-		goto err_free;
+	if (atlas->up_x0 >= atlas->up_x1) {
+		atlas->up_x0 = x;
+		atlas->up_y0 = y;
+		atlas->up_x1 = x + w;
+		atlas->up_y1 = y + h;
+	} else {
+		if (x < atlas->up_x0)
+			atlas->up_x0 = x;
+		if (y < atlas->up_y0)
+			atlas->up_y0 = y;
+		if (x + w > atlas->up_x1)
+			atlas->up_x1 = x + w;
+		if (y + h > atlas->up_y1)
+			atlas->up_y1 = y + h;
 	}
 
 	glyph->atlas = atlas;
-	glyph->texoff = atlas->fill;
+	glyph->tex_x = x;
+	glyph->tex_y = y;
 
 	ret = shl_hashtable_insert(gtable, (void*)(long)id, glyph);
 	if (ret)
 		goto err_free;
 
-	atlas->fill += glyph->glyph->width;
-
 	*out = glyph;
 	return 0;
 
@@ -522,24 +621,197 @@ err_free:
 static int gltex_prepare(struct kmscon_text *txt)
 {
 	struct gltex *gt = txt->data;
-	struct atlas *atlas;
-	struct shl_dlist *iter;
+	unsigned int i;
 	int ret;
 
 	ret = uterm_display_use(txt->disp, NULL);
 	if (ret)
 		return ret;
 
-	shl_dlist_for_each(iter, &gt->atlases) {
-		atlas = shl_dlist_entry(iter, struct atlas, list);
+	/* cells that are not drawn during a full redraw must stay empty */
+	if (!txt->age) {
+		memset(gt->cells, 0,
+		       sizeof(*gt->cells) * txt->cols * txt->rows);
+		memset(gt->verts, 0,
+		       sizeof(*gt->verts) * txt->cols * txt->rows * 6);
+		for (i = 0; i < txt->rows; ++i) {
+			gt->dirty[i].start = 0;
+			gt->dirty[i].end = txt->cols;
+		}
+	}
+
+	return 0;
+}
 
-		atlas->cache_num = 0;
+static void set_dirty(struct kmscon_text *txt, unsigned int posx,
+		      unsigned int posy)
+{
+	struct gltex *gt = txt->data;
+	struct dirty *d = &gt->dirty[posy];
+
+	if (d->start == d->end) {
+		d->start = posx;
+		d->end = posx + 1;
+	} else if (posx < d->start) {
+		d->start = posx;
+	} else if (posx >= d->end) {
+		d->end = posx + 1;
+	}
+}
+
+static void write_cell(struct kmscon_text *txt, const struct cell *cell,
+		       unsigned int posx, unsigned int posy)
+{
+	struct gltex *gt = txt->data;
+	struct glyph *glyph = cell->glyph;
+	struct vertex *v, *vert;
+	unsigned int x0, x1, tx0, tx1, ty0, ty1, i;
+
+	vert = &gt->verts[(posy * txt->cols + posx) * 6];
+	if (!glyph) {
+		memset(vert, 0, sizeof(*vert) * 6);
+		return;
 	}
 
-	gt->advance_x = 2.0 / gt->sw * FONT_WIDTH(txt);
-	gt->advance_y = 2.0 / gt->sh * FONT_HEIGHT(txt);
+	x0 = posx;
+	x1 = posx + cell->width;
+	tx0 = glyph->tex_x;
+	tx1 = glyph->tex_x + cell->width * FONT_WIDTH(txt);
+	ty0 = glyph->tex_y;
+	ty1 = glyph->tex_y + FONT_HEIGHT(txt);
 
-	return 0;
+	for (i = 0; i < 6; ++i) {
+		v = &vert[i];
+		v->fgcol[0] = cell->fg >> 16;
+		v->fgcol[1] = cell->fg >> 8;
+		v->fgcol[2] = cell->fg;
+		v->atlas = glyph->atlas->id;
+		v->bgcol[0] = cell->bg >> 16;
+		v->bgcol[1] = cell->bg >> 8;
+		v->bgcol[2] = cell->bg;
+		v->bgcol[3] = 0;
+	}
+
+	/* two triangles: top-left, bottom-left, bottom-right and top-left,
+	 * bottom-right, top-right */
+	vert[0].pos[0] = x0;
+	vert[0].pos[1] = posy;
+	vert[0].texpos[0] = tx0;
+	vert[0].texpos[1] = ty0;
+	vert[1].pos[0] = x0;
+	vert[1].pos[1] = posy + 1;
+	vert[1].texpos[0] = tx0;
+	vert[1].texpos[1] = ty1;
+	vert[2].pos[0] = x1;
+	vert[2].pos[1] = posy + 1;
+	vert[2].texpos[0] = tx1;
+	vert[2].texpos[1] = ty1;
+
+	vert[3] = vert[0];
+	vert[4] = vert[2];
+	vert[5].pos[0] = x1;
+	vert[5].pos[1] = posy;
+	vert[5].texpos[0] = tx1;
+	vert[5].texpos[1] = ty0;
+}
+
+/* A cell without glyph but with a width is blank and shows its background
+ * only. Each run of blank cells with equal background is drawn as a single
+ * quad which is stored in the first cell of the run. */
+static bool cell_is_blank(const struct cell *cell)
+{
+	return !cell->glyph && cell->width;
+}
+
+static void write_blank(struct kmscon_text *txt, const struct cell *cell,
+			unsigned int posx, unsigned int posy,
+			unsigned int num)
+{
+	struct gltex *gt = txt->data;
+	struct vertex *v, *vert;
+	unsigned int i;
+
+	vert = &gt->verts[(posy * txt->cols + posx) * 6];
+	memset(vert, 0, sizeof(*vert) * 6 * num);
+
+	for (i = 0; i < 6; ++i) {
+		v = &vert[i];
+		v->fgcol[0] = cell->bg >> 16;
+		v->fgcol[1] = cell->bg >> 8;
+		v->fgcol[2] = cell->bg;
+		v->atlas = BLANK_ATLAS;
+		v->bgcol[0] = cell->bg >> 16;
+		v->bgcol[1] = cell->bg >> 8;
+		v->bgcol[2] = cell->bg;
+	}
+
+	vert[0].pos[0] = posx;
+	vert[0].pos[1] = posy;
+	vert[1].pos[0] = posx;
+	vert[1].pos[1] = posy + 1;
+	vert[2].pos[0] = posx + num;
+	vert[2].pos[1] = posy + 1;
+	vert[3] = vert[0];
+	vert[4] = vert[2];
+	vert[5].pos[0] = posx + num;
+	vert[5].pos[1] = posy;
+}
+
+/* Writes the vertices of all changed cells. The changed range of each row is
+ * first extended over neighboring blank cells so every run that it touches is
+ * written again as a whole. */
+static void write_dirty(struct kmscon_text *txt)
+{
+	struct gltex *gt = txt->data;
+	struct cell *row, *cell;
+	struct dirty *d;
+	unsigned int i, x, num;
+
+	for (i = 0; i < txt->rows; ++i) {
+		d = &gt->dirty[i];
+		if (d->start == d->end)
+			continue;
+
+		row = &gt->cells[i * txt->cols];
+		while (d->start > 0 && cell_is_blank(&row[d->start - 1]))
+			--d->start;
+		while (d->end < txt->cols && cell_is_blank(&row[d->end]))
+			++d->end;
+
+		for (x = d->start; x < d->end; x += num) {
+			cell = &row[x];
+			if (!cell_is_blank(cell)) {
+				write_cell(txt, cell, x, i);
+				num = 1;
+				continue;
+			}
+
+			for (num = 1; x + num < d->end; ++num) {
+				if (!cell_is_blank(&row[x + num]) ||
+				    row[x + num].bg != cell->bg)
+					break;
+			}
+			write_blank(txt, cell, x, i, num);
+		}
+	}
+}
+
+static void set_cell(struct kmscon_text *txt, unsigned int posx,
+		     unsigned int posy, struct glyph *glyph,
+		     unsigned int width, uint32_t fg, uint32_t bg)
+{
+	struct gltex *gt = txt->data;
+	struct cell *cell = &gt->cells[posy * txt->cols + posx];
+
+	if (cell->glyph == glyph && cell->width == width &&
+	    cell->fg == fg && cell->bg == bg)
+		return;
+
+	cell->glyph = glyph;
+	cell->width = width;
+	cell->fg = fg;
+	cell->bg = bg;
+	set_dirty(txt, posx, posy);
 }
 
 static int gltex_draw(struct kmscon_text *txt,
@@ -548,131 +820,208 @@ static int gltex_draw(struct kmscon_text *txt,
 		      unsigned int posx, unsigned int posy,
 		      const struct tsm_screen_attr *attr)
 {
-	struct gltex *gt = txt->data;
-	struct atlas *atlas;
 	struct glyph *glyph;
-	int ret, i, idx;
-
-	if (!width)
-		return 0;
-
-	ret = find_glyph(txt, &glyph, id, ch, len, attr->bold);
-	if (ret)
-		return ret;
-	atlas = glyph->atlas;
-
-	if (atlas->cache_num >= atlas->cache_size)
-		return -ERANGE;
-
-	atlas->cache_pos[atlas->cache_num * 2 * 6 + 0] =
-		gt->advance_x * posx - 1;
-	atlas->cache_pos[atlas->cache_num * 2 * 6 + 1] =
-		1 - gt->advance_y * posy;
-	atlas->cache_pos[atlas->cache_num * 2 * 6 + 2] =
-		gt->advance_x * posx - 1;
-	atlas->cache_pos[atlas->cache_num * 2 * 6 + 3] =
-		1 - (gt->advance_y * posy + gt->advance_y);
-	atlas->cache_pos[atlas->cache_num * 2 * 6 + 4] =
-		gt->advance_x * posx + width * gt->advance_x - 1;
-	atlas->cache_pos[atlas->cache_num * 2 * 6 + 5] =
-		1 - (gt->advance_y * posy + gt->advance_y);
-
-	atlas->cache_pos[atlas->cache_num * 2 * 6 + 6] =
-		gt->advance_x * posx - 1;
-	atlas->cache_pos[atlas->cache_num * 2 * 6 + 7] =
-		1 - gt->advance_y * posy;
-	atlas->cache_pos[atlas->cache_num * 2 * 6 + 8] =
-		gt->advance_x * posx + width * gt->advance_x - 1;
-	atlas->cache_pos[atlas->cache_num * 2 * 6 + 9] =
-		1 - (gt->advance_y * posy + gt->advance_y);
-	atlas->cache_pos[atlas->cache_num * 2 * 6 + 10] =
-		gt->advance_x * posx + width * gt->advance_x - 1;
-	atlas->cache_pos[atlas->cache_num * 2 * 6 + 11] =
-		1 - gt->advance_y * posy;
-
-	atlas->cache_texpos[atlas->cache_num * 2 * 6 + 0] = glyph->texoff;
-	atlas->cache_texpos[atlas->cache_num * 2 * 6 + 1] = 0.0;
-	atlas->cache_texpos[atlas->cache_num * 2 * 6 + 2] = glyph->texoff;
-	atlas->cache_texpos[atlas->cache_num * 2 * 6 + 3] = 1.0;
-	atlas->cache_texpos[atlas->cache_num * 2 * 6 + 4] = glyph->texoff + width;
-	atlas->cache_texpos[atlas->cache_num * 2 * 6 + 5] = 1.0;
-
-	atlas->cache_texpos[atlas->cache_num * 2 * 6 + 6] = glyph->texoff;
-	atlas->cache_texpos[atlas->cache_num * 2 * 6 + 7] = 0.0;
-	atlas->cache_texpos[atlas->cache_num * 2 * 6 + 8] = glyph->texoff + width;
-	atlas->cache_texpos[atlas->cache_num * 2 * 6 + 9] = 1.0;
-	atlas->cache_texpos[atlas->cache_num * 2 * 6 + 10] = glyph->texoff + width;
-	atlas->cache_texpos[atlas->cache_num * 2 * 6 + 11] = 0.0;
+	uint32_t fg, bg;
+	int ret;
 
-	for (i = 0; i < 6; ++i) {
-		idx = atlas->cache_num * 3 * 6 + i * 3;
-		if (attr->inverse) {
-			atlas->cache_fgcol[idx + 0] = attr->br / 255.0;
-			atlas->cache_fgcol[idx + 1] = attr->bg / 255.0;
-			atlas->cache_fgcol[idx + 2] = attr->bb / 255.0;
-			atlas->cache_bgcol[idx + 0] = attr->fr / 255.0;
-			atlas->cache_bgcol[idx + 1] = attr->fg / 255.0;
-			atlas->cache_bgcol[idx + 2] = attr->fb / 255.0;
+	if (!width) {
+		glyph = NULL;
+		fg = 0;
+		bg = 0;
+		ret = 0;
+	} else {
+		ret = find_glyph(txt, &glyph, id, ch, len, attr->bold);
+		if (ret) {
+			glyph = NULL;
+			width = 0;
+			fg = 0;
+			bg = 0;
+		} else if (attr->inverse) {
+			fg = (attr->br << 16) | (attr->bg << 8) | attr->bb;
+			bg = (attr->fr << 16) | (attr->fg << 8) | attr->fb;
 		} else {
-			atlas->cache_fgcol[idx + 0] = attr->fr / 255.0;
-			atlas->cache_fgcol[idx + 1] = attr->fg / 255.0;
-			atlas->cache_fgcol[idx + 2] = attr->fb / 255.0;
-			atlas->cache_bgcol[idx + 0] = attr->br / 255.0;
-			atlas->cache_bgcol[idx + 1] = attr->bg / 255.0;
-			atlas->cache_bgcol[idx + 2] = attr->bb / 255.0;
+			fg = (attr->fr << 16) | (attr->fg << 8) | attr->fb;
+			bg = (attr->br << 16) | (attr->bg << 8) | attr->bb;
 		}
 	}
 
-	++atlas->cache_num;
+	set_cell(txt, posx, posy, glyph, width, fg, bg);
+
+	return ret;
+}
+
+static int gltex_fill(struct kmscon_text *txt,
+		      unsigned int posx, unsigned int posy, unsigned int num,
+		      uint8_t r, uint8_t g, uint8_t b)
+{
+	uint32_t bg = (r << 16) | (g << 8) | b;
+	unsigned int i;
+
+	for (i = 0; i < num; ++i)
+		set_cell(txt, posx + i, posy, NULL, 1, bg, bg);
 
 	return 0;
 }
 
+static void upload_cells(struct kmscon_text *txt, unsigned int start,
+			 unsigned int end)
+{
+	struct gltex *gt = txt->data;
+	unsigned int num = txt->cols * txt->rows;
+
+	/* orphan the old storage instead of waiting for pending draws */
+	if (!start && end == num)
+		glBufferData(GL_ARRAY_BUFFER, sizeof(*gt->verts) * num * 6,
+			     gt->verts, GL_DYNAMIC_DRAW);
+	else
+		glBufferSubData(GL_ARRAY_BUFFER,
+				sizeof(*gt->verts) * start * 6,
+				sizeof(*gt->verts) * (end - start) * 6,
+				&gt->verts[start * 6]);
+}
+
+/* Uploads all changed cells. Ranges of neighboring rows are merged if the gap
+ * between them is less than a row, so scrolling text needs few uploads. */
+static void upload_dirty(struct kmscon_text *txt)
+{
+	struct gltex *gt = txt->data;
+	struct dirty *d;
+	unsigned int i, start = 0, end = 0;
+	bool pending = false;
+
+	for (i = 0; i < txt->rows; ++i) {
+		d = &gt->dirty[i];
+		if (d->start == d->end)
+			continue;
+
+		if (pending && i * txt->cols + d->start > end + txt->cols) {
+			upload_cells(txt, start, end);
+			pending = false;
+		}
+		if (!pending) {
+			start = i * txt->cols + d->start;
+			pending = true;
+		}
+		end = i * txt->cols + d->end;
+
+		d->start = 0;
+		d->end = 0;
+	}
+
+	if (pending)
+		upload_cells(txt, start, end);
+}
+
+/* Uploads the glyphs that were added to @atlas since the last frame. Without
+ * GL_EXT_unpack_subimage we cannot pass the stride of the CPU copy so we upload
+ * whole texture rows, which are contiguous in memory. */
+static void upload_atlas(struct kmscon_text *txt, struct atlas *atlas)
+{
+	struct gltex *gt = txt->data;
+	unsigned int x, w;
+
+	if (atlas->up_x0 >= atlas->up_x1)
+		return;
+
+	if (gt->supports_rowlen) {
+		x = atlas->up_x0;
+		w = atlas->up_x1 - atlas->up_x0;
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, atlas->width);
+	} else {
+		x = 0;
+		w = atlas->width;
+	}
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, x, atlas->up_y0,
+			w, atlas->up_y1 - atlas->up_y0,
+			GL_ALPHA, GL_UNSIGNED_BYTE,
+			&atlas->data[atlas->up_y0 * atlas->width + x]);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	if (gt->supports_rowlen)
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+
+	atlas->up_x0 = 0;
+	atlas->up_y0 = 0;
+	atlas->up_x1 = 0;
+	atlas->up_y1 = 0;
+}
+
 static int gltex_render(struct kmscon_text *txt)
 {
 	struct gltex *gt = txt->data;
 	struct atlas *atlas;
 	struct shl_dlist *iter;
-	float mat[16];
+	bool blank;
 
 	gl_clear_error();
 
+	glBindBuffer(GL_ARRAY_BUFFER, gt->vbo);
+	write_dirty(txt);
+	upload_dirty(txt);
+
 	gl_shader_use(gt->shader);
 
 	glViewport(0, 0, gt->sw, gt->sh);
 	glDisable(GL_BLEND);
 
-	gl_m4_identity(mat);
-	glUniformMatrix4fv(gt->uni_proj, 1, GL_FALSE, mat);
+	glUniform2f(gt->uni_advance, 2.0 / gt->sw * FONT_WIDTH(txt),
+		    2.0 / gt->sh * FONT_HEIGHT(txt));
 
 	glEnableVertexAttribArray(0);
 	glEnableVertexAttribArray(1);
 	glEnableVertexAttribArray(2);
 	glEnableVertexAttribArray(3);
+	glEnableVertexAttribArray(4);
+
+	glVertexAttribPointer(0, 2, GL_UNSIGNED_SHORT, GL_FALSE,
+			      sizeof(struct vertex),
+			      (void*)offsetof(struct vertex, pos));
+	glVertexAttribPointer(1, 2, GL_UNSIGNED_SHORT, GL_FALSE,
+			      sizeof(struct vertex),
+			      (void*)offsetof(struct vertex, texpos));
+	glVertexAttribPointer(2, 3, GL_UNSIGNED_BYTE, GL_TRUE,
+			      sizeof(struct vertex),
+			      (void*)offsetof(struct vertex, fgcol));
+	glVertexAttribPointer(3, 3, GL_UNSIGNED_BYTE, GL_TRUE,
+			      sizeof(struct vertex),
+			      (void*)offsetof(struct vertex, bgcol));
+	glVertexAttribPointer(4, 1, GL_UNSIGNED_BYTE, GL_FALSE,
+			      sizeof(struct vertex),
+			      (void*)offsetof(struct vertex, atlas));
 
 	glActiveTexture(GL_TEXTURE0);
 	glUniform1i(gt->uni_atlas, 0);
 
+	blank = true;
 	shl_dlist_for_each(iter, &gt->atlases) {
 		atlas = shl_dlist_entry(iter, struct atlas, list);
-		if (!atlas->cache_num)
-			continue;
 
 		glBindTexture(GL_TEXTURE_2D, atlas->tex);
-		glUniform1f(gt->uni_advance_htex, atlas->advance_htex);
-		glUniform1f(gt->uni_advance_vtex, atlas->advance_vtex);
+		upload_atlas(txt, atlas);
+		glUniform2f(gt->uni_tex_scale, 1.0 / atlas->width,
+			    1.0 / atlas->height);
+		glUniform1f(gt->uni_current, atlas->id);
+		glUniform1f(gt->uni_blank, blank);
+		glDrawArrays(GL_TRIANGLES, 0, 6 * txt->cols * txt->rows);
+		blank = false;
+	}
 
-		glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, atlas->cache_pos);
-		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, atlas->cache_texpos);
-		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, atlas->cache_fgcol);
-		glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 0, atlas->cache_bgcol);
-		glDrawArrays(GL_TRIANGLES, 0, 6 * atlas->cache_num);
+	/* a console without any glyph still has blank cells */
+	if (blank) {
+		glUniform1f(gt->uni_current, -1.0);
+		glUniform1f(gt->uni_blank, 1.0);
+		glDrawArrays(GL_TRIANGLES, 0, 6 * txt->cols * txt->rows);
 	}
 
 	glDisableVertexAttribArray(0);
 	glDisableVertexAttribArray(1);
 	glDisableVertexAttribArray(2);
 	glDisableVertexAttribArray(3);
+	glDisableVertexAttribArray(4);
+
+	/* the video backends use client-side vertex arrays */
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
 
 	if (gl_has_error(gt->shader)) {
 		log_warning("rendering console caused OpenGL errors");
@@ -682,6 +1031,14 @@ static int gltex_render(struct kmscon_text *txt)
 	return 0;
 }
 
+/* The cell grid is rendered into a fresh back-buffer every frame, so moving the
+ * previous content is of no use. */
+static int gltex_move(struct kmscon_text *txt, unsigned int src,
+		      unsigned int dst, unsigned int num)
+{
+	return -EOPNOTSUPP;
+}
+
 struct kmscon_text_ops kmscon_text_gltex_ops = {
 	.name = "gltex",
 	.owner = NULL,
@@ -693,4 +1050,6 @@ struct kmscon_text_ops kmscon_text_gltex_ops = {
 	.draw = gltex_draw,
 	.render = gltex_render,
 	.abort = NULL,
+	.move = gltex_move,
+	.fill = gltex_fill,
 };
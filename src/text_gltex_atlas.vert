@@ -26,16 +26,24 @@
 
 /*
  * Vertex Shader
- * This shader is a very basic vertex shader which forwards all data and
- * performs basic matrix multiplications.
+ * Positions are given in console cells and texture positions in atlas texels.
+ * Both are converted here. Vertices that do not belong to the atlas that is
+ * currently drawn are moved out of the clip space so their triangles are
+ * dropped. Runs of blank cells use atlas index 255 and are drawn together with
+ * the first atlas. Their foreground equals their background so the texture
+ * does not matter.
  */
 
-uniform mat4 projection;
+uniform vec2 advance;
+uniform vec2 tex_scale;
+uniform float current_atlas;
+uniform float draw_blank;
 
 attribute vec2 position;
 attribute vec2 texture_position;
 attribute vec3 fgcolor;
 attribute vec3 bgcolor;
+attribute float atlas_index;
 
 varying vec2 texpos;
 varying vec3 fgcol;
@@ -43,8 +51,14 @@ varying vec3 bgcol;
 
 void main()
 {
-	gl_Position = projection * vec4(position, 0.0, 1.0);
-	texpos = texture_position;
+	if (abs(atlas_index - current_atlas) > 0.5 &&
+	    (atlas_index < 254.5 || draw_blank < 0.5)) {
+		gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+	} else {
+		gl_Position = vec4(position.x * advance.x - 1.0,
+				   1.0 - position.y * advance.y, 0.0, 1.0);
+	}
+	texpos = texture_position * tex_scale;
 	fgcol = fgcolor;
 	bgcol = bgcolor;
 }
@@ -25,6 +25,9 @@
 
 /*
  * Pixman based text renderer
+ * Consecutive cells with equal colors are collected into runs. The glyphs of a
+ * run are copied into a shared A8 mask so each run needs a single fill and a
+ * single composite operation. Solid-fill source images are cached by color.
  */
 
 #include <errno.h>
@@ -39,10 +42,11 @@
 
 #define LOG_SUBSYSTEM "text_pixman"
 
-struct tp_glyph {
-	const struct kmscon_glyph *glyph;
-	pixman_image_t *surf;
-	uint8_t *data;
+#define TP_COLORS 64
+
+struct tp_color {
+	uint32_t rgb;
+	pixman_image_t *img;
 };
 
 struct tp_pixman {
@@ -50,11 +54,25 @@ struct tp_pixman {
 	struct shl_hashtable *glyphs;
 	struct shl_hashtable *bold_glyphs;
 
+	/* direct-mapped cache of solid-fill images */
+	struct tp_color colors[TP_COLORS];
+
+	/* A8 mask of the current run */
+	pixman_image_t *mask;
+	uint8_t *mask_data;
+	unsigned int mask_stride;
+
+	/* current run of cells with equal colors */
+	unsigned int run_x;
+	unsigned int run_y;
+	unsigned int run_len;
+	uint32_t run_fc;
+	uint32_t run_bc;
+
 	struct uterm_video_buffer buf[2];
 	pixman_image_t *surf[2];
 	unsigned int format[2];
 
-	bool new_stride;
 	bool use_indirect;
 	uint8_t *data[2];
 	struct uterm_video_buffer vbuf;
@@ -85,15 +103,6 @@ static void tp_destroy(struct kmscon_text *txt)
 	free(tp);
 }
 
-static void free_glyph(void *data)
-{
-	struct tp_glyph *glyph = data;
-
-	pixman_image_unref(glyph->surf);
-	free(glyph->data);
-	free(glyph);
-}
-
 static unsigned int format_u2p(unsigned int f)
 {
 	switch (f) {
@@ -185,22 +194,40 @@ static int tp_set(struct kmscon_text *txt)
 	}
 
 	ret = shl_hashtable_new(&tp->glyphs, shl_direct_hash,
-				shl_direct_equal, NULL,
-				free_glyph);
+				shl_direct_equal, NULL, NULL);
 	if (ret)
 		goto err_white;
 
 	ret = shl_hashtable_new(&tp->bold_glyphs, shl_direct_hash,
-				shl_direct_equal, NULL,
-				free_glyph);
+				shl_direct_equal, NULL, NULL);
 	if (ret)
 		goto err_htable;
 
+	/* a run never spans more than one row of cells */
+	txt->cols = w / txt->font->attr.width;
+	txt->rows = h / txt->font->attr.height;
+	tp->mask_stride = (txt->cols * txt->font->attr.width + 3) & ~0x3;
+	tp->mask_data = malloc(tp->mask_stride * txt->font->attr.height);
+	if (!tp->mask_data) {
+		log_error("cannot allocate memory for glyph mask");
+		ret = -ENOMEM;
+		goto err_htable_bold;
+	}
+	tp->mask = pixman_image_create_bits_no_clear(PIXMAN_a8,
+				txt->cols * txt->font->attr.width,
+				txt->font->attr.height,
+				(void*)tp->mask_data, tp->mask_stride);
+	if (!tp->mask) {
+		log_error("cannot create pixman glyph mask");
+		ret = -ENOMEM;
+		goto err_mask;
+	}
+
 	/*
-	 * TODO: It is actually faster to use a local shadow buffer and then
-	 * blit all data to the framebuffer afterwards. Reads seem to be
-	 * horribly slow on some mmap'ed framebuffers. However, that's not true
-	 * for all so we actually don't know which to use here.
+	 * Reads are horribly slow on some mmap'ed framebuffers. The video
+	 * backend decides whether it hands out a shadow buffer in system RAM
+	 * here, so we render directly into these buffers and report our
+	 * damage in tp_draw().
 	 */
 	ret = uterm_display_get_buffers(txt->disp, tp->buf,
 					UTERM_FORMAT_XRGB32);
@@ -209,7 +236,7 @@ static int tp_set(struct kmscon_text *txt)
 			    txt->disp);
 		ret = alloc_indirect(txt, w, h);
 		if (ret)
-			goto err_htable_bold;
+			goto err_mask_img;
 	} else {
 		tp->format[0] = format_u2p(tp->buf[0].format);
 		tp->surf[0] = pixman_image_create_bits_no_clear(tp->format[0],
@@ -227,9 +254,6 @@ static int tp_set(struct kmscon_text *txt)
 		}
 	}
 
-	txt->cols = w / txt->font->attr.width;
-	txt->rows = h / txt->font->attr.height;
-
 	return 0;
 
 err_ctx:
@@ -239,6 +263,10 @@ err_ctx:
 		pixman_image_unref(tp->surf[0]);
 	free(tp->data[1]);
 	free(tp->data[0]);
+err_mask_img:
+	pixman_image_unref(tp->mask);
+err_mask:
+	free(tp->mask_data);
 err_htable_bold:
 	shl_hashtable_free(tp->bold_glyphs);
 err_htable:
@@ -251,27 +279,33 @@ err_white:
 static void tp_unset(struct kmscon_text *txt)
 {
 	struct tp_pixman *tp = txt->data;
+	unsigned int i;
+
+	for (i = 0; i < TP_COLORS; ++i) {
+		if (tp->colors[i].img)
+			pixman_image_unref(tp->colors[i].img);
+	}
 
 	pixman_image_unref(tp->surf[1]);
 	pixman_image_unref(tp->surf[0]);
 	free(tp->data[1]);
 	free(tp->data[0]);
+	pixman_image_unref(tp->mask);
+	free(tp->mask_data);
 	shl_hashtable_free(tp->bold_glyphs);
 	shl_hashtable_free(tp->glyphs);
 	pixman_image_unref(tp->white);
 }
 
-static int find_glyph(struct kmscon_text *txt, struct tp_glyph **out,
+static int find_glyph(struct kmscon_text *txt,
+		      const struct kmscon_glyph **out,
 		      uint32_t id, const uint32_t *ch, size_t len, bool bold)
 {
 	struct tp_pixman *tp = txt->data;
-	struct tp_glyph *glyph;
+	const struct kmscon_glyph *glyph;
 	struct shl_hashtable *gtable;
 	struct kmscon_font *font;
-	const struct uterm_video_buffer *buf;
-	uint8_t *dst, *src;
-	unsigned int format, i;
-	int ret, stride;
+	int ret;
 	bool res;
 
 	if (bold) {
@@ -289,80 +323,97 @@ static int find_glyph(struct kmscon_text *txt, struct tp_glyph **out,
 		return 0;
 	}
 
-	glyph = malloc(sizeof(*glyph));
-	if (!glyph)
-		return -ENOMEM;
-	memset(glyph, 0, sizeof(*glyph));
-
 	if (!len)
-		ret = kmscon_font_render_empty(font, &glyph->glyph);
+		ret = kmscon_font_render_empty(font, &glyph);
 	else
-		ret = kmscon_font_render(font, id, ch, len, &glyph->glyph);
+		ret = kmscon_font_render(font, id, ch, len, &glyph);
 
 	if (ret) {
-		ret = kmscon_font_render_inval(font, &glyph->glyph);
+		ret = kmscon_font_render_inval(font, &glyph);
 		if (ret)
-			goto err_free;
+			return ret;
 	}
 
-	buf = &glyph->glyph->buf;
-	stride = buf->stride;
-	format = format_u2p(buf->format);
-	glyph->surf = pixman_image_create_bits_no_clear(format,
-							buf->width,
-							buf->height,
-							(void*)buf->data,
-							buf->stride);
-	if (!glyph->surf) {
-		stride = (buf->stride + 3) & ~0x3;
-		if (!tp->new_stride) {
-			tp->new_stride = true;
-			log_debug("wrong stride, copy buffer (%d => %d)",
-			  buf->stride, stride);
-		}
-
-		glyph->data = malloc(stride * buf->height);
-		if (!glyph->data) {
-			log_error("cannot allocate memory for glyph storage");
-			ret = -ENOMEM;
-			goto err_free;
-		}
-
-		src = buf->data;
-		dst = glyph->data;
-		for (i = 0; i < buf->height; ++i) {
-			memcpy(dst, src, buf->width);
-			dst += stride;
-			src += buf->stride;
-		}
-
-		glyph->surf = pixman_image_create_bits_no_clear(format,
-								buf->width,
-								buf->height,
-								(void*)
-								glyph->data,
-								stride);
-	}
-	if (!glyph->surf) {
-		log_error("cannot create pixman-glyph: %d %p %d %d %d %d",
-			  ret, glyph->data ? glyph->data : buf->data, format,
-			  buf->width, buf->height, stride);
-		ret = -EFAULT;
-		goto err_free;
+	if (glyph->buf.format != UTERM_FORMAT_GREY) {
+		log_error("unsupported glyph format %u", glyph->buf.format);
+		return -EFAULT;
 	}
 
-	ret = shl_hashtable_insert(gtable, (void*)(long)id, glyph);
+	ret = shl_hashtable_insert(gtable, (void*)(long)id, (void*)glyph);
 	if (ret)
-		goto err_pixman;
+		return ret;
 
 	*out = glyph;
 	return 0;
+}
 
-err_pixman:
-	pixman_image_unref(glyph->surf);
-err_free:
-	free(glyph);
-	return ret;
+/*
+ * pixman cannot change the color of a solid-fill image, so we keep the images
+ * of recently used colors around instead of allocating one for each glyph.
+ * Terminal output uses only a few colors so a small direct-mapped table is
+ * enough. Black keeps using the white image as it always did.
+ */
+static pixman_image_t *get_color(struct tp_pixman *tp, uint32_t rgb)
+{
+	struct tp_color *c;
+	pixman_color_t fc;
+
+	if (!rgb)
+		return tp->white;
+
+	c = &tp->colors[((rgb * 0x9e3779b1U) >> 26) % TP_COLORS];
+	if (c->img && c->rgb == rgb)
+		return c->img;
+
+	fc.red = ((rgb >> 16) & 0xff) << 8;
+	fc.green = ((rgb >> 8) & 0xff) << 8;
+	fc.blue = (rgb & 0xff) << 8;
+	fc.alpha = 0xffff;
+
+	if (c->img)
+		pixman_image_unref(c->img);
+	c->rgb = rgb;
+	c->img = pixman_image_create_solid_fill(&fc);
+	if (!c->img)
+		log_error("cannot create pixman color image");
+
+	return c->img;
+}
+
+static int flush_run(struct kmscon_text *txt)
+{
+	struct tp_pixman *tp = txt->data;
+	pixman_image_t *col;
+	unsigned int x, y, w, h;
+
+	if (!tp->run_len)
+		return 0;
+
+	x = tp->run_x * txt->font->attr.width;
+	y = tp->run_y * txt->font->attr.height;
+	w = tp->run_len * txt->font->attr.width;
+	h = txt->font->attr.height;
+	tp->run_len = 0;
+
+	col = get_color(tp, tp->run_fc);
+	if (!col)
+		return -ENOMEM;
+
+	/* OVER on a freshly filled background gives the same result as SRC
+	 * for black backgrounds, so all runs take the same path. */
+	pixman_fill(tp->c_data, tp->c_stride / 4, tp->c_bpp,
+		    x, y, w, h, tp->run_bc);
+	pixman_image_composite(PIXMAN_OP_OVER,
+			       col,
+			       tp->mask,
+			       tp->surf[tp->cur],
+			       0, 0, 0, 0,
+			       x, y, w, h);
+
+	if (!tp->use_indirect)
+		uterm_display_damage(txt->disp, x, y, w, h);
+
+	return 0;
 }
 
 static int tp_prepare(struct kmscon_text *txt)
@@ -378,6 +429,7 @@ static int tp_prepare(struct kmscon_text *txt)
 	}
 
 	tp->cur = ret;
+	tp->run_len = 0;
 	img = tp->surf[tp->cur];
 	tp->c_bpp = PIXMAN_FORMAT_BPP(tp->format[tp->cur]);
 	tp->c_data = pixman_image_get_data(img);
@@ -393,11 +445,12 @@ static int tp_draw(struct kmscon_text *txt,
 		   const struct tsm_screen_attr *attr)
 {
 	struct tp_pixman *tp = txt->data;
-	struct tp_glyph *glyph;
+	const struct kmscon_glyph *glyph;
+	const struct uterm_video_buffer *buf;
 	int ret;
-	uint32_t bc;
-	pixman_color_t fc;
-	pixman_image_t *col;
+	uint32_t bc, fc;
+	unsigned int i, w, h, fw, fh;
+	uint8_t *dst, *src;
 
 	if (!width)
 		return 0;
@@ -408,64 +461,47 @@ static int tp_draw(struct kmscon_text *txt,
 
 	if (attr->inverse) {
 		bc = (attr->fr << 16) | (attr->fg << 8) | (attr->fb);
-		fc.red = attr->br << 8;
-		fc.green = attr->bg << 8;
-		fc.blue = attr->bb << 8;
-		fc.alpha = 0xffff;
+		fc = (attr->br << 16) | (attr->bg << 8) | (attr->bb);
 	} else {
 		bc = (attr->br << 16) | (attr->bg << 8) | (attr->bb);
-		fc.red = attr->fr << 8;
-		fc.green = attr->fg << 8;
-		fc.blue = attr->fb << 8;
-		fc.alpha = 0xffff;
+		fc = (attr->fr << 16) | (attr->fg << 8) | (attr->fb);
 	}
 
-	/* TODO: We _really_ should fix pixman to allow something like
-	 * pixman_image_set_solid_fill(img, &fc) to avoid allocating a pixman
-	 * image for each glyph here.
-	 * libc malloc() is pretty fast, but this still costs us a lot of
-	 * rendering performance. */
-	if (!fc.red && !fc.green && !fc.blue) {
-		col = tp->white;
-		pixman_image_ref(col);
-	} else {
-		col = pixman_image_create_solid_fill(&fc);
-		if (!col) {
-			log_error("cannot create pixman color image");
-			return -ENOMEM;
-		}
+	if (tp->run_len && (posy != tp->run_y ||
+			    posx != tp->run_x + tp->run_len ||
+			    fc != tp->run_fc || bc != tp->run_bc)) {
+		ret = flush_run(txt);
+		if (ret)
+			return ret;
 	}
 
-	if (!bc) {
-		pixman_image_composite(PIXMAN_OP_SRC,
-				       col,
-				       glyph->surf,
-				       tp->surf[tp->cur],
-				       0, 0, 0, 0,
-				       posx * txt->font->attr.width,
-				       posy * txt->font->attr.height,
-				       txt->font->attr.width,
-				       txt->font->attr.height);
-	} else {
-		pixman_fill(tp->c_data, tp->c_stride / 4, tp->c_bpp,
-			    posx * txt->font->attr.width,
-			    posy * txt->font->attr.height,
-			    txt->font->attr.width,
-			    txt->font->attr.height,
-			    bc);
-
-		pixman_image_composite(PIXMAN_OP_OVER,
-				       col,
-				       glyph->surf,
-				       tp->surf[tp->cur],
-				       0, 0, 0, 0,
-				       posx * txt->font->attr.width,
-				       posy * txt->font->attr.height,
-				       txt->font->attr.width,
-				       txt->font->attr.height);
+	if (!tp->run_len) {
+		tp->run_x = posx;
+		tp->run_y = posy;
+		tp->run_fc = fc;
+		tp->run_bc = bc;
 	}
 
-	pixman_image_unref(col);
+	/* copy the glyph into its cell of the run mask; glyphs are clipped
+	 * to a single cell like they always were */
+	fw = txt->font->attr.width;
+	fh = txt->font->attr.height;
+	buf = &glyph->buf;
+	w = buf->width < fw ? buf->width : fw;
+	h = buf->height < fh ? buf->height : fh;
+	dst = &tp->mask_data[tp->run_len * fw];
+	src = buf->data;
+	for (i = 0; i < fh; ++i) {
+		if (i < h) {
+			memcpy(dst, src, w);
+			memset(&dst[w], 0, fw - w);
+			src += buf->stride;
+		} else {
+			memset(dst, 0, fw);
+		}
+		dst += tp->mask_stride;
+	}
+	++tp->run_len;
 
 	return 0;
 }
@@ -475,6 +511,10 @@ static int tp_render(struct kmscon_text *txt)
 	struct tp_pixman *tp = txt->data;
 	int ret;
 
+	ret = flush_run(txt);
+	if (ret)
+		return ret;
+
 	if (!tp->use_indirect)
 		return 0;
 
@@ -488,6 +528,58 @@ static int tp_render(struct kmscon_text *txt)
 	return 0;
 }
 
+/* Rows span the whole surface, so moving them is a single memmove(). This also
+ * keeps the private buffers of the blitting engine in sync. */
+static int tp_move(struct kmscon_text *txt, unsigned int src,
+		   unsigned int dst, unsigned int num)
+{
+	struct tp_pixman *tp = txt->data;
+	unsigned int fh = txt->font->attr.height;
+	uint8_t *data = (uint8_t*)tp->c_data;
+	int ret;
+
+	ret = flush_run(txt);
+	if (ret)
+		return ret;
+
+	memmove(&data[dst * fh * tp->c_stride],
+		&data[src * fh * tp->c_stride],
+		num * fh * tp->c_stride);
+
+	if (!tp->use_indirect)
+		uterm_display_damage(txt->disp, 0, dst * fh,
+				     txt->cols * txt->font->attr.width,
+				     num * fh);
+
+	return 0;
+}
+
+static int tp_fill(struct kmscon_text *txt,
+		   unsigned int posx, unsigned int posy, unsigned int num,
+		   uint8_t r, uint8_t g, uint8_t b)
+{
+	struct tp_pixman *tp = txt->data;
+	unsigned int x, y, w, h;
+	int ret;
+
+	ret = flush_run(txt);
+	if (ret)
+		return ret;
+
+	x = posx * txt->font->attr.width;
+	y = posy * txt->font->attr.height;
+	w = num * txt->font->attr.width;
+	h = txt->font->attr.height;
+
+	pixman_fill(tp->c_data, tp->c_stride / 4, tp->c_bpp,
+		    x, y, w, h, (r << 16) | (g << 8) | b);
+
+	if (!tp->use_indirect)
+		uterm_display_damage(txt->disp, x, y, w, h);
+
+	return 0;
+}
+
 struct kmscon_text_ops kmscon_text_pixman_ops = {
 	.name = "pixman",
 	.owner = NULL,
@@ -499,4 +591,6 @@ struct kmscon_text_ops kmscon_text_pixman_ops = {
 	.draw = tp_draw,
 	.render = tp_render,
 	.abort = NULL,
+	.move = tp_move,
+	.fill = tp_fill,
 };
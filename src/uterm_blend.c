@@ -0,0 +1,376 @@
+/*
+ * uterm - Linux User-Space Terminal
+ *
+ * Copyright (c) 2011-2013 David Herrmann <dh.herrmann@googlemail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Glyph Blending Kernels
+ * The scalar kernels are the reference implementation. The SIMD kernels
+ * compute all channels in 16bit lanes, which is enough as the largest
+ * intermediate value is 255 * 255 + 255 + 0x80. They process 8 or 16 pixels
+ * per iteration and leave the remaining pixels of a row to the scalar kernels.
+ *
+ * x86 kernels are only built for x86-64 where SSE2 is always available. AVX2
+ * is detected at runtime. NEON has no reliable runtime detection on all ARM
+ * platforms, so it is used whenever the compiler targets it.
+ */
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include "shl_log.h"
+#include "uterm_blend_internal.h"
+
+#define LOG_SUBSYSTEM "blend"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define BLEND_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) && defined(__BYTE_ORDER__) && \
+    __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define BLEND_NEON 1
+#include <arm_neon.h>
+#endif
+
+/*
+ * Scalar kernels
+ */
+
+static bool scalar_supported(void)
+{
+	return true;
+}
+
+static void scalar_blend255(uint32_t *dst, const uint8_t *src,
+			    unsigned int num, uint32_t fg, uint32_t bg)
+{
+	unsigned int i;
+	uint_fast32_t r, g, b;
+	uint_fast32_t fr, fgr, fb, br, bgr, bb;
+
+	fr = (fg >> 16) & 0xff;
+	fgr = (fg >> 8) & 0xff;
+	fb = fg & 0xff;
+	br = (bg >> 16) & 0xff;
+	bgr = (bg >> 8) & 0xff;
+	bb = bg & 0xff;
+
+	for (i = 0; i < num; ++i) {
+		/* Division by 255 (t /= 255) is done with:
+		 *   t += 0x80
+		 *   t = (t + (t >> 8)) >> 8
+		 * This speeds up the computation by ~20% as the
+		 * division is not needed. */
+		if (src[i] == 0) {
+			dst[i] = (br << 16) | (bgr << 8) | bb;
+		} else if (src[i] == 255) {
+			dst[i] = (fr << 16) | (fgr << 8) | fb;
+		} else {
+			r = fr * src[i] + br * (255 - src[i]);
+			r += 0x80;
+			r = (r + (r >> 8)) >> 8;
+
+			g = fgr * src[i] + bgr * (255 - src[i]);
+			g += 0x80;
+			g = (g + (g >> 8)) >> 8;
+
+			b = fb * src[i] + bb * (255 - src[i]);
+			b += 0x80;
+			b = (b + (b >> 8)) >> 8;
+
+			dst[i] = (r << 16) | (g << 8) | b;
+		}
+	}
+}
+
+static const struct uterm_blend_ops scalar_ops = {
+	.name = "scalar",
+	.supported = scalar_supported,
+	.blend255 = scalar_blend255,
+};
+
+/*
+ * SSE2 kernels
+ */
+
+#ifdef BLEND_X86
+
+static inline __m128i sse2_channel(__m128i a, __m128i ia, uint32_t fg,
+				   uint32_t bg, unsigned int shift)
+{
+	__m128i f, b, t;
+
+	f = _mm_set1_epi16((fg >> shift) & 0xff);
+	b = _mm_set1_epi16((bg >> shift) & 0xff);
+	t = _mm_add_epi16(_mm_mullo_epi16(f, a), _mm_mullo_epi16(b, ia));
+
+	t = _mm_add_epi16(t, _mm_set1_epi16(0x80));
+	t = _mm_add_epi16(t, _mm_srli_epi16(t, 8));
+	return _mm_srli_epi16(t, 8);
+}
+
+/* blend 8 pixels */
+static inline void sse2_blend8(uint32_t *dst, const uint8_t *src,
+			       uint32_t fg, uint32_t bg)
+{
+	__m128i zero, a, ia, r, g, b, bgv, rv;
+
+	zero = _mm_setzero_si128();
+	a = _mm_loadl_epi64((const __m128i*)src);
+	a = _mm_unpacklo_epi8(a, zero);
+	ia = _mm_sub_epi16(_mm_set1_epi16(255), a);
+
+	r = sse2_channel(a, ia, fg, bg, 16);
+	g = sse2_channel(a, ia, fg, bg, 8);
+	b = sse2_channel(a, ia, fg, bg, 0);
+
+	/* interleave to B G R X bytes which is XRGB32 in little-endian */
+	r = _mm_packus_epi16(r, zero);
+	g = _mm_packus_epi16(g, zero);
+	b = _mm_packus_epi16(b, zero);
+	bgv = _mm_unpacklo_epi8(b, g);
+	rv = _mm_unpacklo_epi8(r, zero);
+
+	_mm_storeu_si128((__m128i*)dst, _mm_unpacklo_epi16(bgv, rv));
+	_mm_storeu_si128((__m128i*)&dst[4], _mm_unpackhi_epi16(bgv, rv));
+}
+
+static bool sse2_supported(void)
+{
+	return true;
+}
+
+static void sse2_blend255(uint32_t *dst, const uint8_t *src,
+			  unsigned int num, uint32_t fg, uint32_t bg)
+{
+	for ( ; num >= 8; num -= 8, dst += 8, src += 8)
+		sse2_blend8(dst, src, fg, bg);
+
+	scalar_blend255(dst, src, num, fg, bg);
+}
+
+static const struct uterm_blend_ops sse2_ops = {
+	.name = "sse2",
+	.supported = sse2_supported,
+	.blend255 = sse2_blend255,
+};
+
+/*
+ * AVX2 kernels
+ */
+
+__attribute__((target("avx2")))
+static inline __m256i avx2_channel(__m256i a, __m256i ia, uint32_t fg,
+				   uint32_t bg, unsigned int shift)
+{
+	__m256i f, b, t;
+
+	f = _mm256_set1_epi16((fg >> shift) & 0xff);
+	b = _mm256_set1_epi16((bg >> shift) & 0xff);
+	t = _mm256_add_epi16(_mm256_mullo_epi16(f, a),
+			     _mm256_mullo_epi16(b, ia));
+
+	t = _mm256_add_epi16(t, _mm256_set1_epi16(0x80));
+	t = _mm256_add_epi16(t, _mm256_srli_epi16(t, 8));
+	return _mm256_srli_epi16(t, 8);
+}
+
+/* blend 16 pixels */
+__attribute__((target("avx2")))
+static inline void avx2_blend16(uint32_t *dst, const uint8_t *src,
+				uint32_t fg, uint32_t bg)
+{
+	__m256i zero, a, ia, r, g, b, bgv, rv, lo, hi;
+
+	zero = _mm256_setzero_si256();
+	a = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)src));
+	ia = _mm256_sub_epi16(_mm256_set1_epi16(255), a);
+
+	r = avx2_channel(a, ia, fg, bg, 16);
+	g = avx2_channel(a, ia, fg, bg, 8);
+	b = avx2_channel(a, ia, fg, bg, 0);
+
+	/* Unpacking works per 128bit lane, so we end up with pixels 0-3 and
+	 * 8-11 in @lo and 4-7 and 12-15 in @hi. */
+	r = _mm256_packus_epi16(r, zero);
+	g = _mm256_packus_epi16(g, zero);
+	b = _mm256_packus_epi16(b, zero);
+	bgv = _mm256_unpacklo_epi8(b, g);
+	rv = _mm256_unpacklo_epi8(r, zero);
+	lo = _mm256_unpacklo_epi16(bgv, rv);
+	hi = _mm256_unpackhi_epi16(bgv, rv);
+
+	_mm256_storeu_si256((__m256i*)dst,
+			    _mm256_permute2x128_si256(lo, hi, 0x20));
+	_mm256_storeu_si256((__m256i*)&dst[8],
+			    _mm256_permute2x128_si256(lo, hi, 0x31));
+}
+
+static bool avx2_supported(void)
+{
+	return __builtin_cpu_supports("avx2");
+}
+
+__attribute__((target("avx2")))
+static void avx2_blend255(uint32_t *dst, const uint8_t *src,
+			  unsigned int num, uint32_t fg, uint32_t bg)
+{
+	for ( ; num >= 16; num -= 16, dst += 16, src += 16)
+		avx2_blend16(dst, src, fg, bg);
+
+	sse2_blend255(dst, src, num, fg, bg);
+}
+
+static const struct uterm_blend_ops avx2_ops = {
+	.name = "avx2",
+	.supported = avx2_supported,
+	.blend255 = avx2_blend255,
+};
+
+#endif /* BLEND_X86 */
+
+/*
+ * NEON kernels
+ */
+
+#ifdef BLEND_NEON
+
+static inline uint8x16_t neon_channel(uint8x16_t a, uint8x16_t ia,
+				      uint32_t fg, uint32_t bg,
+				      unsigned int shift)
+{
+	uint8x8_t f, b;
+	uint16x8_t lo, hi;
+
+	f = vdup_n_u8((fg >> shift) & 0xff);
+	b = vdup_n_u8((bg >> shift) & 0xff);
+	lo = vmlal_u8(vmull_u8(vget_low_u8(a), f), vget_low_u8(ia), b);
+	hi = vmlal_u8(vmull_u8(vget_high_u8(a), f), vget_high_u8(ia), b);
+
+	lo = vaddq_u16(lo, vdupq_n_u16(0x80));
+	lo = vaddq_u16(lo, vshrq_n_u16(lo, 8));
+	hi = vaddq_u16(hi, vdupq_n_u16(0x80));
+	hi = vaddq_u16(hi, vshrq_n_u16(hi, 8));
+	return vcombine_u8(vshrn_n_u16(lo, 8), vshrn_n_u16(hi, 8));
+}
+
+/* blend 16 pixels */
+static inline void neon_blend16(uint32_t *dst, const uint8_t *src,
+				uint32_t fg, uint32_t bg)
+{
+	uint8x16_t a, ia;
+	uint8x16x4_t px;
+
+	a = vld1q_u8(src);
+	ia = vmvnq_u8(a);
+
+	/* B G R X bytes is XRGB32 in little-endian */
+	px.val[0] = neon_channel(a, ia, fg, bg, 0);
+	px.val[1] = neon_channel(a, ia, fg, bg, 8);
+	px.val[2] = neon_channel(a, ia, fg, bg, 16);
+	px.val[3] = vdupq_n_u8(0);
+	vst4q_u8((uint8_t*)dst, px);
+}
+
+/* blend 8 pixels */
+static inline void neon_blend8(uint32_t *dst, const uint8_t *src,
+			       uint32_t fg, uint32_t bg)
+{
+	uint8x16_t a, ia;
+	uint8x8x4_t px;
+
+	a = vcombine_u8(vld1_u8(src), vdup_n_u8(0));
+	ia = vmvnq_u8(a);
+
+	px.val[0] = vget_low_u8(neon_channel(a, ia, fg, bg, 0));
+	px.val[1] = vget_low_u8(neon_channel(a, ia, fg, bg, 8));
+	px.val[2] = vget_low_u8(neon_channel(a, ia, fg, bg, 16));
+	px.val[3] = vdup_n_u8(0);
+	vst4_u8((uint8_t*)dst, px);
+}
+
+static bool neon_supported(void)
+{
+	return true;
+}
+
+static void neon_blend255(uint32_t *dst, const uint8_t *src,
+			  unsigned int num, uint32_t fg, uint32_t bg)
+{
+	for ( ; num >= 16; num -= 16, dst += 16, src += 16)
+		neon_blend16(dst, src, fg, bg);
+	if (num >= 8) {
+		neon_blend8(dst, src, fg, bg);
+		num -= 8;
+		dst += 8;
+		src += 8;
+	}
+
+	scalar_blend255(dst, src, num, fg, bg);
+}
+
+static const struct uterm_blend_ops neon_ops = {
+	.name = "neon",
+	.supported = neon_supported,
+	.blend255 = neon_blend255,
+};
+
+#endif /* BLEND_NEON */
+
+const struct uterm_blend_ops *uterm_blend_kernels[] = {
+#ifdef BLEND_X86
+	&avx2_ops,
+	&sse2_ops,
+#endif
+#ifdef BLEND_NEON
+	&neon_ops,
+#endif
+	&scalar_ops,
+	NULL,
+};
+
+static const struct uterm_blend_ops *blend_ops;
+static pthread_once_t blend_once = PTHREAD_ONCE_INIT;
+
+static void blend_select(void)
+{
+	unsigned int i;
+
+	for (i = 0; uterm_blend_kernels[i]; ++i) {
+		if (uterm_blend_kernels[i]->supported())
+			break;
+	}
+
+	blend_ops = uterm_blend_kernels[i];
+	log_debug("using %s glyph blending", blend_ops->name);
+}
+
+/* may be called from render threads concurrently */
+const struct uterm_blend_ops *uterm_blend_get(void)
+{
+	pthread_once(&blend_once, blend_select);
+	return blend_ops;
+}
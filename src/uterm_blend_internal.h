@@ -0,0 +1,60 @@
+/*
+ * uterm - Linux User-Space Terminal
+ *
+ * Copyright (c) 2011-2013 David Herrmann <dh.herrmann@googlemail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Glyph Blending
+ * The software renderers blend GREY glyph masks with a foreground and
+ * background color into XRGB32 buffers. Each kernel blends a single row of
+ * @num pixels. @fg and @bg are XRGB32 colors. blend255 divides by 255 with
+ * correct rounding. All renderers use it, so glyphs look the same whether they
+ * are blended directly or taken from the glyph cache.
+ *
+ * Several CPU specific implementations are available. uterm_blend_get()
+ * returns the fastest kernel supported by the running CPU. All kernels must
+ * produce exactly the same results as the scalar kernel.
+ */
+
+#ifndef UTERM_BLEND_INTERNAL_H
+#define UTERM_BLEND_INTERNAL_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+typedef void (*uterm_blend_fn) (uint32_t *dst, const uint8_t *src,
+				unsigned int num, uint32_t fg, uint32_t bg);
+
+struct uterm_blend_ops {
+	const char *name;
+	bool (*supported) (void);
+	uterm_blend_fn blend255;
+};
+
+/* NULL-terminated, sorted by preference; the scalar kernel is always last */
+extern const struct uterm_blend_ops *uterm_blend_kernels[];
+
+const struct uterm_blend_ops *uterm_blend_get(void);
+
+#endif /* UTERM_BLEND_INTERNAL_H */
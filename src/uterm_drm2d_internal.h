@@ -34,24 +34,50 @@
 #include <stdlib.h>
 #include "uterm_video.h"
 
+struct uterm_drm2d_span {
+	unsigned int x1;
+	unsigned int x2;
+};
+
 struct uterm_drm2d_rb {
 	uint32_t fb;
 	uint32_t handle;
 	uint32_t stride;
 	uint64_t size;
 	void *map;
+
+	/* frames since this buffer was presented; 0 if its content is
+	 * undefined */
+	unsigned int age;
+	/* area drawn into this buffer during the current frame, per row; only
+	 * tracked in dirty-only mode */
+	struct uterm_drm2d_span *drawn;
 };
 
 struct uterm_drm2d_display {
 	int current_rb;
 	struct uterm_drm2d_rb rb[2];
+	/* draw into the scanned-out buffer and flush damaged areas only */
+	bool dirty_only;
 };
 
+static inline struct uterm_drm2d_rb *uterm_drm2d_target(
+					struct uterm_drm2d_display *d2d)
+{
+	if (d2d->dirty_only)
+		return &d2d->rb[d2d->current_rb];
+	else
+		return &d2d->rb[d2d->current_rb ^ 1];
+}
+
 struct uterm_drm2d_video {
 	int fd;
 	struct ev_fd *efd;
 };
 
+int uterm_drm2d_display_damage(struct uterm_display *disp,
+			       unsigned int x, unsigned int y,
+			       unsigned int width, unsigned int height);
 int uterm_drm2d_display_blit(struct uterm_display *disp,
 			     const struct uterm_video_buffer *buf,
 			     unsigned int x, unsigned int y);
@@ -62,5 +88,9 @@ int uterm_drm2d_display_fill(struct uterm_display *disp,
 			     uint8_t r, uint8_t g, uint8_t b,
 			     unsigned int x, unsigned int y,
 			     unsigned int width, unsigned int height);
+int uterm_drm2d_display_copy(struct uterm_display *disp,
+			     unsigned int src_x, unsigned int src_y,
+			     unsigned int dst_x, unsigned int dst_y,
+			     unsigned int width, unsigned int height);
 
 #endif /* UTERM_DRM2D_INTERNAL_H */
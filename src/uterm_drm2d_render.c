@@ -39,6 +39,7 @@
 #include <xf86drmMode.h>
 #include "eloop.h"
 #include "shl_log.h"
+#include "uterm_blend_internal.h"
 #include "uterm_drm_shared_internal.h"
 #include "uterm_drm2d_internal.h"
 #include "uterm_video.h"
@@ -46,6 +47,51 @@
 
 #define LOG_SUBSYSTEM "uterm_drm2d_render"
 
+/* Damage is tracked per row so parallel blending of disjoint rows never
+ * touches the same span. */
+static void add_damage(struct uterm_drm2d_rb *rb, unsigned int x,
+		       unsigned int y, unsigned int width,
+		       unsigned int height)
+{
+	struct uterm_drm2d_span *span;
+
+	if (!rb->drawn || !width)
+		return;
+
+	for (span = &rb->drawn[y]; height--; ++span) {
+		if (span->x1 >= span->x2) {
+			span->x1 = x;
+			span->x2 = x + width;
+		} else {
+			if (x < span->x1)
+				span->x1 = x;
+			if (x + width > span->x2)
+				span->x2 = x + width;
+		}
+	}
+}
+
+int uterm_drm2d_display_damage(struct uterm_display *disp,
+			       unsigned int x, unsigned int y,
+			       unsigned int width, unsigned int height)
+{
+	unsigned int sw, sh;
+	struct uterm_drm2d_display *d2d = uterm_drm_display_get_data(disp);
+
+	sw = uterm_drm_mode_get_width(disp->current_mode);
+	sh = uterm_drm_mode_get_height(disp->current_mode);
+
+	if (x >= sw || y >= sh)
+		return -EINVAL;
+	if (width > sw - x)
+		width = sw - x;
+	if (height > sh - y)
+		height = sh - y;
+
+	add_damage(uterm_drm2d_target(d2d), x, y, width, height);
+	return 0;
+}
+
 int uterm_drm2d_display_blit(struct uterm_display *disp,
 			     const struct uterm_video_buffer *buf,
 			     unsigned int x, unsigned int y)
@@ -60,7 +106,7 @@ int uterm_drm2d_display_blit(struct uterm_display *disp,
 	if (!buf || buf->format != UTERM_FORMAT_XRGB32)
 		return -EINVAL;
 
-	rb = &d2d->rb[d2d->current_rb ^ 1];
+	rb = uterm_drm2d_target(d2d);
 	sw = uterm_drm_mode_get_width(disp->current_mode);
 	sh = uterm_drm_mode_get_height(disp->current_mode);
 
@@ -83,6 +129,7 @@ int uterm_drm2d_display_blit(struct uterm_display *disp,
 	dst = rb->map;
 	dst = &dst[y * rb->stride + x * 4];
 	src = buf->data;
+	add_damage(rb, x, y, width, height);
 
 	while (height--) {
 		memcpy(dst, src, 4 * width);
@@ -99,16 +146,17 @@ int uterm_drm2d_display_fake_blendv(struct uterm_display *disp,
 {
 	unsigned int tmp;
 	uint8_t *dst, *src;
-	unsigned int width, height, i, j;
+	unsigned int width, height, j;
 	unsigned int sw, sh;
-	uint_fast32_t r, g, b, out;
+	uint32_t fg, bg;
 	struct uterm_drm2d_rb *rb;
 	struct uterm_drm2d_display *d2d = uterm_drm_display_get_data(disp);
+	const struct uterm_blend_ops *blend = uterm_blend_get();
 
 	if (!req)
 		return -EINVAL;
 
-	rb = &d2d->rb[d2d->current_rb ^ 1];
+	rb = uterm_drm2d_target(d2d);
 	sw = uterm_drm_mode_get_width(disp->current_mode);
 	sh = uterm_drm_mode_get_height(disp->current_mode);
 
@@ -138,44 +186,13 @@ int uterm_drm2d_display_fake_blendv(struct uterm_display *disp,
 		dst = rb->map;
 		dst = &dst[req->y * rb->stride + req->x * 4];
 		src = req->buf->data;
+		add_damage(rb, req->x, req->y, width, height);
+
+		fg = (req->fr << 16) | (req->fg << 8) | req->fb;
+		bg = (req->br << 16) | (req->bg << 8) | req->bb;
 
 		while (height--) {
-			for (i = 0; i < width; ++i) {
-				/* Division by 255 (t /= 255) is done with:
-				 *   t += 0x80
-				 *   t = (t + (t >> 8)) >> 8
-				 * This speeds up the computation by ~20% as the
-				 * division is not needed. */
-				if (src[i] == 0) {
-					r = req->br;
-					g = req->bg;
-					b = req->bb;
-					out = (r << 16) | (g << 8) | b;
-				} else if (src[i] == 255) {
-					r = req->fr;
-					g = req->fg;
-					b = req->fb;
-					out = (r << 16) | (g << 8) | b;
-				} else {
-					r = req->fr * src[i] +
-					    req->br * (255 - src[i]);
-					r += 0x80;
-					r = (r + (r >> 8)) >> 8;
-
-					g = req->fg * src[i] +
-					    req->bg * (255 - src[i]);
-					g += 0x80;
-					g = (g + (g >> 8)) >> 8;
-
-					b = req->fb * src[i] +
-					    req->bb * (255 - src[i]);
-					b += 0x80;
-					b = (b + (b >> 8)) >> 8;
-					out = (r << 16) | (g << 8) | b;
-				}
-
-				((uint32_t*)dst)[i] = out;
-			}
+			blend->blend255((uint32_t*)dst, src, width, fg, bg);
 			dst += rb->stride;
 			src += req->buf->stride;
 		}
@@ -195,7 +212,7 @@ int uterm_drm2d_display_fill(struct uterm_display *disp,
 	struct uterm_drm2d_rb *rb;
 	struct uterm_drm2d_display *d2d = uterm_drm_display_get_data(disp);
 
-	rb = &d2d->rb[d2d->current_rb ^ 1];
+	rb = uterm_drm2d_target(d2d);
 	sw = uterm_drm_mode_get_width(disp->current_mode);
 	sh = uterm_drm_mode_get_height(disp->current_mode);
 
@@ -212,6 +229,7 @@ int uterm_drm2d_display_fill(struct uterm_display *disp,
 
 	dst = rb->map;
 	dst = &dst[y * rb->stride + x * 4];
+	add_damage(rb, x, y, width, height);
 
 	while (height--) {
 		for (i = 0; i < width; ++i)
@@ -221,3 +239,55 @@ int uterm_drm2d_display_fill(struct uterm_display *disp,
 
 	return 0;
 }
+
+int uterm_drm2d_display_copy(struct uterm_display *disp,
+			     unsigned int src_x, unsigned int src_y,
+			     unsigned int dst_x, unsigned int dst_y,
+			     unsigned int width, unsigned int height)
+{
+	uint8_t *dst, *src;
+	unsigned int sw, sh;
+	int step;
+	struct uterm_drm2d_rb *rb;
+	struct uterm_drm2d_display *d2d = uterm_drm_display_get_data(disp);
+
+	rb = uterm_drm2d_target(d2d);
+	sw = uterm_drm_mode_get_width(disp->current_mode);
+	sh = uterm_drm_mode_get_height(disp->current_mode);
+
+	if (src_x >= sw || dst_x >= sw || src_y >= sh || dst_y >= sh)
+		return -EINVAL;
+	if (width > sw - src_x)
+		width = sw - src_x;
+	if (width > sw - dst_x)
+		width = sw - dst_x;
+	if (height > sh - src_y)
+		height = sh - src_y;
+	if (height > sh - dst_y)
+		height = sh - dst_y;
+	if (!width || !height)
+		return 0;
+
+	dst = rb->map;
+	src = rb->map;
+	dst = &dst[dst_y * rb->stride + dst_x * 4];
+	src = &src[src_y * rb->stride + src_x * 4];
+	add_damage(rb, dst_x, dst_y, width, height);
+
+	/* copy bottom-up if we move downwards so we never overwrite rows
+	 * that are still to be copied */
+	step = rb->stride;
+	if (dst_y > src_y) {
+		dst += (height - 1) * rb->stride;
+		src += (height - 1) * rb->stride;
+		step = -step;
+	}
+
+	while (height--) {
+		memmove(dst, src, 4 * width);
+		dst += step;
+		src += step;
+	}
+
+	return 0;
+}
@@ -77,9 +77,22 @@ static int init_rb(struct uterm_display *disp, struct uterm_drm2d_rb *rb)
 	int ret, r;
 	struct uterm_video *video = disp->video;
 	struct uterm_drm_video *vdrm = video->data;
+	struct uterm_drm2d_display *d2d = uterm_drm_display_get_data(disp);
 	struct drm_mode_create_dumb req;
 	struct drm_mode_destroy_dumb dreq;
 	struct drm_mode_map_dumb mreq;
+	unsigned int height;
+
+	rb->age = 0;
+
+	/* drawn areas are only passed to the driver in dirty-only mode; page
+	 * flips rely on the buffer age alone */
+	if (d2d->dirty_only) {
+		height = uterm_drm_mode_get_height(disp->current_mode);
+		rb->drawn = calloc(height, sizeof(*rb->drawn));
+		if (!rb->drawn)
+			return -ENOMEM;
+	}
 
 	memset(&req, 0, sizeof(req));
 	req.width = uterm_drm_mode_get_width(disp->current_mode);
@@ -90,7 +103,8 @@ static int init_rb(struct uterm_display *disp, struct uterm_drm2d_rb *rb)
 	ret = drmIoctl(vdrm->fd, DRM_IOCTL_MODE_CREATE_DUMB, &req);
 	if (ret < 0) {
 		log_err("cannot create dumb drm buffer");
-		return -EFAULT;
+		ret = -EFAULT;
+		goto err_damage;
 	}
 
 	rb->handle = req.handle;
@@ -135,6 +149,9 @@ err_buf:
 	if (r)
 		log_warning("cannot destroy dumb buffer (%d/%d): %m",
 			    ret, errno);
+err_damage:
+	free(rb->drawn);
+	rb->drawn = NULL;
 
 	return ret;
 }
@@ -154,6 +171,9 @@ static void destroy_rb(struct uterm_display *disp, struct uterm_drm2d_rb *rb)
 	if (ret)
 		log_warning("cannot destroy dumb buffer (%d/%d): %m",
 			    ret, errno);
+
+	free(rb->drawn);
+	rb->drawn = NULL;
 }
 
 static int display_activate(struct uterm_display *disp, struct uterm_mode *mode)
@@ -177,6 +197,7 @@ static int display_activate(struct uterm_display *disp, struct uterm_mode *mode)
 		return ret;
 
 	d2d->current_rb = 0;
+	d2d->dirty_only = disp->video->dirty_only;
 	disp->current_mode = mode;
 
 	ret = init_rb(disp, &d2d->rb[0]);
@@ -196,7 +217,7 @@ static int display_activate(struct uterm_display *disp, struct uterm_mode *mode)
 		goto err_fb;
 	}
 
-	disp->flags |= DISPLAY_ONLINE;
+	disp->flags |= DISPLAY_ONLINE | DISPLAY_PARALLEL;
 	return 0;
 
 err_fb:
@@ -231,6 +252,8 @@ static int display_use(struct uterm_display *disp, bool *opengl)
 	if (opengl)
 		*opengl = false;
 
+	if (d2d->dirty_only)
+		return d2d->current_rb;
 	return d2d->current_rb ^ 1;
 }
 
@@ -257,16 +280,101 @@ static int display_get_buffers(struct uterm_display *disp,
 	return 0;
 }
 
+/*
+ * Buffer Age
+ * Renderers that redraw only what changed must know what the back-buffer
+ * contains. Like EGL_EXT_buffer_age, we count the frames since each buffer was
+ * presented. The age is 0 while the content of a buffer is undefined.
+ */
+static int display_get_buffer_age(struct uterm_display *disp)
+{
+	struct uterm_drm2d_display *d2d = uterm_drm_display_get_data(disp);
+
+	return uterm_drm2d_target(d2d)->age;
+}
+
+/*
+ * Dirty-Only Mode
+ * Some devices, like USB displays or virtual GPUs, upload the whole
+ * framebuffer on each page-flip. If requested, we never flip but draw directly
+ * into the scanned-out buffer and pass the drawn areas as dirty rectangles to
+ * the driver. Consecutive damaged rows are merged into a single rectangle so
+ * a redraw of a text-line results in one clip.
+ */
+#define DIRTY_MAX_CLIPS 64
+
+static int display_swap_dirty(struct uterm_display *disp, bool immediate)
+{
+	int ret;
+	unsigned int i, sh, num = 0;
+	struct uterm_drm2d_display *d2d = uterm_drm_display_get_data(disp);
+	struct uterm_drm2d_rb *rb = &d2d->rb[d2d->current_rb];
+	struct uterm_drm2d_span *span;
+	drmModeClip clips[DIRTY_MAX_CLIPS], *clip = NULL;
+
+	sh = uterm_drm_mode_get_height(disp->current_mode);
+
+	for (i = 0; i < sh; ++i) {
+		span = &rb->drawn[i];
+		if (span->x1 >= span->x2) {
+			clip = NULL;
+			continue;
+		}
+
+		if (!clip) {
+			if (num < DIRTY_MAX_CLIPS) {
+				clip = &clips[num++];
+				clip->x1 = span->x1;
+				clip->x2 = span->x2;
+				clip->y1 = i;
+			} else {
+				clip = &clips[num - 1];
+			}
+		}
+
+		if (span->x1 < clip->x1)
+			clip->x1 = span->x1;
+		if (span->x2 > clip->x2)
+			clip->x2 = span->x2;
+		clip->y2 = i + 1;
+
+		span->x1 = 0;
+		span->x2 = 0;
+	}
+
+	ret = uterm_drm_display_swap(disp, rb->fb, clips, num, immediate);
+	if (ret) {
+		/* the device missed the damage; force a full redraw */
+		rb->age = 0;
+		return ret;
+	}
+
+	rb->age = 1;
+	return 0;
+}
+
 static int display_swap(struct uterm_display *disp, bool immediate)
 {
 	int ret, rb;
 	struct uterm_drm2d_display *d2d = uterm_drm_display_get_data(disp);
+	struct uterm_drm2d_rb *back, *front;
+
+	if (d2d->dirty_only)
+		return display_swap_dirty(disp, immediate);
 
 	rb = d2d->current_rb ^ 1;
-	ret = uterm_drm_display_swap(disp, d2d->rb[rb].fb, immediate);
+	ret = uterm_drm_display_swap(disp, d2d->rb[rb].fb, NULL, 0,
+				     immediate);
 	if (ret)
 		return ret;
 
+	back = &d2d->rb[rb];
+	front = &d2d->rb[rb ^ 1];
+
+	back->age = 1;
+	if (front->age)
+		++front->age;
+
 	d2d->current_rb = rb;
 	return 0;
 }
@@ -280,9 +388,12 @@ static const struct display_ops drm2d_display_ops = {
 	.use = display_use,
 	.get_buffers = display_get_buffers,
 	.swap = display_swap,
+	.get_buffer_age = display_get_buffer_age,
+	.damage = uterm_drm2d_display_damage,
 	.blit = uterm_drm2d_display_blit,
 	.fake_blendv = uterm_drm2d_display_fake_blendv,
 	.fill = uterm_drm2d_display_fill,
+	.copy = uterm_drm2d_display_copy,
 };
 
 static void show_displays(struct uterm_video *video)
@@ -312,6 +423,7 @@ static void show_displays(struct uterm_video *video)
 		d2d = uterm_drm_display_get_data(iter);
 		rb = &d2d->rb[d2d->current_rb];
 		memset(rb->map, 0, rb->size);
+		rb->age = 0;
 		uterm_drm_display_wait_pflip(iter);
 	}
 }
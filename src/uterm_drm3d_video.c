@@ -318,7 +318,7 @@ static int display_swap(struct uterm_display *disp, bool immediate)
 		return -EFAULT;
 	}
 
-	ret = uterm_drm_display_swap(disp, rb->fb, immediate);
+	ret = uterm_drm_display_swap(disp, rb->fb, NULL, 0, immediate);
 	if (ret) {
 		gbm_surface_release_buffer(d3d->gbm, bo);
 		return ret;
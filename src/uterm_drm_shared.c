@@ -331,7 +331,16 @@ int uterm_drm_display_wait_pflip(struct uterm_display *disp)
 	return 0;
 }
 
+/*
+ * If @clips is given, @fb is already scanned out and was modified in place.
+ * Instead of flipping, we only report the dirty rectangles to the driver so
+ * devices that upload the framebuffer, like USB displays, transfer only what
+ * changed. The page-flip event is emulated via the vblank timer. Drivers
+ * without dirty-tracking scan out the buffer directly so nothing needs to be
+ * done for them.
+ */
 int uterm_drm_display_swap(struct uterm_display *disp, uint32_t fb,
+			   drmModeClip *clips, unsigned int num,
 			   bool immediate)
 {
 	struct uterm_drm_display *ddrm = disp->data;
@@ -343,6 +352,21 @@ int uterm_drm_display_swap(struct uterm_display *disp, uint32_t fb,
 	if (disp->dpms != UTERM_DPMS_ON)
 		return -EINVAL;
 
+	if (clips) {
+		if (num && !vdrm->no_dirty) {
+			ret = drmModeDirtyFB(vdrm->fd, fb, clips, num);
+			if (ret == -ENOSYS) {
+				log_debug("driver does not track dirty framebuffers");
+				vdrm->no_dirty = true;
+			} else if (ret) {
+				log_warning("cannot mark DRM-FB as dirty (%d)",
+					    ret);
+			}
+		}
+
+		return display_schedule_vblank_timer(disp);
+	}
+
 	if (immediate) {
 		ret = uterm_drm_display_wait_pflip(disp);
 		if (ret)
@@ -79,6 +79,7 @@ void uterm_drm_display_deactivate(struct uterm_display *disp, int fd);
 int uterm_drm_display_set_dpms(struct uterm_display *disp, int state);
 int uterm_drm_display_wait_pflip(struct uterm_display *disp);
 int uterm_drm_display_swap(struct uterm_display *disp, uint32_t fb,
+			   drmModeClip *clips, unsigned int num,
 			   bool immediate);
 
 static inline void *uterm_drm_display_get_data(struct uterm_display *disp)
@@ -100,6 +101,8 @@ struct uterm_drm_video {
 	struct shl_timer *timer;
 	struct ev_timer *vt_timer;
 	const struct display_ops *display_ops;
+	/* driver does not support drmModeDirtyFB() */
+	bool no_dirty;
 };
 
 int uterm_drm_video_init(struct uterm_video *video, const char *node,
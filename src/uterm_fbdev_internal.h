@@ -40,6 +40,23 @@ struct fbdev_mode {
 	unsigned int height;
 };
 
+struct fbdev_span {
+	unsigned int x1;
+	unsigned int x2;
+};
+
+/* size of the ordered-dither matrix and of the channel lookup tables, which
+ * cover a channel value plus the largest dither offset */
+#define FBDEV_DITHER_SIZE 4
+#define FBDEV_LUT_SIZE 384
+
+struct fbdev_display;
+
+typedef void (*fbdev_convert_fn) (const struct fbdev_display *fbdev,
+				  void *dst, const uint32_t *src,
+				  unsigned int num, unsigned int x,
+				  unsigned int y);
+
 struct fbdev_display {
 	int fd;
 	struct fb_fix_screeninfo finfo;
@@ -54,6 +71,18 @@ struct fbdev_display {
 	uint8_t *map;
 	unsigned int stride;
 
+	/* shadow buffer in system RAM and damaged area per row */
+	bool shadow_probed;
+	bool slow_reads;
+	uint8_t *shadow;
+	size_t shadow_len;
+	size_t shadow_xres;
+	size_t shadow_yres;
+	unsigned int shadow_stride;
+	struct fbdev_span *damage;
+	/* buffer handed out by get_buffers() */
+	uint8_t *data;
+
 	bool xrgb32;
 	bool rgb16;
 	unsigned int Bpp;
@@ -63,9 +92,15 @@ struct fbdev_display {
 	unsigned int len_r;
 	unsigned int len_g;
 	unsigned int len_b;
-	int_fast32_t dither_r;
-	int_fast32_t dither_g;
-	int_fast32_t dither_b;
+
+	/* XRGB32 to device format conversion for non-XRGB32 framebuffers */
+	fbdev_convert_fn convert;
+	uint32_t lut_r[FBDEV_LUT_SIZE];
+	uint32_t lut_g[FBDEV_LUT_SIZE];
+	uint32_t lut_b[FBDEV_LUT_SIZE];
+	uint8_t dither_r[FBDEV_DITHER_SIZE][FBDEV_DITHER_SIZE];
+	uint8_t dither_g[FBDEV_DITHER_SIZE][FBDEV_DITHER_SIZE];
+	uint8_t dither_b[FBDEV_DITHER_SIZE][FBDEV_DITHER_SIZE];
 };
 
 struct fbdev_video {
@@ -73,15 +108,23 @@ struct fbdev_video {
 	bool pending_intro;
 };
 
+void uterm_fbdev_display_init_convert(struct uterm_display *disp);
 int uterm_fbdev_display_blit(struct uterm_display *disp,
 			     const struct uterm_video_buffer *buf,
 			     unsigned int x, unsigned int y);
 int uterm_fbdev_display_fake_blendv(struct uterm_display *disp,
 				    const struct uterm_video_blend_req *req,
 				    size_t num);
+int uterm_fbdev_display_damage(struct uterm_display *disp,
+			       unsigned int x, unsigned int y,
+			       unsigned int width, unsigned int height);
 int uterm_fbdev_display_fill(struct uterm_display *disp,
 			     uint8_t r, uint8_t g, uint8_t b,
 			     unsigned int x, unsigned int y,
 			     unsigned int width, unsigned int height);
+int uterm_fbdev_display_copy(struct uterm_display *disp,
+			     unsigned int src_x, unsigned int src_y,
+			     unsigned int dst_x, unsigned int dst_y,
+			     unsigned int width, unsigned int height);
 
 #endif /* UTERM_FBDEV_INTERNAL_H */
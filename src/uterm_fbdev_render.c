@@ -32,72 +32,219 @@
 #include <stdlib.h>
 #include <string.h>
 #include "shl_log.h"
+#include "uterm_blend_internal.h"
 #include "uterm_fbdev_internal.h"
 #include "uterm_video.h"
 #include "uterm_video_internal.h"
 
 #define LOG_SUBSYSTEM "fbdev_render"
 
-static int clamp_value(int val, int low, int up)
+/*
+ * Pixel Conversion
+ * The renderers draw XRGB32 pixels. For other framebuffer formats, each row
+ * is converted with fbdev->convert, which is chosen when the display is
+ * activated. Common formats without dithering have dedicated shift-only
+ * kernels which the compiler can vectorize. All other formats use per-channel
+ * lookup tables that map an 8bit channel value directly to its bits in the
+ * device pixel.
+ * Dithering uses an ordered 4x4 Bayer matrix. The offset for a pixel depends
+ * only on its position, so a pixel can be converted without knowing its
+ * neighbours and disjoint areas can be converted in parallel. The offsets are
+ * added to the channel value before the lookup; the lookup tables are large
+ * enough to cover the overflow and clamp it to the channel maximum.
+ */
+
+#define FBDEV_BLEND_CHUNK 64
+
+static const uint8_t bayer[FBDEV_DITHER_SIZE][FBDEV_DITHER_SIZE] = {
+	{  0,  8,  2, 10 },
+	{ 12,  4, 14,  6 },
+	{  3, 11,  1,  9 },
+	{ 15,  7, 13,  5 },
+};
+
+static inline uint_fast32_t convert_pixel(const struct fbdev_display *fbdev,
+					  uint32_t pixel, unsigned int x,
+					  unsigned int y)
+{
+	unsigned int i = y % FBDEV_DITHER_SIZE, j = x % FBDEV_DITHER_SIZE;
+
+	return fbdev->lut_r[((pixel >> 16) & 0xff) + fbdev->dither_r[i][j]] |
+	       fbdev->lut_g[((pixel >>  8) & 0xff) + fbdev->dither_g[i][j]] |
+	       fbdev->lut_b[((pixel >>  0) & 0xff) + fbdev->dither_b[i][j]];
+}
+
+static void convert_lut16(const struct fbdev_display *fbdev, void *dst,
+			  const uint32_t *src, unsigned int num,
+			  unsigned int x, unsigned int y)
+{
+	uint16_t *out = dst;
+	unsigned int i;
+
+	for (i = 0; i < num; ++i)
+		out[i] = convert_pixel(fbdev, src[i], x + i, y);
+}
+
+static void convert_lut32(const struct fbdev_display *fbdev, void *dst,
+			  const uint32_t *src, unsigned int num,
+			  unsigned int x, unsigned int y)
 {
-	if (val < low)
-		return low;
-	else if (val > up)
-		return up;
+	uint32_t *out = dst;
+	unsigned int i;
+
+	for (i = 0; i < num; ++i)
+		out[i] = convert_pixel(fbdev, src[i], x + i, y);
+}
+
+static void convert_rgb565(const struct fbdev_display *fbdev, void *dst,
+			   const uint32_t *src, unsigned int num,
+			   unsigned int x, unsigned int y)
+{
+	uint16_t *out = dst;
+	unsigned int i;
+
+	for (i = 0; i < num; ++i)
+		out[i] = ((src[i] >> 8) & 0xf800) |
+			 ((src[i] >> 5) & 0x07e0) |
+			 ((src[i] >> 3) & 0x001f);
+}
+
+static void convert_rgb555(const struct fbdev_display *fbdev, void *dst,
+			   const uint32_t *src, unsigned int num,
+			   unsigned int x, unsigned int y)
+{
+	uint16_t *out = dst;
+	unsigned int i;
+
+	for (i = 0; i < num; ++i)
+		out[i] = ((src[i] >> 9) & 0x7c00) |
+			 ((src[i] >> 6) & 0x03e0) |
+			 ((src[i] >> 3) & 0x001f);
+}
+
+static void convert_xbgr32(const struct fbdev_display *fbdev, void *dst,
+			   const uint32_t *src, unsigned int num,
+			   unsigned int x, unsigned int y)
+{
+	uint32_t *out = dst;
+	unsigned int i;
+
+	for (i = 0; i < num; ++i)
+		out[i] = ((src[i] >> 16) & 0x0000ff) |
+			 ( src[i]        & 0x00ff00) |
+			 ((src[i] << 16) & 0xff0000);
+}
+
+static void init_channel(uint32_t *lut,
+			 uint8_t dither[FBDEV_DITHER_SIZE][FBDEV_DITHER_SIZE],
+			 unsigned int off, unsigned int len, bool dithering)
+{
+	unsigned int i, j, val, quantum;
+
+	for (i = 0; i < FBDEV_LUT_SIZE; ++i) {
+		val = (i > 255) ? 255 : i;
+		if (len >= 8)
+			lut[i] = (val << (len - 8)) << off;
+		else
+			lut[i] = (val >> (8 - len)) << off;
+	}
+
+	/* spread the offsets over one quantization step of the channel */
+	quantum = 0;
+	if (dithering && len > 0 && len < 8)
+		quantum = 1 << (8 - len);
+
+	for (i = 0; i < FBDEV_DITHER_SIZE; ++i)
+		for (j = 0; j < FBDEV_DITHER_SIZE; ++j)
+			dither[i][j] = bayer[i][j] * quantum /
+				       (FBDEV_DITHER_SIZE * FBDEV_DITHER_SIZE);
+}
+
+static bool has_layout(const struct fbdev_display *fbdev, unsigned int Bpp,
+		       unsigned int len_r, unsigned int len_g,
+		       unsigned int len_b, unsigned int off_r,
+		       unsigned int off_g, unsigned int off_b)
+{
+	return fbdev->Bpp == Bpp &&
+	       fbdev->len_r == len_r && fbdev->len_g == len_g &&
+	       fbdev->len_b == len_b && fbdev->off_r == off_r &&
+	       fbdev->off_g == off_g && fbdev->off_b == off_b;
+}
+
+void uterm_fbdev_display_init_convert(struct uterm_display *disp)
+{
+	struct fbdev_display *fbdev = disp->data;
+	bool dithering;
+
+	dithering = disp->flags & DISPLAY_DITHERING;
+	if (fbdev->len_r >= 8 && fbdev->len_g >= 8 && fbdev->len_b >= 8)
+		dithering = false;
+
+	init_channel(fbdev->lut_r, fbdev->dither_r, fbdev->off_r,
+		     fbdev->len_r, dithering);
+	init_channel(fbdev->lut_g, fbdev->dither_g, fbdev->off_g,
+		     fbdev->len_g, dithering);
+	init_channel(fbdev->lut_b, fbdev->dither_b, fbdev->off_b,
+		     fbdev->len_b, dithering);
+
+	if (!dithering && has_layout(fbdev, 2, 5, 6, 5, 11, 5, 0))
+		fbdev->convert = convert_rgb565;
+	else if (!dithering && has_layout(fbdev, 2, 5, 5, 5, 10, 5, 0))
+		fbdev->convert = convert_rgb555;
+	else if (has_layout(fbdev, 4, 8, 8, 8, 0, 8, 16))
+		fbdev->convert = convert_xbgr32;
+	else if (fbdev->Bpp == 2)
+		fbdev->convert = convert_lut16;
+	else if (fbdev->Bpp == 4)
+		fbdev->convert = convert_lut32;
 	else
-		return val;
+		fbdev->convert = NULL;
 }
 
-static uint_fast32_t xrgb32_to_device(struct uterm_display *disp,
-				      uint32_t pixel)
+static uint8_t *get_target(struct uterm_display *disp)
 {
-	uint8_t r, g, b, nr, ng, nb;
-	int i;
-	uint_fast32_t res;
 	struct fbdev_display *fbdev = disp->data;
 
-	r = (pixel >> 16) & 0xff;
-	g = (pixel >>  8) & 0xff;
-	b = (pixel >>  0) & 0xff;
-
-	if (disp->flags & DISPLAY_DITHERING) {
-		/* This is some very basic dithering which simply does small
-		 * rotations in the lower pixel bits. TODO: Let's take a look
-		 * at Floyd-Steinberg dithering which should give much better
-		 * results. It is slightly slower, though.
-		 * Or even better would be some Sierra filter like the Sierra
-		 * LITE. */
-		fbdev->dither_r = r - fbdev->dither_r;
-		fbdev->dither_g = g - fbdev->dither_g;
-		fbdev->dither_b = b - fbdev->dither_b;
-		r = clamp_value(fbdev->dither_r, 0, 255) >> (8 - fbdev->len_r);
-		g = clamp_value(fbdev->dither_g, 0, 255) >> (8 - fbdev->len_g);
-		b = clamp_value(fbdev->dither_b, 0, 255) >> (8 - fbdev->len_b);
-		nr = r << (8 - fbdev->len_r);
-		ng = g << (8 - fbdev->len_g);
-		nb = b << (8 - fbdev->len_b);
-
-		for (i = fbdev->len_r; i < 8; i <<= 1)
-			nr |= nr >> i;
-		for (i = fbdev->len_g; i < 8; i <<= 1)
-			ng |= ng >> i;
-		for (i = fbdev->len_b; i < 8; i <<= 1)
-			nb |= nb >> i;
-
-		fbdev->dither_r = nr - fbdev->dither_r;
-		fbdev->dither_g = ng - fbdev->dither_g;
-		fbdev->dither_b = nb - fbdev->dither_b;
-
-		res  = r << fbdev->off_r;
-		res |= g << fbdev->off_g;
-		res |= b << fbdev->off_b;
-	} else {
-		res  = (r >> (8 - fbdev->len_r)) << fbdev->off_r;
-		res |= (g >> (8 - fbdev->len_g)) << fbdev->off_g;
-		res |= (b >> (8 - fbdev->len_b)) << fbdev->off_b;
+	if (fbdev->shadow)
+		return fbdev->shadow;
+	if (!(disp->flags & DISPLAY_DBUF) || fbdev->bufid)
+		return fbdev->map;
+
+	return &fbdev->map[fbdev->yres * fbdev->stride];
+}
+
+int uterm_fbdev_display_damage(struct uterm_display *disp,
+			       unsigned int x, unsigned int y,
+			       unsigned int width, unsigned int height)
+{
+	struct fbdev_display *fbdev = disp->data;
+	struct fbdev_span *span;
+	unsigned int x2, y2;
+
+	if (!fbdev->shadow)
+		return 0;
+	if (x >= fbdev->xres || y >= fbdev->yres)
+		return -EINVAL;
+
+	x2 = x + width;
+	if (x2 < x || x2 > fbdev->xres)
+		x2 = fbdev->xres;
+	y2 = y + height;
+	if (y2 < y || y2 > fbdev->yres)
+		y2 = fbdev->yres;
+	if (x2 == x || y2 == y)
+		return 0;
+
+	/* Only rows in [y, y2) are touched so parallel blending of disjoint
+	 * row bands is safe. */
+	for (span = &fbdev->damage[y]; y < y2; ++y, ++span) {
+		if (x < span->x1)
+			span->x1 = x;
+		if (x2 > span->x2)
+			span->x2 = x2;
 	}
 
-	return res;
+	return 0;
 }
 
 int uterm_fbdev_display_blit(struct uterm_display *disp,
@@ -107,7 +254,6 @@ int uterm_fbdev_display_blit(struct uterm_display *disp,
 	unsigned int tmp;
 	uint8_t *dst, *src;
 	unsigned int width, height, i;
-	uint32_t val;
 	struct fbdev_display *fbdev = disp->data;
 
 	if (!buf || buf->format != UTERM_FORMAT_XRGB32)
@@ -129,11 +275,9 @@ int uterm_fbdev_display_blit(struct uterm_display *disp,
 	else
 		height = buf->height;
 
-	if (!(disp->flags & DISPLAY_DBUF) || fbdev->bufid)
-		dst = fbdev->map;
-	else
-		dst = &fbdev->map[fbdev->yres * fbdev->stride];
+	dst = get_target(disp);
 	dst = &dst[y * fbdev->stride + x * fbdev->Bpp];
+	uterm_fbdev_display_damage(disp, x, y, width, height);
 	src = buf->data;
 
 	if (fbdev->xrgb32) {
@@ -142,21 +286,10 @@ int uterm_fbdev_display_blit(struct uterm_display *disp,
 			dst += fbdev->stride;
 			src += buf->stride;
 		}
-	} else if (fbdev->Bpp == 2) {
-		while (height--) {
-			for (i = 0; i < width; ++i) {
-				val = ((uint32_t*)src)[i];
-				((uint16_t*)dst)[i] = xrgb32_to_device(disp, val);
-			}
-			dst += fbdev->stride;
-			src += buf->stride;
-		}
-	} else if (fbdev->Bpp == 4) {
-		while (height--) {
-			for (i = 0; i < width; ++i) {
-				val = ((uint32_t*)src)[i];
-				((uint32_t*)dst)[i] = xrgb32_to_device(disp, val);
-			}
+	} else if (fbdev->convert) {
+		for (i = 0; i < height; ++i) {
+			fbdev->convert(fbdev, dst, (uint32_t*)src, width, x,
+				       y + i);
 			dst += fbdev->stride;
 			src += buf->stride;
 		}
@@ -173,10 +306,10 @@ int uterm_fbdev_display_fake_blendv(struct uterm_display *disp,
 {
 	unsigned int tmp;
 	uint8_t *dst, *src;
-	unsigned int width, height, i, j;
-	unsigned int r, g, b;
-	uint32_t val;
+	unsigned int width, height, i, j, k, n;
+	uint32_t fg, bg, row[FBDEV_BLEND_CHUNK];
 	struct fbdev_display *fbdev = disp->data;
+	const struct uterm_blend_ops *blend = uterm_blend_get();
 
 	if (!req)
 		return -EINVAL;
@@ -204,99 +337,33 @@ int uterm_fbdev_display_fake_blendv(struct uterm_display *disp,
 		else
 			height = req->buf->height;
 
-		if (!(disp->flags & DISPLAY_DBUF) || fbdev->bufid)
-			dst = fbdev->map;
-		else
-			dst = &fbdev->map[fbdev->yres * fbdev->stride];
+		dst = get_target(disp);
 		dst = &dst[req->y * fbdev->stride + req->x * fbdev->Bpp];
+		uterm_fbdev_display_damage(disp, req->x, req->y, width,
+					   height);
 		src = req->buf->data;
 
-		/* Division by 256 instead of 255 increases
-		 * speed by like 20% on slower machines.
-		 * Downside is, full white is 254/254/254
-		 * instead of 255/255/255. */
+		fg = (req->fr << 16) | (req->fg << 8) | req->fb;
+		bg = (req->br << 16) | (req->bg << 8) | req->bb;
 		if (fbdev->xrgb32) {
 			while (height--) {
-				for (i = 0; i < width; ++i) {
-					if (src[i] == 0) {
-						r = req->br;
-						g = req->bg;
-						b = req->bb;
-					} else if (src[i] == 255) {
-						r = req->fr;
-						g = req->fg;
-						b = req->fb;
-					} else {
-						r = req->fr * src[i] +
-						    req->br * (255 - src[i]);
-						r /= 256;
-						g = req->fg * src[i] +
-						    req->bg * (255 - src[i]);
-						g /= 256;
-						b = req->fb * src[i] +
-						    req->bb * (255 - src[i]);
-						b /= 256;
-					}
-					val = (r << 16) | (g << 8) | b;
-					((uint32_t*)dst)[i] = val;
-				}
-				dst += fbdev->stride;
-				src += req->buf->stride;
-			}
-		} else if (fbdev->Bpp == 2) {
-			while (height--) {
-				for (i = 0; i < width; ++i) {
-					if (src[i] == 0) {
-						r = req->br;
-						g = req->bg;
-						b = req->bb;
-					} else if (src[i] == 255) {
-						r = req->fr;
-						g = req->fg;
-						b = req->fb;
-					} else {
-						r = req->fr * src[i] +
-						    req->br * (255 - src[i]);
-						r /= 256;
-						g = req->fg * src[i] +
-						    req->bg * (255 - src[i]);
-						g /= 256;
-						b = req->fb * src[i] +
-						    req->bb * (255 - src[i]);
-						b /= 256;
-					}
-					val = (r << 16) | (g << 8) | b;
-					((uint16_t*)dst)[i] =
-						xrgb32_to_device(disp, val);
-				}
+				blend->blend255((uint32_t*)dst, src, width,
+						fg, bg);
 				dst += fbdev->stride;
 				src += req->buf->stride;
 			}
-		} else if (fbdev->Bpp == 4) {
-			while (height--) {
-				for (i = 0; i < width; ++i) {
-					if (src[i] == 0) {
-						r = req->br;
-						g = req->bg;
-						b = req->bb;
-					} else if (src[i] == 255) {
-						r = req->fr;
-						g = req->fg;
-						b = req->fb;
-					} else {
-						r = req->fr * src[i] +
-						    req->br * (255 - src[i]);
-						r /= 256;
-						g = req->fg * src[i] +
-						    req->bg * (255 - src[i]);
-						g /= 256;
-						b = req->fb * src[i] +
-						    req->bb * (255 - src[i]);
-						b /= 256;
-					}
-					val = (r << 16) | (g << 8) | b;
-					((uint32_t*)dst)[i] =
-						xrgb32_to_device(disp, val);
+		} else if (fbdev->convert) {
+			for (i = 0; i < height; ++i) {
+				for (k = 0; k < width; k += n) {
+					n = width - k;
+					if (n > FBDEV_BLEND_CHUNK)
+						n = FBDEV_BLEND_CHUNK;
+					blend->blend255(row, &src[k], n,
+							fg, bg);
+					fbdev->convert(fbdev,
+						       &dst[k * fbdev->Bpp],
+						       row, n, req->x + k,
+						       req->y + i);
 				}
 				dst += fbdev->stride;
 				src += req->buf->stride;
@@ -314,9 +381,11 @@ int uterm_fbdev_display_fill(struct uterm_display *disp,
 			     unsigned int x, unsigned int y,
 			     unsigned int width, unsigned int height)
 {
-	unsigned int tmp, i;
+	unsigned int tmp, i, j;
 	uint8_t *dst;
-	uint32_t full_val, rgb32;
+	uint32_t full_val, rgb32[FBDEV_DITHER_SIZE];
+	uint16_t pat16[FBDEV_DITHER_SIZE];
+	uint32_t pat32[FBDEV_DITHER_SIZE];
 	struct fbdev_display *fbdev = disp->data;
 
 	tmp = x + width;
@@ -330,44 +399,92 @@ int uterm_fbdev_display_fill(struct uterm_display *disp,
 	if (tmp > fbdev->yres)
 		height = fbdev->yres - y;
 
-	if (!(disp->flags & DISPLAY_DBUF) || fbdev->bufid)
-		dst = fbdev->map;
-	else
-		dst = &fbdev->map[fbdev->yres * fbdev->stride];
+	dst = get_target(disp);
 	dst = &dst[y * fbdev->stride + x * fbdev->Bpp];
+	uterm_fbdev_display_damage(disp, x, y, width, height);
 
-	full_val  = ((r & 0xff) >> (8 - fbdev->len_r)) << fbdev->off_r;
-	full_val |= ((g & 0xff) >> (8 - fbdev->len_g)) << fbdev->off_g;
-	full_val |= ((b & 0xff) >> (8 - fbdev->len_b)) << fbdev->off_b;
-
-	if (fbdev->Bpp == 2) {
-		if (disp->flags & DISPLAY_DITHERING) {
-			rgb32  = (r & 0xff) << 16;
-			rgb32 |= (g & 0xff) <<  8;
-			rgb32 |= (b & 0xff) <<  0;
-			while (height--) {
-				for (i = 0; i < width; ++i)
-					((uint16_t*)dst)[i] = xrgb32_to_device(disp, rgb32);
-				dst += fbdev->stride;
-			}
-		} else {
-			full_val &= 0xffff;
-			while (height--) {
-				for (i = 0; i < width; ++i)
-					((uint16_t*)dst)[i] = full_val;
-				dst += fbdev->stride;
-			}
-		}
-	} else if (fbdev->Bpp == 4) {
+	if (fbdev->xrgb32) {
+		full_val = (r << 16) | (g << 8) | b;
 		while (height--) {
 			for (i = 0; i < width; ++i)
 				((uint32_t*)dst)[i] = full_val;
 			dst += fbdev->stride;
 		}
-	} else {
+		return 0;
+	} else if (!fbdev->convert) {
 		log_error("invalid Bpp");
 		return -EFAULT;
 	}
 
+	/* With dithering, the color repeats every FBDEV_DITHER_SIZE pixels,
+	 * so only one period has to be converted per row. */
+	for (i = 0; i < FBDEV_DITHER_SIZE; ++i)
+		rgb32[i] = (r << 16) | (g << 8) | b;
+
+	for (j = 0; j < height; ++j) {
+		if (fbdev->Bpp == 2) {
+			fbdev->convert(fbdev, pat16, rgb32, FBDEV_DITHER_SIZE,
+				       x, y + j);
+			for (i = 0; i < width; ++i)
+				((uint16_t*)dst)[i] =
+					pat16[i % FBDEV_DITHER_SIZE];
+		} else {
+			fbdev->convert(fbdev, pat32, rgb32, FBDEV_DITHER_SIZE,
+				       x, y + j);
+			for (i = 0; i < width; ++i)
+				((uint32_t*)dst)[i] =
+					pat32[i % FBDEV_DITHER_SIZE];
+		}
+		dst += fbdev->stride;
+	}
+
+	return 0;
+}
+
+int uterm_fbdev_display_copy(struct uterm_display *disp,
+			     unsigned int src_x, unsigned int src_y,
+			     unsigned int dst_x, unsigned int dst_y,
+			     unsigned int width, unsigned int height)
+{
+	uint8_t *dst, *src;
+	int step;
+	struct fbdev_display *fbdev = disp->data;
+
+	if (src_x >= fbdev->xres || dst_x >= fbdev->xres ||
+	    src_y >= fbdev->yres || dst_y >= fbdev->yres)
+		return -EINVAL;
+	if (width > fbdev->xres - src_x)
+		width = fbdev->xres - src_x;
+	if (width > fbdev->xres - dst_x)
+		width = fbdev->xres - dst_x;
+	if (height > fbdev->yres - src_y)
+		height = fbdev->yres - src_y;
+	if (height > fbdev->yres - dst_y)
+		height = fbdev->yres - dst_y;
+	if (!width || !height)
+		return 0;
+
+	/* Reading from the framebuffer may be slow but it is still faster
+	 * than rendering all moved glyphs again. The shadow buffer avoids
+	 * this altogether. */
+	dst = get_target(disp);
+	src = dst;
+	dst = &dst[dst_y * fbdev->stride + dst_x * fbdev->Bpp];
+	src = &src[src_y * fbdev->stride + src_x * fbdev->Bpp];
+	uterm_fbdev_display_damage(disp, dst_x, dst_y, width, height);
+
+	step = fbdev->stride;
+	if (dst_y > src_y) {
+		dst += (height - 1) * fbdev->stride;
+		src += (height - 1) * fbdev->stride;
+		step = -step;
+	}
+
+	while (height--) {
+		memmove(dst, src, width * fbdev->Bpp);
+		dst += step;
+		src += step;
+	}
+
 	return 0;
 }
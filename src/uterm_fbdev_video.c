@@ -38,6 +38,7 @@
 #include <unistd.h>
 #include "shl_log.h"
 #include "shl_misc.h"
+#include "shl_timer.h"
 #include "uterm_fbdev_internal.h"
 #include "uterm_video.h"
 #include "uterm_video_internal.h"
@@ -103,8 +104,11 @@ static int display_init(struct uterm_display *disp)
 	return 0;
 }
 
+static void free_shadow(struct uterm_display *disp);
+
 static void display_destroy(struct uterm_display *disp)
 {
+	free_shadow(disp);
 	free(disp->data);
 }
 
@@ -128,6 +132,184 @@ static int refresh_info(struct uterm_display *disp)
 	return 0;
 }
 
+/*
+ * Shadow buffer
+ * Reading from mmap'ed framebuffers is horribly slow on many devices as the
+ * memory is mapped uncached or sits behind a slow bus. Renderers read back the
+ * framebuffer whenever they blend, so on such devices we render into a shadow
+ * buffer in system RAM and copy only the damaged rows to the framebuffer on
+ * swap. The fbdev API does not tell us what kind of memory we got, so unless
+ * the user forces a mode, we time a few copies on the first activation and
+ * compare them to system RAM.
+ * Renderers keep the pointer they got from get_buffers() until they are unset,
+ * so the shadow buffer is kept while the display is only put to sleep, as on
+ * VT switches, and is reused on wake-up if the mode is still the same. If
+ * another VT changed it meanwhile, the buffer is allocated again and the
+ * display is refreshed so renderers fetch the new buffers.
+ */
+
+#define SHADOW_PROBE_SIZE (256 * 1024)
+#define SHADOW_PROBE_RUNS 4
+#define SHADOW_READ_RATIO 4
+
+static uint64_t probe_copy(uint8_t *dst, const uint8_t *src, size_t len)
+{
+	struct shl_timer timer;
+	unsigned int i;
+
+	shl_timer_reset(&timer);
+	for (i = 0; i < SHADOW_PROBE_RUNS; ++i)
+		memcpy(dst, src, len);
+
+	return shl_timer_elapsed(&timer);
+}
+
+static void probe_shadow(struct uterm_display *disp)
+{
+	struct fbdev_display *dfb = disp->data;
+	uint64_t ram_read, map_read, map_write;
+	uint8_t *src;
+	size_t len;
+
+	len = dfb->len;
+	if (len > SHADOW_PROBE_SIZE)
+		len = SHADOW_PROBE_SIZE;
+
+	src = malloc(len);
+	if (!src) {
+		log_warning("cannot allocate probe buffer for %s", dfb->node);
+		return;
+	}
+	memset(src, 0, len);
+
+	/* the shadow buffer is the destination so no copy can be optimized
+	 * away; the framebuffer is cleared anyway */
+	ram_read = probe_copy(dfb->shadow, src, len);
+	map_write = probe_copy(dfb->map, src, len);
+	map_read = probe_copy(dfb->shadow, dfb->map, len);
+	free(src);
+
+	dfb->shadow_probed = true;
+	dfb->slow_reads = map_read > ram_read * SHADOW_READ_RATIO;
+
+	log_info("bandwidth of %s for %zu KiB: RAM %" PRIu64 " us, fb-read %" PRIu64 " us, fb-write %" PRIu64 " us",
+		 dfb->node, len * SHADOW_PROBE_RUNS / 1024, ram_read,
+		 map_read, map_write);
+}
+
+static void free_shadow(struct uterm_display *disp)
+{
+	struct fbdev_display *dfb = disp->data;
+
+	free(dfb->damage);
+	free(dfb->shadow);
+	dfb->damage = NULL;
+	dfb->shadow = NULL;
+	dfb->shadow_len = 0;
+	dfb->shadow_xres = 0;
+	dfb->shadow_yres = 0;
+	dfb->shadow_stride = 0;
+}
+
+static void reset_damage(struct uterm_display *disp, bool full)
+{
+	struct fbdev_display *dfb = disp->data;
+	unsigned int i;
+
+	for (i = 0; i < dfb->yres; ++i) {
+		dfb->damage[i].x1 = full ? 0 : dfb->xres;
+		dfb->damage[i].x2 = full ? dfb->xres : 0;
+	}
+}
+
+static void init_shadow(struct uterm_display *disp)
+{
+	struct fbdev_display *dfb = disp->data;
+	unsigned int mode = disp->video->shadow;
+
+	/* waking up again; the framebuffer was cleared so restore all of it */
+	if (dfb->shadow && dfb->shadow_len == dfb->len &&
+	    dfb->shadow_xres == dfb->xres && dfb->shadow_yres == dfb->yres &&
+	    dfb->shadow_stride == dfb->stride) {
+		reset_damage(disp, true);
+		return;
+	}
+	free_shadow(disp);
+
+	if (mode == UTERM_SHADOW_OFF)
+		return;
+	if (disp->flags & DISPLAY_DBUF) {
+		/* flips would have to copy the damage of both buffers */
+		if (mode == UTERM_SHADOW_ON)
+			log_warning("shadow buffer not supported with double-buffering on %s, ignoring --fb-shadow=on",
+				    dfb->node);
+		return;
+	}
+	if (mode == UTERM_SHADOW_AUTO && dfb->shadow_probed &&
+	    !dfb->slow_reads)
+		return;
+
+	dfb->shadow = malloc(dfb->len);
+	dfb->damage = malloc(sizeof(*dfb->damage) * dfb->yres);
+	if (!dfb->shadow || !dfb->damage) {
+		log_warning("cannot allocate shadow buffer for %s", dfb->node);
+		free_shadow(disp);
+		return;
+	}
+	dfb->shadow_len = dfb->len;
+	dfb->shadow_xres = dfb->xres;
+	dfb->shadow_yres = dfb->yres;
+	dfb->shadow_stride = dfb->stride;
+	memset(dfb->shadow, 0, dfb->len);
+	reset_damage(disp, false);
+
+	if (mode == UTERM_SHADOW_AUTO && !dfb->shadow_probed) {
+		probe_shadow(disp);
+		if (!dfb->slow_reads) {
+			free_shadow(disp);
+			return;
+		}
+	}
+
+	log_info("using shadow buffer for %s", dfb->node);
+}
+
+static void flush_shadow(struct uterm_display *disp)
+{
+	struct fbdev_display *dfb = disp->data;
+	struct fbdev_span *span;
+	unsigned int y, n, off;
+
+	for (y = 0; y < dfb->yres; y += n) {
+		span = &dfb->damage[y];
+		n = 1;
+
+		if (span->x1 >= span->x2)
+			continue;
+
+		/* Full rows are contiguous including their padding so copy
+		 * consecutive full rows in a single burst. */
+		if (!span->x1 && span->x2 == dfb->xres) {
+			while (y + n < dfb->yres && !span[n].x1 &&
+			       span[n].x2 == dfb->xres) {
+				span[n].x1 = dfb->xres;
+				span[n].x2 = 0;
+				++n;
+			}
+			off = y * dfb->stride;
+			memcpy(&dfb->map[off], &dfb->shadow[off],
+			       n * dfb->stride);
+		} else {
+			off = y * dfb->stride + span->x1 * dfb->Bpp;
+			memcpy(&dfb->map[off], &dfb->shadow[off],
+			       (span->x2 - span->x1) * dfb->Bpp);
+		}
+
+		span->x1 = dfb->xres;
+		span->x2 = 0;
+	}
+}
+
 static int display_activate_force(struct uterm_display *disp,
 				  struct uterm_mode *mode,
 				  bool force)
@@ -320,9 +502,6 @@ static int display_activate_force(struct uterm_display *disp,
 	dfb->len_g = vinfo->green.length;
 	dfb->off_b = vinfo->blue.offset;
 	dfb->len_b = vinfo->blue.length;
-	dfb->dither_r = 0;
-	dfb->dither_g = 0;
-	dfb->dither_b = 0;
 	dfb->xrgb32 = false;
 	dfb->rgb16 = false;
 	if (dfb->len_r == 8 && dfb->len_g == 8 && dfb->len_b == 8 &&
@@ -334,8 +513,17 @@ static int display_activate_force(struct uterm_display *disp,
 		 dfb->Bpp == 2)
 		dfb->rgb16 = true;
 
-	/* TODO: make dithering configurable */
-	disp->flags |= DISPLAY_DITHERING;
+	if (disp->video->dithering)
+		disp->flags |= DISPLAY_DITHERING;
+	else
+		disp->flags &= ~DISPLAY_DITHERING;
+	uterm_fbdev_display_init_convert(disp);
+
+	/* the converters are stateless, even with ordered dithering */
+	disp->flags |= DISPLAY_PARALLEL;
+
+	init_shadow(disp);
+	dfb->data = dfb->shadow ? dfb->shadow : dfb->map;
 
 	if (disp->current_mode) {
 		m = disp->current_mode;
@@ -360,6 +548,8 @@ static int display_activate_force(struct uterm_display *disp,
 	return 0;
 
 err_map:
+	if (!force)
+		free_shadow(disp);
 	munmap(dfb->map, dfb->len);
 err_close:
 	close(dfb->fd);
@@ -384,6 +574,7 @@ static void display_deactivate_force(struct uterm_display *disp, bool force)
 		dfb->map = NULL;
 	}
 	if (!force) {
+		free_shadow(disp);
 		uterm_mode_unbind(disp->current_mode);
 		disp->current_mode = NULL;
 		disp->flags &= ~DISPLAY_ONLINE;
@@ -464,7 +655,9 @@ static int display_get_buffers(struct uterm_display *disp,
 		buffer[i].height = dfb->yres;
 		buffer[i].stride = dfb->stride;
 		buffer[i].format = f;
-		if (!(disp->flags & DISPLAY_DBUF) || !i)
+		if (dfb->shadow)
+			buffer[i].data = dfb->shadow;
+		else if (!(disp->flags & DISPLAY_DBUF) || !i)
 			buffer[i].data = dfb->map;
 		else
 			buffer[i].data = &dfb->map[dfb->yres * dfb->stride];
@@ -479,6 +672,9 @@ static int display_swap(struct uterm_display *disp, bool immediate)
 	struct fb_var_screeninfo *vinfo;
 	int ret;
 
+	if (dfb->shadow)
+		flush_shadow(disp);
+
 	if (!(disp->flags & DISPLAY_DBUF)) {
 		if (immediate)
 			return 0;
@@ -516,9 +712,11 @@ static const struct display_ops fbdev_display_ops = {
 	.use = display_use,
 	.get_buffers = display_get_buffers,
 	.swap = display_swap,
+	.damage = uterm_fbdev_display_damage,
 	.blit = uterm_fbdev_display_blit,
 	.fake_blendv = uterm_fbdev_display_fake_blendv,
 	.fill = uterm_fbdev_display_fill,
+	.copy = uterm_fbdev_display_copy,
 };
 
 static void intro_idle_event(struct ev_eloop *eloop, void *unused, void *data)
@@ -618,7 +816,12 @@ static void video_sleep(struct uterm_video *video)
 static int video_wake_up(struct uterm_video *video)
 {
 	struct uterm_display *iter;
+	struct fbdev_display *dfb;
 	struct shl_dlist *i;
+	uint8_t *data;
+	size_t xres, yres;
+	unsigned int stride, Bpp;
+	bool xrgb32, rgb16;
 	int ret;
 
 	video->flags |= VIDEO_AWAKE;
@@ -628,12 +831,27 @@ static int video_wake_up(struct uterm_video *video)
 		if (!display_is_online(iter))
 			continue;
 
+		dfb = iter->data;
+		data = dfb->data;
+		xres = dfb->xres;
+		yres = dfb->yres;
+		stride = dfb->stride;
+		Bpp = dfb->Bpp;
+		xrgb32 = dfb->xrgb32;
+		rgb16 = dfb->rgb16;
 		ret = display_activate_force(iter, NULL, true);
 		if (ret)
 			return ret;
 
 		if (iter->dpms != UTERM_DPMS_UNKNOWN)
 			display_set_dpms(iter, iter->dpms);
+
+		/* renderers still use the buffers of the old mode */
+		if (dfb->data != data || dfb->xres != xres ||
+		    dfb->yres != yres || dfb->stride != stride ||
+		    dfb->Bpp != Bpp || dfb->xrgb32 != xrgb32 ||
+		    dfb->rgb16 != rgb16)
+			VIDEO_CB(video, iter, UTERM_REFRESH);
 	}
 
 	return 0;
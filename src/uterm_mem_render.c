@@ -0,0 +1,259 @@
+/*
+ * uterm - Linux User-Space Terminal memory module
+ *
+ * Copyright (c) 2011-2013 David Herrmann <dh.herrmann@googlemail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Memory module rendering functions
+ * Everything is rendered with the CPU into system RAM. RGB16 displays are
+ * converted without dithering so the output is deterministic and can be
+ * compared in regression tests.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "shl_log.h"
+#include "uterm_blend_internal.h"
+#include "uterm_mem_internal.h"
+#include "uterm_video.h"
+#include "uterm_video_internal.h"
+
+#define LOG_SUBSYSTEM "uterm_mem_render"
+
+/* pixels blended into a temporary XRGB32 row before conversion to RGB16 */
+#define MEM_BLEND_CHUNK 64
+
+static inline uint16_t xrgb32_to_rgb16(uint32_t pixel)
+{
+	return ((pixel >> 8) & 0xf800) |
+	       ((pixel >> 5) & 0x07e0) |
+	       ((pixel >> 3) & 0x001f);
+}
+
+static void convert_row(uint16_t *dst, const uint32_t *src, unsigned int num)
+{
+	unsigned int i;
+
+	for (i = 0; i < num; ++i)
+		dst[i] = xrgb32_to_rgb16(src[i]);
+}
+
+int uterm_mem_display_blit(struct uterm_display *disp,
+			   const struct uterm_video_buffer *buf,
+			   unsigned int x, unsigned int y)
+{
+	unsigned int tmp;
+	uint8_t *dst, *src;
+	unsigned int width, height;
+	struct uterm_mem_display *dmem = disp->data;
+	unsigned int sw = dmem->config.width, sh = dmem->config.height;
+
+	if (!buf || buf->format != UTERM_FORMAT_XRGB32)
+		return -EINVAL;
+
+	tmp = x + buf->width;
+	if (tmp < x || x >= sw)
+		return -EINVAL;
+	if (tmp > sw)
+		width = sw - x;
+	else
+		width = buf->width;
+
+	tmp = y + buf->height;
+	if (tmp < y || y >= sh)
+		return -EINVAL;
+	if (tmp > sh)
+		height = sh - y;
+	else
+		height = buf->height;
+
+	dst = uterm_mem_target(dmem);
+	dst = &dst[y * dmem->stride + x * dmem->Bpp];
+	src = buf->data;
+
+	while (height--) {
+		if (dmem->config.format == UTERM_FORMAT_XRGB32)
+			memcpy(dst, src, 4 * width);
+		else
+			convert_row((uint16_t*)dst, (uint32_t*)src, width);
+		dst += dmem->stride;
+		src += buf->stride;
+	}
+
+	return 0;
+}
+
+int uterm_mem_display_fake_blendv(struct uterm_display *disp,
+				  const struct uterm_video_blend_req *req,
+				  size_t num)
+{
+	unsigned int tmp;
+	uint8_t *dst, *src;
+	unsigned int width, height, i, len, j;
+	uint32_t fg, bg, row[MEM_BLEND_CHUNK];
+	struct uterm_mem_display *dmem = disp->data;
+	unsigned int sw = dmem->config.width, sh = dmem->config.height;
+	const struct uterm_blend_ops *blend = uterm_blend_get();
+
+	if (!req)
+		return -EINVAL;
+
+	for (j = 0; j < num; ++j, ++req) {
+		if (!req->buf)
+			continue;
+
+		if (req->buf->format != UTERM_FORMAT_GREY)
+			return -EOPNOTSUPP;
+
+		tmp = req->x + req->buf->width;
+		if (tmp < req->x || req->x >= sw)
+			return -EINVAL;
+		if (tmp > sw)
+			width = sw - req->x;
+		else
+			width = req->buf->width;
+
+		tmp = req->y + req->buf->height;
+		if (tmp < req->y || req->y >= sh)
+			return -EINVAL;
+		if (tmp > sh)
+			height = sh - req->y;
+		else
+			height = req->buf->height;
+
+		dst = uterm_mem_target(dmem);
+		dst = &dst[req->y * dmem->stride + req->x * dmem->Bpp];
+		src = req->buf->data;
+
+		fg = (req->fr << 16) | (req->fg << 8) | req->fb;
+		bg = (req->br << 16) | (req->bg << 8) | req->bb;
+
+		while (height--) {
+			if (dmem->config.format == UTERM_FORMAT_XRGB32) {
+				blend->blend255((uint32_t*)dst, src, width,
+						fg, bg);
+			} else {
+				for (i = 0; i < width; i += len) {
+					len = width - i;
+					if (len > MEM_BLEND_CHUNK)
+						len = MEM_BLEND_CHUNK;
+					blend->blend255(row, &src[i], len, fg,
+							bg);
+					convert_row(&((uint16_t*)dst)[i], row,
+						    len);
+				}
+			}
+			dst += dmem->stride;
+			src += req->buf->stride;
+		}
+	}
+
+	return 0;
+}
+
+int uterm_mem_display_fill(struct uterm_display *disp,
+			   uint8_t r, uint8_t g, uint8_t b,
+			   unsigned int x, unsigned int y,
+			   unsigned int width, unsigned int height)
+{
+	unsigned int tmp, i;
+	uint8_t *dst;
+	uint32_t val;
+	struct uterm_mem_display *dmem = disp->data;
+	unsigned int sw = dmem->config.width, sh = dmem->config.height;
+
+	tmp = x + width;
+	if (tmp < x || x >= sw)
+		return -EINVAL;
+	if (tmp > sw)
+		width = sw - x;
+	tmp = y + height;
+	if (tmp < y || y >= sh)
+		return -EINVAL;
+	if (tmp > sh)
+		height = sh - y;
+
+	dst = uterm_mem_target(dmem);
+	dst = &dst[y * dmem->stride + x * dmem->Bpp];
+	val = (r << 16) | (g << 8) | b;
+
+	while (height--) {
+		if (dmem->config.format == UTERM_FORMAT_XRGB32) {
+			for (i = 0; i < width; ++i)
+				((uint32_t*)dst)[i] = val;
+		} else {
+			for (i = 0; i < width; ++i)
+				((uint16_t*)dst)[i] = xrgb32_to_rgb16(val);
+		}
+		dst += dmem->stride;
+	}
+
+	return 0;
+}
+
+int uterm_mem_display_copy(struct uterm_display *disp,
+			   unsigned int src_x, unsigned int src_y,
+			   unsigned int dst_x, unsigned int dst_y,
+			   unsigned int width, unsigned int height)
+{
+	uint8_t *dst, *src;
+	int step;
+	struct uterm_mem_display *dmem = disp->data;
+	unsigned int sw = dmem->config.width, sh = dmem->config.height;
+
+	if (src_x >= sw || dst_x >= sw || src_y >= sh || dst_y >= sh)
+		return -EINVAL;
+	if (width > sw - src_x)
+		width = sw - src_x;
+	if (width > sw - dst_x)
+		width = sw - dst_x;
+	if (height > sh - src_y)
+		height = sh - src_y;
+	if (height > sh - dst_y)
+		height = sh - dst_y;
+	if (!width || !height)
+		return 0;
+
+	dst = uterm_mem_target(dmem);
+	src = dst;
+	dst = &dst[dst_y * dmem->stride + dst_x * dmem->Bpp];
+	src = &src[src_y * dmem->stride + src_x * dmem->Bpp];
+
+	step = dmem->stride;
+	if (dst_y > src_y) {
+		dst += (height - 1) * dmem->stride;
+		src += (height - 1) * dmem->stride;
+		step = -step;
+	}
+
+	while (height--) {
+		memmove(dst, src, width * dmem->Bpp);
+		dst += step;
+		src += step;
+	}
+
+	return 0;
+}
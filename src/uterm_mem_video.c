@@ -0,0 +1,486 @@
+/*
+ * uterm - Linux User-Space Terminal memory module
+ *
+ * Copyright (c) 2011-2013 David Herrmann <dh.herrmann@googlemail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Memory Video backend
+ * This backend does not drive any hardware. It provides virtual displays whose
+ * framebuffers are plain system RAM and emulates page-flips with a timer. This
+ * allows running and benchmarking the whole rendering pipeline on machines
+ * without any graphics device, e.g., in build containers.
+ *
+ * The node passed to uterm_video_new() is a comma-separated list of displays,
+ * each given as "<width>x<height>[:<format>][@<rate>]". The format is either
+ * "xrgb32" (default) or "rgb565", the rate is the refresh rate in Hz that is
+ * simulated (default: 60). An empty node creates a single 1024x768 display.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "eloop.h"
+#include "shl_log.h"
+#include "shl_misc.h"
+#include "uterm_mem_internal.h"
+#include "uterm_video.h"
+#include "uterm_video_internal.h"
+
+#define LOG_SUBSYSTEM "video_mem"
+
+#define MEM_DEFAULT_SPEC "1024x768"
+#define MEM_MAX_SIZE 16384
+
+static int mode_init(struct uterm_mode *mode)
+{
+	struct uterm_mem_mode *mmem;
+
+	mmem = malloc(sizeof(*mmem));
+	if (!mmem)
+		return -ENOMEM;
+	memset(mmem, 0, sizeof(*mmem));
+	mode->data = mmem;
+
+	return 0;
+}
+
+static void mode_destroy(struct uterm_mode *mode)
+{
+	free(mode->data);
+}
+
+static const char *mode_get_name(const struct uterm_mode *mode)
+{
+	return "<virtual>";
+}
+
+static unsigned int mode_get_width(const struct uterm_mode *mode)
+{
+	struct uterm_mem_mode *mmem = mode->data;
+
+	return mmem->width;
+}
+
+static unsigned int mode_get_height(const struct uterm_mode *mode)
+{
+	struct uterm_mem_mode *mmem = mode->data;
+
+	return mmem->height;
+}
+
+static const struct mode_ops mem_mode_ops = {
+	.init = mode_init,
+	.destroy = mode_destroy,
+	.get_name = mode_get_name,
+	.get_width = mode_get_width,
+	.get_height = mode_get_height,
+};
+
+static int display_init(struct uterm_display *disp)
+{
+	struct uterm_mem_display *dmem;
+
+	dmem = malloc(sizeof(*dmem));
+	if (!dmem)
+		return -ENOMEM;
+	memset(dmem, 0, sizeof(*dmem));
+	disp->data = dmem;
+	disp->dpms = UTERM_DPMS_UNKNOWN;
+
+	return 0;
+}
+
+static void display_destroy(struct uterm_display *disp)
+{
+	free(disp->data);
+}
+
+static void free_buffers(struct uterm_mem_display *dmem)
+{
+	free(dmem->buf[1]);
+	free(dmem->buf[0]);
+	dmem->buf[1] = NULL;
+	dmem->buf[0] = NULL;
+}
+
+static int display_activate(struct uterm_display *disp, struct uterm_mode *mode)
+{
+	struct uterm_mem_display *dmem = disp->data;
+	struct uterm_mem_config *conf = &dmem->config;
+
+	if (!mode || mode != disp->default_mode)
+		return -EINVAL;
+
+	log_info("activating virtual display %p to %ux%u", disp, conf->width,
+		 conf->height);
+
+	dmem->Bpp = conf->format == UTERM_FORMAT_RGB16 ? 2 : 4;
+	dmem->stride = (conf->width * dmem->Bpp + 3) & ~3U;
+	dmem->size = (size_t)dmem->stride * conf->height;
+
+	dmem->buf[0] = calloc(1, dmem->size);
+	dmem->buf[1] = calloc(1, dmem->size);
+	if (!dmem->buf[0] || !dmem->buf[1]) {
+		log_error("cannot allocate framebuffers for virtual display %p",
+			  disp);
+		free_buffers(dmem);
+		return -ENOMEM;
+	}
+
+	dmem->front = 0;
+	dmem->age[0] = 0;
+	dmem->age[1] = 0;
+	display_set_vblank_timer(disp, 1000 / conf->rate);
+
+	disp->current_mode = mode;
+	disp->flags |= DISPLAY_ONLINE | DISPLAY_PARALLEL;
+	return 0;
+}
+
+static void display_deactivate(struct uterm_display *disp)
+{
+	struct uterm_mem_display *dmem = disp->data;
+
+	log_info("deactivating virtual display %p", disp);
+
+	free_buffers(dmem);
+	disp->current_mode = NULL;
+	disp->flags &= ~DISPLAY_ONLINE;
+}
+
+static int display_set_dpms(struct uterm_display *disp, int state)
+{
+	switch (state) {
+	case UTERM_DPMS_ON:
+	case UTERM_DPMS_STANDBY:
+	case UTERM_DPMS_SUSPEND:
+	case UTERM_DPMS_OFF:
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	log_debug("setting DPMS of virtual display %p to %s", disp,
+		  uterm_dpms_to_name(state));
+	disp->dpms = state;
+	return 0;
+}
+
+static int display_use(struct uterm_display *disp, bool *opengl)
+{
+	struct uterm_mem_display *dmem = disp->data;
+
+	if (opengl)
+		*opengl = false;
+
+	return dmem->front ^ 1;
+}
+
+static int display_get_buffers(struct uterm_display *disp,
+			       struct uterm_video_buffer *buffer,
+			       unsigned int formats)
+{
+	struct uterm_mem_display *dmem = disp->data;
+	unsigned int i;
+
+	if (!(formats & dmem->config.format))
+		return -EOPNOTSUPP;
+
+	for (i = 0; i < 2; ++i) {
+		buffer[i].width = dmem->config.width;
+		buffer[i].height = dmem->config.height;
+		buffer[i].stride = dmem->stride;
+		buffer[i].format = dmem->config.format;
+		buffer[i].data = dmem->buf[i];
+	}
+
+	return 0;
+}
+
+static int display_swap(struct uterm_display *disp, bool immediate)
+{
+	struct uterm_mem_display *dmem = disp->data;
+
+	dmem->front ^= 1;
+	dmem->age[dmem->front] = 1;
+	if (dmem->age[dmem->front ^ 1])
+		++dmem->age[dmem->front ^ 1];
+
+	if (immediate)
+		return 0;
+
+	return display_schedule_vblank_timer(disp);
+}
+
+static int display_get_buffer_age(struct uterm_display *disp)
+{
+	struct uterm_mem_display *dmem = disp->data;
+
+	return dmem->age[dmem->front ^ 1];
+}
+
+static const struct display_ops mem_display_ops = {
+	.init = display_init,
+	.destroy = display_destroy,
+	.activate = display_activate,
+	.deactivate = display_deactivate,
+	.set_dpms = display_set_dpms,
+	.use = display_use,
+	.get_buffers = display_get_buffers,
+	.swap = display_swap,
+	.get_buffer_age = display_get_buffer_age,
+	.blit = uterm_mem_display_blit,
+	.fake_blendv = uterm_mem_display_fake_blendv,
+	.fill = uterm_mem_display_fill,
+	.copy = uterm_mem_display_copy,
+};
+
+static int parse_config(struct uterm_mem_config *conf, const char *str)
+{
+	char *end;
+	const char *fmt;
+	size_t len;
+
+	conf->format = UTERM_FORMAT_XRGB32;
+	conf->rate = 60;
+
+	conf->width = strtoul(str, &end, 10);
+	if (end == str || *end != 'x')
+		return -EINVAL;
+
+	str = end + 1;
+	conf->height = strtoul(str, &end, 10);
+	if (end == str)
+		return -EINVAL;
+
+	if (*end == ':') {
+		fmt = end + 1;
+		len = strcspn(fmt, "@");
+		if (len == 6 && !strncmp(fmt, "xrgb32", len))
+			conf->format = UTERM_FORMAT_XRGB32;
+		else if (len == 6 && !strncmp(fmt, "rgb565", len))
+			conf->format = UTERM_FORMAT_RGB16;
+		else
+			return -EINVAL;
+		end = (char*)&fmt[len];
+	}
+
+	if (*end == '@') {
+		str = end + 1;
+		conf->rate = strtoul(str, &end, 10);
+		if (end == str)
+			return -EINVAL;
+	}
+
+	if (*end)
+		return -EINVAL;
+
+	if (!conf->width || conf->width > MEM_MAX_SIZE ||
+	    !conf->height || conf->height > MEM_MAX_SIZE ||
+	    !conf->rate || conf->rate > 1000)
+		return -EINVAL;
+
+	return 0;
+}
+
+static int parse_spec(struct uterm_mem_video *vmem)
+{
+	char *spec, *tok, *save;
+	unsigned int num;
+	int ret;
+
+	num = 1;
+	for (tok = vmem->spec; *tok; ++tok) {
+		if (*tok == ',')
+			++num;
+	}
+
+	vmem->configs = calloc(num, sizeof(*vmem->configs));
+	if (!vmem->configs)
+		return -ENOMEM;
+
+	spec = strdup(vmem->spec);
+	if (!spec)
+		return -ENOMEM;
+
+	vmem->num = 0;
+	for (tok = strtok_r(spec, ",", &save); tok;
+	     tok = strtok_r(NULL, ",", &save)) {
+		ret = parse_config(&vmem->configs[vmem->num], tok);
+		if (ret) {
+			log_error("invalid virtual display '%s'", tok);
+			free(spec);
+			return ret;
+		}
+		++vmem->num;
+	}
+
+	free(spec);
+	if (!vmem->num) {
+		log_error("no virtual displays given in '%s'", vmem->spec);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int add_display(struct uterm_video *video,
+		       const struct uterm_mem_config *conf)
+{
+	struct uterm_display *disp;
+	struct uterm_mem_display *dmem;
+	struct uterm_mode *mode;
+	struct uterm_mem_mode *mmem;
+	int ret;
+
+	ret = display_new(&disp, &mem_display_ops);
+	if (ret)
+		return ret;
+
+	dmem = disp->data;
+	dmem->config = *conf;
+
+	ret = mode_new(&mode, &mem_mode_ops);
+	if (ret)
+		goto err_disp;
+
+	mmem = mode->data;
+	mmem->width = conf->width;
+	mmem->height = conf->height;
+
+	ret = uterm_mode_bind(mode, disp);
+	if (ret) {
+		uterm_mode_unref(mode);
+		goto err_disp;
+	}
+	disp->default_mode = mode;
+	uterm_mode_unref(mode);
+
+	ret = uterm_display_bind(disp, video);
+	if (ret)
+		goto err_disp;
+
+	uterm_display_unref(disp);
+	return 0;
+
+err_disp:
+	uterm_display_unref(disp);
+	return ret;
+}
+
+static void intro_idle_event(struct ev_eloop *eloop, void *unused, void *data)
+{
+	struct uterm_video *video = data;
+	struct uterm_mem_video *vmem = video->data;
+	unsigned int i;
+	int ret;
+
+	vmem->pending_intro = false;
+	ev_eloop_unregister_idle_cb(eloop, intro_idle_event, data, EV_NORMAL);
+
+	for (i = 0; i < vmem->num; ++i) {
+		ret = add_display(video, &vmem->configs[i]);
+		if (ret)
+			log_error("cannot create virtual display %ux%u: %d",
+				  vmem->configs[i].width,
+				  vmem->configs[i].height, ret);
+	}
+}
+
+static int video_init(struct uterm_video *video, const char *node)
+{
+	int ret;
+	struct uterm_mem_video *vmem;
+
+	if (!node || !*node)
+		node = MEM_DEFAULT_SPEC;
+
+	log_info("new virtual device %s", node);
+
+	vmem = malloc(sizeof(*vmem));
+	if (!vmem)
+		return -ENOMEM;
+	memset(vmem, 0, sizeof(*vmem));
+	video->data = vmem;
+
+	vmem->spec = strdup(node);
+	if (!vmem->spec) {
+		ret = -ENOMEM;
+		goto err_free;
+	}
+
+	ret = parse_spec(vmem);
+	if (ret)
+		goto err_spec;
+
+	ret = ev_eloop_register_idle_cb(video->eloop, intro_idle_event, video,
+					EV_NORMAL);
+	if (ret) {
+		log_error("cannot register idle event: %d", ret);
+		goto err_spec;
+	}
+	vmem->pending_intro = true;
+
+	return 0;
+
+err_spec:
+	free(vmem->configs);
+	free(vmem->spec);
+err_free:
+	free(vmem);
+	return ret;
+}
+
+static void video_destroy(struct uterm_video *video)
+{
+	struct uterm_mem_video *vmem = video->data;
+
+	log_info("free virtual device %s", vmem->spec);
+
+	if (vmem->pending_intro)
+		ev_eloop_unregister_idle_cb(video->eloop, intro_idle_event,
+					    video, EV_NORMAL);
+
+	free(vmem->configs);
+	free(vmem->spec);
+	free(vmem);
+}
+
+static const struct video_ops mem_video_ops = {
+	.init = video_init,
+	.destroy = video_destroy,
+	.segfault = NULL,
+	.poll = NULL,
+	.sleep = NULL,
+	.wake_up = NULL,
+};
+
+static const struct uterm_video_module mem_module = {
+	.ops = &mem_video_ops,
+};
+
+SHL_EXPORT
+const struct uterm_video_module *UTERM_VIDEO_MEM = &mem_module;
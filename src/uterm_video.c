@@ -481,6 +481,39 @@ bool uterm_display_is_swapping(struct uterm_display *disp)
 	return disp->vblank_scheduled || (disp->flags & DISPLAY_VSYNC);
 }
 
+/*
+ * Returns the number of frames since the current back-buffer was presented,
+ * like EGL_EXT_buffer_age. 1 means it contains the frame on screen, 0 means
+ * its content is undefined and everything must be drawn again. Backends that
+ * cannot tell return -EOPNOTSUPP.
+ */
+SHL_EXPORT
+int uterm_display_get_buffer_age(struct uterm_display *disp)
+{
+	if (!disp || !display_is_online(disp))
+		return -EINVAL;
+
+	return VIDEO_CALL(disp->ops->get_buffer_age, -EOPNOTSUPP, disp);
+}
+
+/*
+ * Renderers that write directly into the buffers returned by
+ * uterm_display_get_buffers() must report the regions they modified. Backends
+ * that render into a shadow buffer copy only these regions to the real
+ * framebuffer on the next swap. The helpers like uterm_display_fill() track
+ * their damage internally.
+ */
+SHL_EXPORT
+int uterm_display_damage(struct uterm_display *disp,
+			 unsigned int x, unsigned int y,
+			 unsigned int width, unsigned int height)
+{
+	if (!disp || !display_is_online(disp))
+		return -EINVAL;
+
+	return VIDEO_CALL(disp->ops->damage, 0, disp, x, y, width, height);
+}
+
 SHL_EXPORT
 int uterm_display_fill(struct uterm_display *disp,
 		       uint8_t r, uint8_t g, uint8_t b,
@@ -494,6 +527,25 @@ int uterm_display_fill(struct uterm_display *disp,
 			  width, height);
 }
 
+/*
+ * Moves a rectangle inside the buffer that is currently drawn into. Source and
+ * destination may overlap. This is used to scroll the console without
+ * rendering all rows again. Backends that do not support it return
+ * -EOPNOTSUPP and the caller has to redraw the area instead.
+ */
+SHL_EXPORT
+int uterm_display_copy(struct uterm_display *disp,
+		       unsigned int src_x, unsigned int src_y,
+		       unsigned int dst_x, unsigned int dst_y,
+		       unsigned int width, unsigned int height)
+{
+	if (!disp || !display_is_online(disp) || !video_is_awake(disp->video))
+		return -EINVAL;
+
+	return VIDEO_CALL(disp->ops->copy, -EOPNOTSUPP, disp, src_x, src_y,
+			  dst_x, dst_y, width, height);
+}
+
 SHL_EXPORT
 int uterm_display_blit(struct uterm_display *disp,
 		       const struct uterm_video_buffer *buf,
@@ -531,6 +583,112 @@ int uterm_display_fake_blend(struct uterm_display *disp,
 	return VIDEO_CALL(disp->ops->fake_blendv, -EOPNOTSUPP, disp, &req, 1);
 }
 
+/*
+ * Parallel Blending
+ * If the video object has worker threads and the backend supports it, large
+ * blend requests are split into horizontal bands which are blended in
+ * parallel. Bands must never share a row, so we only split arrays that are
+ * sorted by their y position (like the row-by-row output of the renderers) and
+ * only between requests that start below every request of the current band.
+ * Anything else is blended on the calling thread.
+ */
+
+#define BLEND_PARALLEL_MIN 64
+#define BLEND_BANDS_MAX 16
+
+struct blend_band {
+	const struct uterm_video_blend_req *req;
+	size_t num;
+	int ret;
+};
+
+struct blend_job {
+	struct uterm_display *disp;
+	struct blend_band bands[BLEND_BANDS_MAX];
+};
+
+static void blend_band_run(void *data, unsigned int idx)
+{
+	struct blend_job *job = data;
+	struct blend_band *band = &job->bands[idx];
+
+	band->ret = job->disp->ops->fake_blendv(job->disp, band->req,
+						band->num);
+}
+
+static unsigned int blend_split(struct blend_job *job,
+				const struct uterm_video_blend_req *req,
+				size_t num, unsigned int max)
+{
+	struct blend_band *band;
+	unsigned int cnt, y, bottom, tmp;
+	size_t i, size;
+
+	if (max > BLEND_BANDS_MAX)
+		max = BLEND_BANDS_MAX;
+	size = SHL_DIV_ROUND_UP(num, max);
+
+	cnt = 1;
+	band = job->bands;
+	band->req = req;
+	band->num = 0;
+	y = 0;
+	bottom = 0;
+
+	for (i = 0; i < num; ++i) {
+		if (!req[i].buf) {
+			++band->num;
+			continue;
+		}
+
+		if (req[i].y < y)
+			return 1;
+		y = req[i].y;
+
+		if (band->num >= size && y >= bottom && cnt < max) {
+			++band;
+			++cnt;
+			band->req = &req[i];
+			band->num = 0;
+		}
+
+		tmp = y + req[i].buf->height;
+		if (tmp > bottom)
+			bottom = tmp;
+		++band->num;
+	}
+
+	return cnt;
+}
+
+static int display_fake_blendv(struct uterm_display *disp,
+			       const struct uterm_video_blend_req *req,
+			       size_t num)
+{
+	struct blend_job job;
+	unsigned int i, cnt;
+
+	cnt = shl_worker_get_num(disp->video->workers);
+	if (cnt > 1 && num >= BLEND_PARALLEL_MIN &&
+	    (disp->flags & DISPLAY_PARALLEL))
+		cnt = blend_split(&job, req, num, cnt);
+	else
+		cnt = 1;
+
+	if (cnt < 2)
+		return disp->ops->fake_blendv(disp, req, num);
+
+	job.disp = disp;
+	shl_worker_run(disp->video->workers, blend_band_run, &job, cnt);
+
+	for (i = 0; i < cnt; ++i) {
+		if (job.bands[i].ret)
+			return job.bands[i].ret;
+	}
+
+	return 0;
+}
+
 SHL_EXPORT
 int uterm_display_fake_blendv(struct uterm_display *disp,
 			      const struct uterm_video_blend_req *req,
@@ -538,8 +696,12 @@ int uterm_display_fake_blendv(struct uterm_display *disp,
 {
 	if (!disp || !display_is_online(disp) || !video_is_awake(disp->video))
 		return -EINVAL;
+	if (!disp->ops->fake_blendv)
+		return -EOPNOTSUPP;
+	if (!req)
+		return -EINVAL;
 
-	return VIDEO_CALL(disp->ops->fake_blendv, -EOPNOTSUPP, disp, req, num);
+	return display_fake_blendv(disp, req, num);
 }
 
 SHL_EXPORT
@@ -559,6 +721,7 @@ int uterm_video_new(struct uterm_video **out, struct ev_eloop *eloop,
 		return -ENOMEM;
 	memset(video, 0, sizeof(*video));
 	video->ref = 1;
+	video->dithering = true;
 	video->mod = mod;
 	video->ops = mod->ops;
 	video->eloop = eloop;
@@ -610,6 +773,7 @@ void uterm_video_unref(struct uterm_video *video)
 	}
 
 	VIDEO_CALL(video->ops->destroy, 0, video);
+	shl_worker_free(video->workers);
 	shl_hook_free(video->hook);
 	ev_eloop_unref(video->eloop);
 	free(video);
@@ -704,3 +868,80 @@ void uterm_video_poll(struct uterm_video *video)
 
 	VIDEO_CALL(video->ops->poll, 0, video);
 }
+
+/*
+ * Select whether backends render into a shadow buffer in system RAM instead of
+ * directly into the framebuffer. This only affects displays that are activated
+ * afterwards and is ignored by backends that cannot make use of it.
+ */
+SHL_EXPORT
+void uterm_video_set_shadow(struct uterm_video *video, unsigned int mode)
+{
+	if (!video)
+		return;
+
+	video->shadow = mode;
+}
+
+/*
+ * Render into the buffer that is currently scanned out and only report the
+ * damaged areas to the device instead of flipping buffers. This is much faster
+ * on devices that upload each frame, like USB displays, but may cause tearing.
+ * Like uterm_video_set_shadow(), this only affects displays that are activated
+ * afterwards.
+ */
+SHL_EXPORT
+void uterm_video_set_dirty_only(struct uterm_video *video, bool enable)
+{
+	if (!video)
+		return;
+
+	video->dirty_only = enable;
+}
+
+/*
+ * Dither colors on framebuffers with less than 8 bits per channel. Without
+ * dithering, gradients show bands but common 16bpp formats are converted much
+ * faster. This is enabled by default and, like uterm_video_set_shadow(), only
+ * affects displays that are activated afterwards.
+ */
+SHL_EXPORT
+void uterm_video_set_dithering(struct uterm_video *video, bool enable)
+{
+	if (!video)
+		return;
+
+	video->dithering = enable;
+}
+
+/*
+ * Use @num threads, including the caller, to blend large requests. 0 or 1
+ * disables parallel blending.
+ */
+SHL_EXPORT
+int uterm_video_set_render_threads(struct uterm_video *video,
+				   unsigned int num)
+{
+	struct shl_worker *w = NULL;
+	int ret;
+
+	if (!video)
+		return -EINVAL;
+	if (num == shl_worker_get_num(video->workers) ||
+	    (num <= 1 && !video->workers))
+		return 0;
+
+	if (num > 1) {
+		ret = shl_worker_new(&w, num);
+		if (ret) {
+			log_error("cannot create %u render threads (%d)",
+				  num, ret);
+			return ret;
+		}
+		log_debug("using %u render threads for %p", num, video);
+	}
+
+	shl_worker_free(video->workers);
+	video->workers = w;
+	return 0;
+}
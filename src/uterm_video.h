@@ -102,6 +102,12 @@ enum uterm_video_format {
 	UTERM_FORMAT_RGB16	= 0x04,
 };
 
+enum uterm_video_shadow {
+	UTERM_SHADOW_AUTO,
+	UTERM_SHADOW_ON,
+	UTERM_SHADOW_OFF,
+};
+
 struct uterm_video_buffer {
 	unsigned int width;
 	unsigned int height;
@@ -171,11 +177,19 @@ int uterm_display_get_buffers(struct uterm_display *disp,
 			      unsigned int formats);
 int uterm_display_swap(struct uterm_display *disp, bool immediate);
 bool uterm_display_is_swapping(struct uterm_display *disp);
+int uterm_display_get_buffer_age(struct uterm_display *disp);
+int uterm_display_damage(struct uterm_display *disp,
+			 unsigned int x, unsigned int y,
+			 unsigned int width, unsigned int height);
 
 int uterm_display_fill(struct uterm_display *disp,
 		       uint8_t r, uint8_t g, uint8_t b,
 		       unsigned int x, unsigned int y,
 		       unsigned int width, unsigned int height);
+int uterm_display_copy(struct uterm_display *disp,
+		       unsigned int src_x, unsigned int src_y,
+		       unsigned int dst_x, unsigned int dst_y,
+		       unsigned int width, unsigned int height);
 int uterm_display_blit(struct uterm_display *disp,
 		       const struct uterm_video_buffer *buf,
 		       unsigned int x, unsigned int y);
@@ -206,6 +220,11 @@ void uterm_video_sleep(struct uterm_video *video);
 int uterm_video_wake_up(struct uterm_video *video);
 bool uterm_video_is_awake(struct uterm_video *video);
 void uterm_video_poll(struct uterm_video *video);
+void uterm_video_set_shadow(struct uterm_video *video, unsigned int mode);
+void uterm_video_set_dirty_only(struct uterm_video *video, bool enable);
+void uterm_video_set_dithering(struct uterm_video *video, bool enable);
+int uterm_video_set_render_threads(struct uterm_video *video,
+				   unsigned int num);
 
 /* external modules */
 
@@ -227,4 +246,10 @@ extern const struct uterm_video_module *UTERM_VIDEO_DRM3D;
 #define UTERM_VIDEO_DRM3D NULL
 #endif
 
+#ifdef BUILD_ENABLE_VIDEO_MEM
+extern const struct uterm_video_module *UTERM_VIDEO_MEM;
+#else
+#define UTERM_VIDEO_MEM NULL
+#endif
+
 #endif /* UTERM_UTERM_VIDEO_H */
@@ -35,6 +35,7 @@
 #include "eloop.h"
 #include "shl_dlist.h"
 #include "shl_hook.h"
+#include "shl_worker.h"
 #include "uterm_video.h"
 
 /* backend-operations */
@@ -58,6 +59,9 @@ struct display_ops {
 			    struct uterm_video_buffer *buffer,
 			    unsigned int formats);
 	int (*swap) (struct uterm_display *disp, bool immediate);
+	int (*get_buffer_age) (struct uterm_display *disp);
+	int (*damage) (struct uterm_display *disp, unsigned int x,
+		       unsigned int y, unsigned int width, unsigned int height);
 	int (*blit) (struct uterm_display *disp,
 		     const struct uterm_video_buffer *buf,
 		     unsigned int x, unsigned int y);
@@ -67,6 +71,10 @@ struct display_ops {
 	int (*fill) (struct uterm_display *disp,
 		     uint8_t r, uint8_t g, uint8_t b, unsigned int x,
 		     unsigned int y, unsigned int width, unsigned int height);
+	int (*copy) (struct uterm_display *disp,
+		     unsigned int src_x, unsigned int src_y,
+		     unsigned int dst_x, unsigned int dst_y,
+		     unsigned int width, unsigned int height);
 };
 
 struct video_ops {
@@ -108,6 +116,7 @@ void uterm_mode_unbind(struct uterm_mode *mode);
 #define DISPLAY_DBUF		0x10
 #define DISPLAY_DITHERING	0x20
 #define DISPLAY_PFLIP		0x40
+#define DISPLAY_PARALLEL	0x80	/* fake_blendv() is safe on disjoint rows */
 
 struct uterm_display {
 	struct shl_dlist list;
@@ -155,6 +164,10 @@ struct uterm_video {
 	unsigned long ref;
 	unsigned int flags;
 	struct ev_eloop *eloop;
+	unsigned int shadow;
+	bool dirty_only;
+	bool dithering;
+	struct shl_worker *workers;
 
 	struct shl_dlist displays;
 	struct shl_hook *hook;
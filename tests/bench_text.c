@@ -0,0 +1,722 @@
+/*
+ * bench_text - Benchmark text renderers
+ *
+ * Copyright (c) 2012 David Herrmann <dh.herrmann@googlemail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Text Renderer Benchmark
+ * This draws synthetic screens with every text renderer that is compiled in
+ * and prints one CSV line per renderer and screen to stdout:
+ *   renderer,screen,frames,usec_per_frame,cells_per_sec,allocs_per_frame
+ * Only the time between kmscon_text_prepare() and kmscon_text_render() is
+ * measured; swapping the buffers is not. Allocations are counted by wrapping
+ * malloc(), calloc() and realloc() of the C library.
+ *
+ * The screens are drawn on an offscreen display of the "mem" video backend.
+ * The gltex renderer needs an OpenGL display, so it is only run if a DRM node
+ * is passed via --gl-node. For a software rasterizer like llvmpipe, use a
+ * virtual DRM device like vkms and set LIBGL_ALWAYS_SOFTWARE=1.
+ *
+ * Run all renderers on all screens:
+ * $ ./bench_text
+ *
+ * Compare bblit and bbulk on a large screen:
+ * $ ./bench_text --renderers=bblit,bbulk --display=1920x1080
+ */
+
+static void print_help();
+
+#include <errno.h>
+#include <inttypes.h>
+#include <libtsm.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "eloop.h"
+#include "font.h"
+#include "shl_log.h"
+#include "shl_misc.h"
+#include "shl_timer.h"
+#include "text.h"
+#include "uterm_video.h"
+#include "test_include.h"
+
+#define LOG_SUBSYSTEM "bench_text"
+
+struct {
+	char **renderers;
+	char **screens;
+	unsigned int frames;
+	unsigned int warmup;
+	unsigned int glyph_cache;
+	char *display;
+	char *gl_node;
+} bench_conf;
+
+/*
+ * Allocation Counter
+ * With glibc, the application can replace the allocator and forward the calls
+ * to the __libc_*() entry points. This also catches allocations inside of
+ * shared libraries like pixman or the GL driver. Other C libraries simply
+ * report 0 allocations.
+ */
+
+static bool alloc_counting;
+static unsigned long alloc_count;
+
+#ifdef __GLIBC__
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static inline void count_alloc(void)
+{
+	if (alloc_counting)
+		__sync_fetch_and_add(&alloc_count, 1);
+}
+
+SHL_EXPORT
+void *malloc(size_t size)
+{
+	count_alloc();
+	return __libc_malloc(size);
+}
+
+SHL_EXPORT
+void *calloc(size_t nmemb, size_t size)
+{
+	count_alloc();
+	return __libc_calloc(nmemb, size);
+}
+
+SHL_EXPORT
+void *realloc(void *ptr, size_t size)
+{
+	count_alloc();
+	return __libc_realloc(ptr, size);
+}
+
+#endif /* __GLIBC__ */
+
+/*
+ * Synthetic Screens
+ * Each screen fills a grid of cells for a given frame number. Consecutive
+ * frames differ so glyph caches see a realistic mix of hits and misses. The
+ * grid is drawn completely each frame, except for the "scroll" screen which
+ * moves the rows that the target buffer already contains and draws only the
+ * new ones.
+ */
+
+struct cell {
+	uint32_t ch;
+	unsigned int width;
+	struct tsm_screen_attr attr;
+};
+
+struct bench {
+	struct ev_eloop *eloop;
+	struct uterm_display *disp;
+	struct kmscon_text *txt;
+	unsigned int cols;
+	unsigned int rows;
+	struct cell *cells;
+
+	/* first line that each buffer contains, -1 if unknown */
+	long buf_line[2];
+
+	unsigned long drawn;
+};
+
+struct screen_type {
+	const char *name;
+	bool scroll;
+	void (*fill) (struct bench *b, unsigned int frame);
+};
+
+static const uint8_t palette[8][3] = {
+	{   0,   0,   0 },
+	{ 205,   0,   0 },
+	{   0, 205,   0 },
+	{ 205, 205,   0 },
+	{   0,   0, 238 },
+	{ 205,   0, 205 },
+	{   0, 205, 205 },
+	{ 229, 229, 229 },
+};
+
+static uint32_t rnd(uint32_t seed)
+{
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return seed;
+}
+
+static void set_cell(struct cell *cell, uint32_t ch, unsigned int width,
+		     unsigned int fg, unsigned int bg, bool bold)
+{
+	memset(cell, 0, sizeof(*cell));
+	cell->ch = ch;
+	cell->width = width;
+	cell->attr.fccode = -1;
+	cell->attr.bccode = -1;
+	cell->attr.fr = palette[fg][0];
+	cell->attr.fg = palette[fg][1];
+	cell->attr.fb = palette[fg][2];
+	cell->attr.br = palette[bg][0];
+	cell->attr.bg = palette[bg][1];
+	cell->attr.bb = palette[bg][2];
+	cell->attr.bold = bold;
+}
+
+static void fill_line(struct bench *b, unsigned int row, unsigned long line)
+{
+	struct cell *cell = &b->cells[row * b->cols];
+	unsigned int i, len;
+
+	len = rnd(line + 1) % b->cols;
+	for (i = 0; i < b->cols; ++i) {
+		if (i < len)
+			set_cell(&cell[i], '!' + (line + i) % 94, 1, 7, 0,
+				 false);
+		else
+			set_cell(&cell[i], 0, 1, 7, 0, false);
+	}
+}
+
+static void fill_ascii(struct bench *b, unsigned int frame)
+{
+	unsigned int i, num = b->cols * b->rows;
+
+	for (i = 0; i < num; ++i)
+		set_cell(&b->cells[i], '!' + (i + frame) % 94, 1, 7, 0, false);
+}
+
+static void fill_ls(struct bench *b, unsigned int frame)
+{
+	unsigned int x, y, len, color;
+	uint32_t seed;
+	struct cell *cell;
+
+	for (y = 0; y < b->rows; ++y) {
+		seed = rnd(y * 7919 + frame + 1);
+		len = 0;
+		color = 7;
+		for (x = 0; x < b->cols; ++x) {
+			cell = &b->cells[y * b->cols + x];
+			if (!len) {
+				seed = rnd(seed);
+				len = 4 + seed % 12;
+				color = 1 + (seed >> 8) % 7;
+				set_cell(cell, 0, 1, 7, 0, false);
+				continue;
+			}
+
+			--len;
+			set_cell(cell, 'a' + (seed >> (len % 16)) % 26, 1,
+				 color, 0, color == 4 || color == 2);
+		}
+	}
+}
+
+static void fill_cjk(struct bench *b, unsigned int frame)
+{
+	unsigned int x, y;
+	uint32_t seed;
+	struct cell *cell;
+
+	for (y = 0; y < b->rows; ++y) {
+		seed = rnd(y * 104729 + frame + 1);
+		for (x = 0; x < b->cols; ++x) {
+			cell = &b->cells[y * b->cols + x];
+			seed = rnd(seed);
+			if (x + 1 < b->cols && seed % 10 < 7) {
+				set_cell(cell, 0x4e00 + (seed >> 8) % 0x5000,
+					 2, 7, 0, false);
+				set_cell(++cell, 0, 0, 7, 0, false);
+				++x;
+			} else {
+				set_cell(cell, '!' + (seed >> 8) % 94, 1,
+					 7, 0, false);
+			}
+		}
+	}
+}
+
+static void fill_sparse(struct bench *b, unsigned int frame)
+{
+	unsigned int i, num = b->cols * b->rows;
+	uint32_t seed;
+
+	seed = rnd(frame + 1);
+	for (i = 0; i < num; ++i) {
+		seed = rnd(seed);
+		if (seed % 100 < 5)
+			set_cell(&b->cells[i], '!' + (seed >> 8) % 94, 1,
+				 7, 0, false);
+		else
+			set_cell(&b->cells[i], 0, 1, 7, 0, false);
+	}
+}
+
+static void fill_scroll(struct bench *b, unsigned int frame)
+{
+	unsigned int y;
+
+	for (y = 0; y < b->rows; ++y)
+		fill_line(b, y, frame + y);
+}
+
+static const struct screen_type screen_types[] = {
+	{ "ascii", false, fill_ascii },
+	{ "ls", false, fill_ls },
+	{ "cjk", false, fill_cjk },
+	{ "sparse", false, fill_sparse },
+	{ "scroll", true, fill_scroll },
+	{ NULL },
+};
+
+static bool in_list(char **list, const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; list && list[i]; ++i) {
+		if (!strcmp(list[i], name))
+			return true;
+	}
+
+	return false;
+}
+
+static void draw_rows(struct bench *b, unsigned int from)
+{
+	unsigned int x, y;
+	struct cell *cell;
+	int ret;
+
+	for (y = from; y < b->rows; ++y) {
+		for (x = 0; x < b->cols; ++x) {
+			cell = &b->cells[y * b->cols + x];
+			if (!cell->width)
+				continue;
+
+			ret = kmscon_text_draw(b->txt, cell->ch, &cell->ch,
+					       cell->ch ? 1 : 0, cell->width,
+					       x, y, &cell->attr);
+			if (!ret)
+				++b->drawn;
+		}
+	}
+}
+
+static int draw_frame(struct bench *b, const struct screen_type *type,
+		      unsigned int frame)
+{
+	int ret, buf;
+	long shift = 0;
+	bool opengl;
+
+	buf = uterm_display_use(b->disp, &opengl);
+	if (type->scroll && !opengl && buf >= 0 && buf < 2 &&
+	    b->buf_line[buf] >= 0 && uterm_display_get_buffer_age(b->disp) > 0)
+		shift = (long)frame - b->buf_line[buf];
+	if (shift <= 0 || shift >= b->rows)
+		shift = 0;
+
+	type->fill(b, frame);
+
+	ret = kmscon_text_prepare_age(b->txt, 0);
+	if (ret)
+		return ret;
+
+	if (shift) {
+		ret = kmscon_text_move(b->txt, shift, 0, b->rows - shift);
+		if (ret)
+			shift = 0;
+	}
+
+	draw_rows(b, shift ? b->rows - shift : 0);
+
+	ret = kmscon_text_render(b->txt);
+	if (ret)
+		return ret;
+
+	if (buf >= 0 && buf < 2)
+		b->buf_line[buf] = type->scroll ? (long)frame : -1;
+
+	return 0;
+}
+
+static int swap_frame(struct bench *b)
+{
+	int ret;
+
+	ret = uterm_display_swap(b->disp, true);
+	if (ret)
+		return ret;
+
+	while (uterm_display_is_swapping(b->disp)) {
+		ret = ev_eloop_dispatch(b->eloop, 1000);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+static int run_screen(struct bench *b, const char *renderer,
+		      const struct screen_type *type)
+{
+	struct shl_timer timer;
+	unsigned int i, num;
+	unsigned long allocs;
+	uint64_t usec = 0;
+	int ret;
+
+	b->buf_line[0] = -1;
+	b->buf_line[1] = -1;
+	num = bench_conf.warmup + bench_conf.frames;
+
+	for (i = 0; i < num; ++i) {
+		if (i == bench_conf.warmup) {
+			shl_timer_reset(&timer);
+			b->drawn = 0;
+			alloc_count = 0;
+		}
+
+		shl_timer_start(&timer);
+		alloc_counting = i >= bench_conf.warmup;
+		ret = draw_frame(b, type, i);
+		alloc_counting = false;
+		if (i >= bench_conf.warmup)
+			usec = shl_timer_stop(&timer);
+
+		if (ret) {
+			log_error("cannot draw frame %u of %s with %s: %d",
+				  i, type->name, renderer, ret);
+			kmscon_text_abort(b->txt);
+			return ret;
+		}
+
+		ret = swap_frame(b);
+		if (ret) {
+			log_error("cannot swap display: %d", ret);
+			return ret;
+		}
+	}
+
+	allocs = alloc_count;
+	if (!usec)
+		usec = 1;
+
+	printf("%s,%s,%u,%.1f,%.0f,%.2f\n", renderer, type->name,
+	       bench_conf.frames,
+	       (double)usec / bench_conf.frames,
+	       (double)b->drawn * 1000000 / usec,
+	       (double)allocs / bench_conf.frames);
+	fflush(stdout);
+
+	return 0;
+}
+
+static int run_renderer(struct bench *b, const char *renderer,
+			struct kmscon_font *font, struct kmscon_font *bold_font)
+{
+	const struct screen_type *type;
+	int ret;
+
+	ret = kmscon_text_new(&b->txt, renderer);
+	if (ret) {
+		log_error("cannot create text renderer %s: %d", renderer, ret);
+		return ret;
+	}
+
+	/* kmscon_text_new() falls back to the default renderer */
+	if (strcmp(b->txt->ops->name, renderer)) {
+		log_warning("text renderer %s is not available", renderer);
+		ret = -ENOENT;
+		goto err_txt;
+	}
+
+	kmscon_text_set_cache_size(b->txt,
+				   (size_t)bench_conf.glyph_cache * 1024);
+
+	ret = kmscon_text_set(b->txt, font, bold_font, b->disp);
+	if (ret) {
+		log_error("cannot use text renderer %s on this display: %d",
+			  renderer, ret);
+		goto err_txt;
+	}
+
+	b->cols = kmscon_text_get_cols(b->txt);
+	b->rows = kmscon_text_get_rows(b->txt);
+	b->cells = calloc(b->cols * b->rows, sizeof(*b->cells));
+	if (!b->cells) {
+		ret = -ENOMEM;
+		goto err_unset;
+	}
+
+	for (type = screen_types; type->name; ++type) {
+		if (!in_list(bench_conf.screens, type->name))
+			continue;
+
+		ret = run_screen(b, renderer, type);
+		if (ret)
+			break;
+	}
+
+	free(b->cells);
+	b->cells = NULL;
+err_unset:
+	kmscon_text_unset(b->txt);
+err_txt:
+	kmscon_text_unref(b->txt);
+	b->txt = NULL;
+	return ret;
+}
+
+static int open_display(struct bench *b, struct uterm_video **out,
+			const char *node, const struct uterm_video_module *mod)
+{
+	struct uterm_video *video;
+	struct uterm_display *disp;
+	int ret;
+
+	ret = uterm_video_new(&video, b->eloop, node, mod);
+	if (ret)
+		return ret;
+
+	ret = uterm_video_wake_up(video);
+	if (ret)
+		goto err_unref;
+
+	/* some backends announce their displays from an idle callback */
+	ev_eloop_dispatch(b->eloop, 0);
+
+	disp = uterm_video_get_displays(video);
+	if (!disp) {
+		ret = -ENODEV;
+		goto err_unref;
+	}
+
+	ret = uterm_display_activate(disp, NULL);
+	if (ret)
+		goto err_unref;
+
+	ret = uterm_display_set_dpms(disp, UTERM_DPMS_ON);
+	if (ret)
+		log_warning("cannot set DPMS to ON: %d", ret);
+
+	b->disp = disp;
+	*out = video;
+	return 0;
+
+err_unref:
+	uterm_video_unref(video);
+	return ret;
+}
+
+static int run_video(struct bench *b, const char *node,
+		     const struct uterm_video_module *mod, bool gl)
+{
+	struct uterm_video *video;
+	struct kmscon_font *font, *bold_font;
+	struct kmscon_font_attr attr;
+	unsigned int i;
+	bool opengl;
+	int ret;
+
+	if (!mod) {
+		log_error("video backend for %s not compiled in", node);
+		return -EOPNOTSUPP;
+	}
+
+	ret = open_display(b, &video, node, mod);
+	if (ret) {
+		log_error("cannot open display %s: %d", node, ret);
+		return ret;
+	}
+
+	memset(&attr, 0, sizeof(attr));
+	ret = kmscon_font_find(&font, &attr, "8x16");
+	if (ret) {
+		log_error("cannot load font: %d", ret);
+		goto err_video;
+	}
+
+	attr.bold = true;
+	ret = kmscon_font_find(&bold_font, &attr, "8x16");
+	if (ret) {
+		bold_font = font;
+		kmscon_font_ref(bold_font);
+	}
+
+	uterm_display_use(b->disp, &opengl);
+	for (i = 0; bench_conf.renderers[i]; ++i) {
+		if (gl != !strcmp(bench_conf.renderers[i], "gltex"))
+			continue;
+		if (gl && !opengl) {
+			log_warning("display %s does not support OpenGL",
+				    node);
+			continue;
+		}
+
+		/* a missing renderer does not stop the benchmark */
+		run_renderer(b, bench_conf.renderers[i], font, bold_font);
+	}
+
+	kmscon_font_unref(bold_font);
+	kmscon_font_unref(font);
+err_video:
+	b->disp = NULL;
+	uterm_video_unref(video);
+	return ret;
+}
+
+static void print_help()
+{
+	/*
+	 * Usage/Help information
+	 * This should be scaled to a maximum of 80 characters per line:
+	 *
+	 * 80 char line:
+	 *       |   10   |    20   |    30   |    40   |    50   |    60   |    70   |    80   |
+	 *      "12345678901234567890123456789012345678901234567890123456789012345678901234567890\n"
+	 * 80 char line starting with tab:
+	 *       |10|    20   |    30   |    40   |    50   |    60   |    70   |    80   |
+	 *      "\t901234567890123456789012345678901234567890123456789012345678901234567890\n"
+	 */
+	fprintf(stderr,
+		"Usage:\n"
+		"\t%1$s [options]\n"
+		"\t%1$s -h [options]\n"
+		"\n"
+		"You can prefix boolean options with \"no-\" to negate it. If an argument is\n"
+		"given multiple times, only the last argument matters if not otherwise stated.\n"
+		"\n"
+		"General Options:\n"
+		TEST_HELP
+		"\n"
+		"Benchmark Options:\n"
+		"\t    --renderers <list>      [bblit,bbulk,pixman,gltex]\n"
+		"\t                                    Text renderers to run\n"
+		"\t    --screens <list>        [ascii,ls,cjk,sparse,scroll]\n"
+		"\t                                    Synthetic screens to draw\n"
+		"\t    --frames <num>          [200]   Measured frames per screen\n"
+		"\t    --warmup <num>          [10]    Frames drawn before measuring\n"
+		"\t    --glyph-cache <KiB>     [2048]  Memory for blended glyphs\n"
+		"\t    --display <spec>        [1024x768]\n"
+		"\t                                    Offscreen display as WxH[:format]\n"
+		"\t    --gl-node <node>        [off]   DRM node to run gltex on\n",
+		"bench_text");
+	/*
+	 * 80 char line:
+	 *       |   10   |    20   |    30   |    40   |    50   |    60   |    70   |    80   |
+	 *      "12345678901234567890123456789012345678901234567890123456789012345678901234567890\n"
+	 * 80 char line starting with tab:
+	 *       |10|    20   |    30   |    40   |    50   |    60   |    70   |    80   |
+	 *      "\t901234567890123456789012345678901234567890123456789012345678901234567890\n"
+	 */
+}
+
+static char *def_renderers[] = { "bblit", "bbulk", "pixman", "gltex", NULL };
+static char *def_screens[] = { "ascii", "ls", "cjk", "sparse", "scroll",
+			       NULL };
+
+struct conf_option options[] = {
+	TEST_OPTIONS,
+	CONF_OPTION_STRING_LIST(0, "renderers", &bench_conf.renderers,
+				def_renderers),
+	CONF_OPTION_STRING_LIST(0, "screens", &bench_conf.screens,
+				def_screens),
+	CONF_OPTION_UINT(0, "frames", &bench_conf.frames, 200),
+	CONF_OPTION_UINT(0, "warmup", &bench_conf.warmup, 10),
+	CONF_OPTION_UINT(0, "glyph-cache", &bench_conf.glyph_cache, 2048),
+	CONF_OPTION_STRING(0, "display", &bench_conf.display, "1024x768"),
+	CONF_OPTION_STRING(0, "gl-node", &bench_conf.gl_node, NULL),
+};
+
+int main(int argc, char **argv)
+{
+	struct bench b;
+	size_t onum;
+	int ret;
+
+	onum = sizeof(options) / sizeof(*options);
+	memset(&b, 0, sizeof(b));
+	ret = test_prepare(options, onum, argc, argv, &b.eloop);
+	if (ret)
+		goto err_fail;
+
+	if (!bench_conf.frames) {
+		log_error("--frames must not be 0");
+		ret = -EINVAL;
+		goto err_exit;
+	}
+
+	kmscon_font_register(&kmscon_font_8x16_ops);
+	kmscon_text_register(&kmscon_text_bblit_ops);
+#ifdef BUILD_ENABLE_RENDERER_BBULK
+	kmscon_text_register(&kmscon_text_bbulk_ops);
+#endif
+#ifdef BUILD_ENABLE_RENDERER_PIXMAN
+	kmscon_text_register(&kmscon_text_pixman_ops);
+#endif
+#ifdef BUILD_ENABLE_RENDERER_GLTEX
+	kmscon_text_register(&kmscon_text_gltex_ops);
+#endif
+
+	printf("renderer,screen,frames,usec_per_frame,cells_per_sec,allocs_per_frame\n");
+
+	ret = run_video(&b, bench_conf.display, UTERM_VIDEO_MEM, false);
+	if (ret)
+		goto err_unregister;
+
+	if (in_list(bench_conf.renderers, "gltex")) {
+		if (bench_conf.gl_node)
+			run_video(&b, bench_conf.gl_node, UTERM_VIDEO_DRM3D,
+				  true);
+		else
+			log_notice("skipping gltex, no --gl-node given");
+	}
+
+err_unregister:
+#ifdef BUILD_ENABLE_RENDERER_GLTEX
+	kmscon_text_unregister(kmscon_text_gltex_ops.name);
+#endif
+#ifdef BUILD_ENABLE_RENDERER_PIXMAN
+	kmscon_text_unregister(kmscon_text_pixman_ops.name);
+#endif
+#ifdef BUILD_ENABLE_RENDERER_BBULK
+	kmscon_text_unregister(kmscon_text_bbulk_ops.name);
+#endif
+	kmscon_text_unregister(kmscon_text_bblit_ops.name);
+	kmscon_font_unregister(kmscon_font_8x16_ops.name);
+err_exit:
+	test_exit(options, onum, b.eloop);
+err_fail:
+	if (ret != -ECANCELED)
+		test_fail(ret);
+	return abs(ret);
+}
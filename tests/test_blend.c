@@ -0,0 +1,240 @@
+/*
+ * test_blend - Test glyph blending kernels
+ *
+ * Copyright (c) 2011-2013 David Herrmann <dh.herrmann@googlemail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Test glyph blending kernels
+ * This runs every blending kernel that is supported by the current CPU and
+ * compares the results bit by bit against the scalar reference kernel. All
+ * alpha values are blended against all foreground and background channel
+ * values, followed by random rows of all lengths to test the tail handling.
+ * It fails if any pixel differs.
+ */
+
+static void print_help();
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "shl_log.h"
+#include "uterm_blend_internal.h"
+#include "test_include.h"
+
+#define ROW_MAX 67
+#define RANDOM_RUNS 20000
+
+struct {
+	unsigned int seed;
+} blend_conf;
+
+static const struct uterm_blend_ops *scalar;
+
+static int compare_row(const struct uterm_blend_ops *ops,
+		       const uint8_t *src, unsigned int num,
+		       uint32_t fg, uint32_t bg)
+{
+	uint32_t ref[ROW_MAX + 1], res[ROW_MAX + 1];
+	unsigned int i;
+
+	/* the last pixel guards against writes beyond @num */
+	memset(ref, 0xa5, sizeof(ref));
+	memset(res, 0xa5, sizeof(res));
+
+	scalar->blend255(ref, src, num, fg, bg);
+	ops->blend255(res, src, num, fg, bg);
+
+	for (i = 0; i <= num; ++i) {
+		if (ref[i] != res[i]) {
+			log_err("%s: mismatch at pixel %u/%u (alpha %u fg %06x bg %06x): %08x != %08x",
+				ops->name, i, num,
+				i < num ? src[i] : 0, fg, bg, res[i], ref[i]);
+			return -EFAULT;
+		}
+	}
+
+	return 0;
+}
+
+static int test_full(const struct uterm_blend_ops *ops)
+{
+	uint8_t src[ROW_MAX];
+	unsigned int f, b, i, off;
+	uint32_t fg, bg;
+	int ret;
+
+	/* every alpha value at every offset of a row */
+	for (f = 0; f < 256; ++f) {
+		for (b = 0; b < 256; ++b) {
+			fg = (f << 16) | ((255 - f) << 8) | (f ^ 0x5a);
+			bg = (b << 16) | ((b ^ 0xa5) << 8) | (255 - b);
+
+			for (off = 0; off < 256; off += ROW_MAX) {
+				for (i = 0; i < ROW_MAX; ++i)
+					src[i] = (off + i) & 0xff;
+
+				ret = compare_row(ops, src, ROW_MAX,
+						  fg, bg);
+				if (ret)
+					return ret;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int test_random(const struct uterm_blend_ops *ops)
+{
+	uint8_t src[ROW_MAX];
+	unsigned int run, num, i;
+	uint32_t fg, bg;
+	int ret;
+
+	for (run = 0; run < RANDOM_RUNS; ++run) {
+		num = rand() % (ROW_MAX + 1);
+		fg = rand() & 0xffffff;
+		bg = rand() & 0xffffff;
+
+		/* glyphs are mostly fully transparent or fully opaque */
+		for (i = 0; i < num; ++i) {
+			switch (rand() % 4) {
+			case 0:
+				src[i] = 0;
+				break;
+			case 1:
+				src[i] = 255;
+				break;
+			default:
+				src[i] = rand() & 0xff;
+				break;
+			}
+		}
+
+		ret = compare_row(ops, src, num, fg, bg);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+static int test_kernels(void)
+{
+	const struct uterm_blend_ops *ops;
+	unsigned int i;
+	int ret;
+
+	for (i = 0; uterm_blend_kernels[i]; ++i)
+		scalar = uterm_blend_kernels[i];
+
+	for (i = 0; uterm_blend_kernels[i]; ++i) {
+		ops = uterm_blend_kernels[i];
+		if (ops == scalar)
+			continue;
+
+		if (!ops->supported()) {
+			log_notice("skipping unsupported kernel %s", ops->name);
+			continue;
+		}
+
+		log_notice("testing kernel %s", ops->name);
+
+		ret = test_full(ops);
+		if (ret)
+			return ret;
+
+		srand(blend_conf.seed);
+		ret = test_random(ops);
+		if (ret)
+			return ret;
+	}
+
+	log_notice("default kernel is %s", uterm_blend_get()->name);
+	return 0;
+}
+
+static void print_help()
+{
+	/*
+	 * Usage/Help information
+	 * This should be scaled to a maximum of 80 characters per line:
+	 *
+	 * 80 char line:
+	 *       |   10   |    20   |    30   |    40   |    50   |    60   |    70   |    80   |
+	 *      "12345678901234567890123456789012345678901234567890123456789012345678901234567890\n"
+	 * 80 char line starting with tab:
+	 *       |10|    20   |    30   |    40   |    50   |    60   |    70   |    80   |
+	 *      "\t901234567890123456789012345678901234567890123456789012345678901234567890\n"
+	 */
+	fprintf(stderr,
+		"Usage:\n"
+		"\t%1$s [options]\n"
+		"\t%1$s -h [options]\n"
+		"\n"
+		"You can prefix boolean options with \"no-\" to negate it. If an argument is\n"
+		"given multiple times, only the last argument matters if not otherwise stated.\n"
+		"\n"
+		"General Options:\n"
+		TEST_HELP
+		"\n"
+		"Blend Options:\n"
+		"\t    --seed <seed>           [1]     Seed for random test rows\n",
+		"test_blend");
+	/*
+	 * 80 char line:
+	 *       |   10   |    20   |    30   |    40   |    50   |    60   |    70   |    80   |
+	 *      "12345678901234567890123456789012345678901234567890123456789012345678901234567890\n"
+	 * 80 char line starting with tab:
+	 *       |10|    20   |    30   |    40   |    50   |    60   |    70   |    80   |
+	 *      "\t901234567890123456789012345678901234567890123456789012345678901234567890\n"
+	 */
+}
+
+struct conf_option options[] = {
+	TEST_OPTIONS,
+	CONF_OPTION_UINT(0, "seed", &blend_conf.seed, 1),
+};
+
+int main(int argc, char **argv)
+{
+	struct ev_eloop *eloop;
+	int ret;
+	size_t onum;
+
+	onum = sizeof(options) / sizeof(*options);
+	ret = test_prepare(options, onum, argc, argv, &eloop);
+	if (ret)
+		goto err_fail;
+
+	ret = test_kernels();
+
+	test_exit(options, onum, eloop);
+err_fail:
+	if (ret != -ECANCELED)
+		test_fail(ret);
+	return abs(ret);
+}
@@ -0,0 +1,361 @@
+/*
+ * test_cast - Test session recording and replay
+ *
+ * Copyright (c) 2011-2013 David Herrmann <dh.herrmann@googlemail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Test session recording and replay
+ * This records a random byte stream of ASCII, control characters, valid UTF-8
+ * and invalid bytes in random chunks, so sequences get split across events,
+ * with resize events in between. The recording is then continued by a second
+ * cast object and replayed as fast as possible into a file. It fails if the
+ * replayed bytes differ from the recorded ones.
+ * It also checks that a recording cannot be opened twice at the same time and
+ * replays a recording in the format of other writers, with timestamps in
+ * exponent form, at recorded speed.
+ */
+
+static void print_help();
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cast.h"
+#include "shl_log.h"
+#include "test_include.h"
+
+#define STREAM_SIZE (512 * 1024)
+#define CHUNK_MAX 3000
+
+struct {
+	unsigned int seed;
+} cast_conf;
+
+static size_t fill(unsigned char *buf, size_t size)
+{
+	size_t pos = 0;
+	unsigned int ch;
+
+	while (pos + 4 <= size) {
+		switch (rand() % 6) {
+		case 0:
+			/* any byte, mostly invalid as UTF-8 */
+			buf[pos++] = rand() % 256;
+			break;
+		case 1:
+			buf[pos++] = rand() % 0x20;
+			break;
+		case 2:
+			ch = 0x80 + rand() % 0x780;
+			buf[pos++] = 0xc0 | (ch >> 6);
+			buf[pos++] = 0x80 | (ch & 0x3f);
+			break;
+		case 3:
+			ch = 0x4e00 + rand() % 0x5000;
+			buf[pos++] = 0xe0 | (ch >> 12);
+			buf[pos++] = 0x80 | ((ch >> 6) & 0x3f);
+			buf[pos++] = 0x80 | (ch & 0x3f);
+			break;
+		case 4:
+			ch = 0x10000 + rand() % 0x100000;
+			buf[pos++] = 0xf0 | (ch >> 18);
+			buf[pos++] = 0x80 | ((ch >> 12) & 0x3f);
+			buf[pos++] = 0x80 | ((ch >> 6) & 0x3f);
+			buf[pos++] = 0x80 | (ch & 0x3f);
+			break;
+		default:
+			buf[pos++] = ' ' + rand() % 95;
+			break;
+		}
+	}
+
+	return pos;
+}
+
+static int record(const char *path, const unsigned char *buf, size_t len)
+{
+	struct kmscon_cast *cast;
+	size_t num;
+	int ret;
+
+	ret = kmscon_cast_open(&cast, path, 80, 24);
+	if (ret)
+		return ret;
+
+	while (len) {
+		num = rand() % CHUNK_MAX + 1;
+		if (num > len)
+			num = len;
+
+		kmscon_cast_output(cast, (const char*)buf, num);
+		buf += num;
+		len -= num;
+
+		if (!(rand() % 50))
+			kmscon_cast_resize(cast, 1 + rand() % 300,
+					   1 + rand() % 100);
+	}
+
+	kmscon_cast_close(cast);
+	return 0;
+}
+
+static int test_cast(void)
+{
+	char rec_path[] = "/tmp/test_cast-XXXXXX";
+	char out_path[] = "/tmp/test_cast-XXXXXX";
+	unsigned char *buf, *out;
+	size_t len, half;
+	ssize_t num;
+	int rec_fd = -1, out_fd = -1, ret;
+
+	buf = malloc(STREAM_SIZE);
+	out = malloc(STREAM_SIZE + 1);
+	if (!buf || !out) {
+		ret = -ENOMEM;
+		goto err_free;
+	}
+
+	rec_fd = mkstemp(rec_path);
+	out_fd = mkstemp(out_path);
+	if (rec_fd < 0 || out_fd < 0) {
+		ret = -errno;
+		log_err("cannot create temporary files: %m");
+		goto err_unlink;
+	}
+
+	srand(cast_conf.seed);
+	len = fill(buf, STREAM_SIZE);
+	half = len / 2;
+
+	/* the second half continues the recording of the first one */
+	ret = record(rec_path, buf, half);
+	if (!ret)
+		ret = record(rec_path, &buf[half], len - half);
+	if (ret) {
+		log_err("cannot record to %s: %d", rec_path, ret);
+		goto err_unlink;
+	}
+
+	ret = kmscon_cast_replay(rec_path, out_fd, true);
+	if (ret) {
+		log_err("cannot replay %s: %d", rec_path, ret);
+		goto err_unlink;
+	}
+
+	num = pread(out_fd, out, STREAM_SIZE + 1, 0);
+	if (num < 0 || (size_t)num != len || memcmp(buf, out, len)) {
+		log_err("replayed %zd bytes differ from %zu recorded bytes",
+			num, len);
+		ret = -EFAULT;
+		goto err_unlink;
+	}
+
+	log_notice("cast: %zu bytes recorded and replayed", len);
+
+err_unlink:
+	if (out_fd >= 0) {
+		close(out_fd);
+		unlink(out_path);
+	}
+	if (rec_fd >= 0) {
+		close(rec_fd);
+		unlink(rec_path);
+	}
+err_free:
+	free(out);
+	free(buf);
+	return ret;
+}
+
+static int test_busy(void)
+{
+	char path[] = "/tmp/test_cast-XXXXXX";
+	struct kmscon_cast *cast, *second;
+	int fd, ret;
+
+	fd = mkstemp(path);
+	if (fd < 0) {
+		log_err("cannot create temporary file: %m");
+		return -errno;
+	}
+
+	ret = kmscon_cast_open(&cast, path, 80, 24);
+	if (ret) {
+		log_err("cannot record to %s: %d", path, ret);
+		goto err_unlink;
+	}
+
+	ret = kmscon_cast_open(&second, path, 80, 24);
+	if (ret != -EBUSY) {
+		log_err("second open of %s returned %d instead of -EBUSY",
+			path, ret);
+		if (!ret)
+			kmscon_cast_close(second);
+		ret = -EFAULT;
+		goto err_close;
+	}
+
+	ret = 0;
+	log_notice("cast: second recording to the same file refused");
+
+err_close:
+	kmscon_cast_close(cast);
+err_unlink:
+	close(fd);
+	unlink(path);
+	return ret;
+}
+
+static const char foreign_cast[] =
+	"{\"version\": 2, \"width\": 80, \"height\": 24, \"timestamp\": 1500000000, \"env\": {\"TERM\": \"xterm\"}}\n"
+	"[1e-05, \"o\", \"a\"]\n"
+	"[0.0025, \"o\", \"b\\u00e4\"]\n"
+	"[2.5E-3, \"i\", \"x\"]\n"
+	"[5e-3, \"r\", \"100x30\"]\n"
+	"\n"
+	"[1.0E-2, \"o\", \"\\r\\n\"]\n";
+
+static const char foreign_out[] = "ab\xc3\xa4\r\n";
+
+static int test_foreign(void)
+{
+	char rec_path[] = "/tmp/test_cast-XXXXXX";
+	char out_path[] = "/tmp/test_cast-XXXXXX";
+	char out[sizeof(foreign_out) + 1];
+	ssize_t num;
+	int rec_fd, out_fd = -1, ret;
+
+	rec_fd = mkstemp(rec_path);
+	if (rec_fd >= 0)
+		out_fd = mkstemp(out_path);
+	if (rec_fd < 0 || out_fd < 0) {
+		ret = -errno;
+		log_err("cannot create temporary files: %m");
+		goto err_unlink;
+	}
+
+	num = write(rec_fd, foreign_cast, sizeof(foreign_cast) - 1);
+	if (num != sizeof(foreign_cast) - 1) {
+		ret = -EIO;
+		log_err("cannot write %s: %m", rec_path);
+		goto err_unlink;
+	}
+
+	ret = kmscon_cast_replay(rec_path, out_fd, false);
+	if (ret) {
+		log_err("cannot replay %s: %d", rec_path, ret);
+		goto err_unlink;
+	}
+
+	num = pread(out_fd, out, sizeof(out), 0);
+	if (num != sizeof(foreign_out) - 1 ||
+	    memcmp(out, foreign_out, num)) {
+		log_err("replayed %zd bytes differ from the foreign recording",
+			num);
+		ret = -EFAULT;
+		goto err_unlink;
+	}
+
+	log_notice("cast: foreign recording replayed");
+
+err_unlink:
+	if (out_fd >= 0) {
+		close(out_fd);
+		unlink(out_path);
+	}
+	if (rec_fd >= 0) {
+		close(rec_fd);
+		unlink(rec_path);
+	}
+	return ret;
+}
+
+static void print_help()
+{
+	/*
+	 * Usage/Help information
+	 * This should be scaled to a maximum of 80 characters per line:
+	 *
+	 * 80 char line:
+	 *       |   10   |    20   |    30   |    40   |    50   |    60   |    70   |    80   |
+	 *      "12345678901234567890123456789012345678901234567890123456789012345678901234567890\n"
+	 * 80 char line starting with tab:
+	 *       |10|    20   |    30   |    40   |    50   |    60   |    70   |    80   |
+	 *      "\t901234567890123456789012345678901234567890123456789012345678901234567890\n"
+	 */
+	fprintf(stderr,
+		"Usage:\n"
+		"\t%1$s [options]\n"
+		"\t%1$s -h [options]\n"
+		"\n"
+		"You can prefix boolean options with \"no-\" to negate it. If an argument is\n"
+		"given multiple times, only the last argument matters if not otherwise stated.\n"
+		"\n"
+		"General Options:\n"
+		TEST_HELP
+		"\n"
+		"Cast Options:\n"
+		"\t    --seed <seed>           [1]     Seed for the random stream\n",
+		"test_cast");
+	/*
+	 * 80 char line:
+	 *       |   10   |    20   |    30   |    40   |    50   |    60   |    70   |    80   |
+	 *      "12345678901234567890123456789012345678901234567890123456789012345678901234567890\n"
+	 * 80 char line starting with tab:
+	 *       |10|    20   |    30   |    40   |    50   |    60   |    70   |    80   |
+	 *      "\t901234567890123456789012345678901234567890123456789012345678901234567890\n"
+	 */
+}
+
+struct conf_option options[] = {
+	TEST_OPTIONS,
+	CONF_OPTION_UINT(0, "seed", &cast_conf.seed, 1),
+};
+
+int main(int argc, char **argv)
+{
+	struct ev_eloop *eloop;
+	int ret;
+	size_t onum;
+
+	onum = sizeof(options) / sizeof(*options);
+	ret = test_prepare(options, onum, argc, argv, &eloop);
+	if (ret)
+		goto err_fail;
+
+	ret = test_cast();
+	if (!ret)
+		ret = test_busy();
+	if (!ret)
+		ret = test_foreign();
+
+	test_exit(options, onum, eloop);
+err_fail:
+	if (ret != -ECANCELED)
+		test_fail(ret);
+	return abs(ret);
+}
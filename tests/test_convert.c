@@ -0,0 +1,282 @@
+/*
+ * test_convert - Test fbdev pixel conversion
+ *
+ * Copyright (c) 2011-2013 David Herrmann <dh.herrmann@googlemail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Test fbdev pixel conversion
+ * This sets up the XRGB32 conversion of the fbdev backend for several
+ * framebuffer layouts, with and without dithering, and compares the converted
+ * pixels with a straightforward per-pixel reference. Depending on the layout,
+ * this covers the lookup-table kernels, the dithered lookup-table kernels and
+ * the shift-only kernels for RGB565 and RGB555. Every value of each channel is
+ * converted at every position of the dither matrix, followed by random rows.
+ * It fails if any pixel differs.
+ */
+
+static void print_help();
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "shl_log.h"
+#include "uterm_fbdev_internal.h"
+#include "uterm_video_internal.h"
+#include "test_include.h"
+
+#define ROW_MAX 300
+#define RANDOM_RUNS 20000
+
+struct {
+	unsigned int seed;
+} convert_conf;
+
+struct layout {
+	const char *name;
+	unsigned int Bpp;
+	unsigned int len_r, len_g, len_b;
+	unsigned int off_r, off_g, off_b;
+};
+
+static const struct layout layouts[] = {
+	{ "rgb565",	2, 5, 6, 5, 11, 5, 0 },
+	{ "rgb555",	2, 5, 5, 5, 10, 5, 0 },
+	{ "bgr565",	2, 5, 6, 5, 0, 5, 11 },
+	{ "rgb444",	2, 4, 4, 4, 8, 4, 0 },
+	{ "xbgr32",	4, 8, 8, 8, 0, 8, 16 },
+	{ "xrgb2101010", 4, 10, 10, 10, 20, 10, 0 },
+	{ "rgb666",	4, 6, 6, 6, 12, 6, 0 },
+};
+
+/* the ordered dither matrix the backend is expected to use */
+static const uint8_t bayer[4][4] = {
+	{  0,  8,  2, 10 },
+	{ 12,  4, 14,  6 },
+	{  3, 11,  1,  9 },
+	{ 15,  7, 13,  5 },
+};
+
+static uint32_t ref_channel(unsigned int val, unsigned int len,
+			    unsigned int off, bool dither, unsigned int x,
+			    unsigned int y)
+{
+	if (len >= 8)
+		return (val << (len - 8)) << off;
+
+	if (dither) {
+		val += bayer[y % 4][x % 4] * (1 << (8 - len)) / 16;
+		if (val > 255)
+			val = 255;
+	}
+
+	return (val >> (8 - len)) << off;
+}
+
+static uint32_t ref_pixel(const struct layout *l, uint32_t pixel, bool dither,
+			  unsigned int x, unsigned int y)
+{
+	/* there is nothing to dither on 24bit and deeper framebuffers */
+	if (l->len_r >= 8 && l->len_g >= 8 && l->len_b >= 8)
+		dither = false;
+
+	return ref_channel((pixel >> 16) & 0xff, l->len_r, l->off_r, dither,
+			   x, y) |
+	       ref_channel((pixel >> 8) & 0xff, l->len_g, l->off_g, dither,
+			   x, y) |
+	       ref_channel(pixel & 0xff, l->len_b, l->off_b, dither, x, y);
+}
+
+static int compare_row(const struct layout *l, bool dither,
+		       const struct fbdev_display *fbdev, const uint32_t *src,
+		       unsigned int num, unsigned int x, unsigned int y)
+{
+	uint8_t res[(ROW_MAX + 1) * 4];
+	uint32_t ref, val;
+	unsigned int i;
+
+	/* the last pixel guards against writes beyond @num */
+	memset(res, 0xa5, sizeof(res));
+
+	fbdev->convert(fbdev, res, src, num, x, y);
+
+	for (i = 0; i <= num; ++i) {
+		if (l->Bpp == 2)
+			val = ((uint16_t*)res)[i];
+		else
+			val = ((uint32_t*)res)[i];
+
+		if (i == num)
+			ref = l->Bpp == 2 ? 0xa5a5 : 0xa5a5a5a5;
+		else
+			ref = ref_pixel(l, src[i], dither, x + i, y);
+
+		if (ref != val) {
+			log_err("%s%s: mismatch at pixel %u/%u (%u,%u, color %06x): %08x != %08x",
+				l->name, dither ? " dithered" : "", i, num,
+				x + i, y, i < num ? src[i] : 0, val, ref);
+			return -EFAULT;
+		}
+	}
+
+	return 0;
+}
+
+static int test_layout(const struct layout *l, bool dither)
+{
+	struct uterm_display disp;
+	struct fbdev_display fbdev;
+	uint32_t src[ROW_MAX];
+	unsigned int i, x, y, num, run;
+	int ret;
+
+	memset(&disp, 0, sizeof(disp));
+	memset(&fbdev, 0, sizeof(fbdev));
+	disp.data = &fbdev;
+	if (dither)
+		disp.flags |= DISPLAY_DITHERING;
+
+	fbdev.Bpp = l->Bpp;
+	fbdev.len_r = l->len_r;
+	fbdev.len_g = l->len_g;
+	fbdev.len_b = l->len_b;
+	fbdev.off_r = l->off_r;
+	fbdev.off_g = l->off_g;
+	fbdev.off_b = l->off_b;
+
+	uterm_fbdev_display_init_convert(&disp);
+	if (!fbdev.convert) {
+		log_err("%s: no conversion", l->name);
+		return -EFAULT;
+	}
+
+	/* every channel value at every position of the dither matrix */
+	for (i = 0; i < 256; ++i)
+		src[i] = (i << 16) | ((255 - i) << 8) | (i ^ 0x5a);
+
+	for (y = 0; y < 4; ++y) {
+		for (x = 0; x < 4; ++x) {
+			ret = compare_row(l, dither, &fbdev, src, 256, x, y);
+			if (ret)
+				return ret;
+		}
+	}
+
+	srand(convert_conf.seed);
+	for (run = 0; run < RANDOM_RUNS; ++run) {
+		num = rand() % (ROW_MAX + 1);
+		x = rand() % 4096;
+		y = rand() % 4096;
+		for (i = 0; i < num; ++i)
+			src[i] = rand() & 0xffffff;
+
+		ret = compare_row(l, dither, &fbdev, src, num, x, y);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+static int test_convert(void)
+{
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < sizeof(layouts) / sizeof(*layouts); ++i) {
+		log_notice("testing layout %s", layouts[i].name);
+
+		ret = test_layout(&layouts[i], false);
+		if (ret)
+			return ret;
+		ret = test_layout(&layouts[i], true);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+static void print_help()
+{
+	/*
+	 * Usage/Help information
+	 * This should be scaled to a maximum of 80 characters per line:
+	 *
+	 * 80 char line:
+	 *       |   10   |    20   |    30   |    40   |    50   |    60   |    70   |    80   |
+	 *      "12345678901234567890123456789012345678901234567890123456789012345678901234567890\n"
+	 * 80 char line starting with tab:
+	 *       |10|    20   |    30   |    40   |    50   |    60   |    70   |    80   |
+	 *      "\t901234567890123456789012345678901234567890123456789012345678901234567890\n"
+	 */
+	fprintf(stderr,
+		"Usage:\n"
+		"\t%1$s [options]\n"
+		"\t%1$s -h [options]\n"
+		"\n"
+		"You can prefix boolean options with \"no-\" to negate it. If an argument is\n"
+		"given multiple times, only the last argument matters if not otherwise stated.\n"
+		"\n"
+		"General Options:\n"
+		TEST_HELP
+		"\n"
+		"Convert Options:\n"
+		"\t    --seed <seed>           [1]     Seed for random test rows\n",
+		"test_convert");
+	/*
+	 * 80 char line:
+	 *       |   10   |    20   |    30   |    40   |    50   |    60   |    70   |    80   |
+	 *      "12345678901234567890123456789012345678901234567890123456789012345678901234567890\n"
+	 * 80 char line starting with tab:
+	 *       |10|    20   |    30   |    40   |    50   |    60   |    70   |    80   |
+	 *      "\t901234567890123456789012345678901234567890123456789012345678901234567890\n"
+	 */
+}
+
+struct conf_option options[] = {
+	TEST_OPTIONS,
+	CONF_OPTION_UINT(0, "seed", &convert_conf.seed, 1),
+};
+
+int main(int argc, char **argv)
+{
+	struct ev_eloop *eloop;
+	int ret;
+	size_t onum;
+
+	onum = sizeof(options) / sizeof(*options);
+	ret = test_prepare(options, onum, argc, argv, &eloop);
+	if (ret)
+		goto err_fail;
+
+	ret = test_convert();
+
+	test_exit(options, onum, eloop);
+err_fail:
+	if (ret != -ECANCELED)
+		test_fail(ret);
+	return abs(ret);
+}
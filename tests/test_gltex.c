@@ -0,0 +1,553 @@
+/*
+ * test_gltex - Test the OpenGL text renderer
+ *
+ * Copyright (c) 2011-2013 David Herrmann <dh.herrmann@googlemail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Test the OpenGL text renderer
+ * This runs the gltex renderer on an offscreen EGL surface without any display
+ * and compares every pixel of each frame with a CPU blend of the same cells.
+ * The first frame is a full redraw with hundreds of different glyphs,
+ * including double-width glyphs and glyphs that are smaller than a cell. The following frames only redraw a few
+ * changed cells so the partial vertex and atlas uploads are checked, too.
+ * Glyphs are synthetic patterns with every alpha value so no font is needed.
+ *
+ * This needs the EGL_MESA_platform_surfaceless extension, which any recent
+ * Mesa provides with the llvmpipe software rasterizer. If it is missing, the
+ * test is skipped.
+ */
+
+static void print_help();
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <errno.h>
+#include <GLES2/gl2.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "font.h"
+#include "shl_log.h"
+#include "text.h"
+#include "uterm_video.h"
+#include "test_include.h"
+
+/* automake treats this exit status as a skipped test */
+#define TEST_SKIP 77
+
+#define FONT_W 8
+#define FONT_H 16
+#define MAX_GLYPHS 4096
+
+struct {
+	unsigned int cols;
+	unsigned int rows;
+	unsigned int frames;
+	unsigned int max_diff;
+} gltex_conf;
+
+extern struct kmscon_text_ops kmscon_text_gltex_ops;
+
+struct cell {
+	uint32_t id;
+	unsigned int width;
+	uint8_t fg[3];
+	uint8_t bg[3];
+};
+
+static struct cell *cells;
+static struct kmscon_glyph *glyphs[MAX_GLYPHS];
+
+/*
+ * The renderer only needs an OpenGL context and the size of the current mode
+ * from the display, so these are provided here instead of a real display. The
+ * EGL context is made current before the renderer is set up.
+ */
+
+static char dummy_display, dummy_mode;
+
+int uterm_display_use(struct uterm_display *disp, bool *opengl)
+{
+	if (opengl)
+		*opengl = true;
+	return 0;
+}
+
+struct uterm_mode *uterm_display_get_current(struct uterm_display *disp)
+{
+	return (struct uterm_mode*)&dummy_mode;
+}
+
+unsigned int uterm_mode_get_width(const struct uterm_mode *mode)
+{
+	return gltex_conf.cols * FONT_W;
+}
+
+unsigned int uterm_mode_get_height(const struct uterm_mode *mode)
+{
+	return gltex_conf.rows * FONT_H;
+}
+
+/* glyphs 1000 to 1999 are double-width */
+static unsigned int glyph_width(uint32_t id)
+{
+	return (id >= 1000 && id < 2000) ? 2 : 1;
+}
+
+/* glyphs 2000 to 2999 are smaller than a cell, the rest is padding */
+static unsigned int glyph_pad(uint32_t id)
+{
+	return (id >= 2000 && id < 3000) ? 3 : 0;
+}
+
+static uint8_t glyph_alpha(uint32_t id, unsigned int x, unsigned int y)
+{
+	unsigned int pad = glyph_pad(id);
+
+	if (!id || x >= FONT_W * glyph_width(id) - pad || y >= FONT_H - pad)
+		return 0;
+	return (id * 37 + x * 29 + y * 13 + ((x ^ y ^ id) & 7) * 31) & 0xff;
+}
+
+int kmscon_font_render(struct kmscon_font *font, uint32_t id,
+		       const uint32_t *ch, size_t len,
+		       const struct kmscon_glyph **out)
+{
+	struct kmscon_glyph *glyph;
+	unsigned int x, y, w;
+
+	if (id >= MAX_GLYPHS)
+		return -EINVAL;
+
+	if (!glyphs[id]) {
+		glyph = calloc(1, sizeof(*glyph));
+		if (!glyph)
+			return -ENOMEM;
+
+		glyph->width = glyph_width(id);
+		w = FONT_W * glyph->width - glyph_pad(id);
+		glyph->buf.width = w;
+		glyph->buf.height = FONT_H - glyph_pad(id);
+		/* odd stride to test unpacking of unaligned rows */
+		glyph->buf.stride = w + 5;
+		glyph->buf.format = UTERM_FORMAT_GREY;
+		glyph->buf.data = calloc(glyph->buf.stride, FONT_H);
+		if (!glyph->buf.data) {
+			free(glyph);
+			return -ENOMEM;
+		}
+
+		for (y = 0; y < glyph->buf.height; ++y)
+			for (x = 0; x < w; ++x)
+				glyph->buf.data[y * glyph->buf.stride + x] =
+							glyph_alpha(id, x, y);
+		glyphs[id] = glyph;
+	}
+
+	*out = glyphs[id];
+	return 0;
+}
+
+int kmscon_font_render_empty(struct kmscon_font *font,
+			     const struct kmscon_glyph **out)
+{
+	return kmscon_font_render(font, 0, NULL, 0, out);
+}
+
+int kmscon_font_render_inval(struct kmscon_font *font,
+			     const struct kmscon_glyph **out)
+{
+	return kmscon_font_render(font, 0, NULL, 0, out);
+}
+
+static void free_glyphs(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < MAX_GLYPHS; ++i) {
+		if (glyphs[i]) {
+			free(glyphs[i]->buf.data);
+			free(glyphs[i]);
+			glyphs[i] = NULL;
+		}
+	}
+}
+
+static void set_cell(unsigned int x, unsigned int y, uint32_t id,
+		     unsigned int seed)
+{
+	struct cell *c = &cells[y * gltex_conf.cols + x];
+
+	if (glyph_width(id) == 2 && x + 1 >= gltex_conf.cols)
+		id = 5;
+
+	c->id = id;
+	c->width = glyph_width(id);
+	c->fg[0] = seed * 7;
+	c->fg[1] = seed * 13 + 50;
+	c->fg[2] = 255 - seed;
+	c->bg[0] = seed * 3;
+	c->bg[1] = 20;
+	c->bg[2] = seed * 11;
+
+	if (c->width == 2) {
+		c[1].id = 0;
+		c[1].width = 0;
+	}
+}
+
+static int draw_cell(struct kmscon_text *txt, unsigned int x, unsigned int y)
+{
+	struct cell *c = &cells[y * gltex_conf.cols + x];
+	struct tsm_screen_attr attr;
+	uint32_t ch = c->id;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.fr = c->fg[0];
+	attr.fg = c->fg[1];
+	attr.fb = c->fg[2];
+	attr.br = c->bg[0];
+	attr.bg = c->bg[1];
+	attr.bb = c->bg[2];
+
+	return txt->ops->draw(txt, c->id, &ch, c->id ? 1 : 0, c->width,
+			      x, y, &attr);
+}
+
+static int compare(const char *frame)
+{
+	unsigned int w = gltex_conf.cols * FONT_W;
+	unsigned int h = gltex_conf.rows * FONT_H;
+	unsigned int x, y, gx, i, max = 0;
+	uint8_t *px, *p;
+	struct cell *c;
+	int a, e, d, ret = 0;
+
+	px = malloc(w * h * 4);
+	if (!px)
+		return -ENOMEM;
+
+	glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, px);
+
+	for (y = 0; y < h && !ret; ++y) {
+		for (x = 0; x < w && !ret; ++x) {
+			/* GL rows start at the bottom */
+			p = &px[((h - 1 - y) * w + x) * 4];
+			c = &cells[y / FONT_H * gltex_conf.cols + x / FONT_W];
+			gx = x % FONT_W;
+			if (!c->width) {
+				--c;
+				gx += FONT_W;
+			}
+
+			a = glyph_alpha(c->id, gx, y % FONT_H);
+			for (i = 0; i < 3; ++i) {
+				e = (a * c->fg[i] + (255 - a) * c->bg[i] +
+				     127) / 255;
+				d = abs(e - p[i]);
+				if (d > max)
+					max = d;
+				if (d > gltex_conf.max_diff) {
+					log_err("%s: pixel %u,%u channel %u is %u instead of %d (glyph %u)",
+						frame, x, y, i, p[i], e,
+						c->id);
+					ret = -EFAULT;
+					break;
+				}
+			}
+		}
+	}
+
+	if (!ret)
+		log_notice("%s: ok, max difference %u", frame, max);
+
+	free(px);
+	return ret;
+}
+
+static int run_frames(struct kmscon_text *txt)
+{
+	unsigned int x, y, f, i, cols, rows;
+	struct cell *c;
+	int ret;
+
+	cols = gltex_conf.cols;
+	rows = gltex_conf.rows;
+
+	/* full redraw with many different and some double-width glyphs */
+	for (y = 0; y < rows; ++y) {
+		for (x = 0; x < cols; ++x) {
+			c = &cells[y * cols + x];
+			if (x && !c->width && c[-1].width == 2)
+				continue;
+			if ((x + y * cols) % 7 == 3)
+				set_cell(x, y, 1000 + x + y, x + y);
+			else
+				set_cell(x, y, 1 + (x * 17 + y * 3) % 700,
+					 x + y);
+		}
+	}
+
+	glClearColor(1.0, 0.0, 1.0, 1.0);
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	txt->age = 0;
+	ret = txt->ops->prepare(txt);
+	if (ret)
+		return ret;
+	for (y = 0; y < rows; ++y)
+		for (x = 0; x < cols; ++x)
+			draw_cell(txt, x, y);
+	ret = txt->ops->render(txt);
+	if (ret)
+		return ret;
+
+	ret = compare("full redraw");
+	if (ret)
+		return ret;
+
+	/* the target is cleared so only cells that are drawn again are kept;
+	 * the renderer must still draw all cells from its vertex buffer */
+	for (f = 0; f < gltex_conf.frames; ++f) {
+		glClear(GL_COLOR_BUFFER_BIT);
+
+		txt->age = 1;
+		ret = txt->ops->prepare(txt);
+		if (ret)
+			return ret;
+
+		for (i = 0; i < 20; ++i) {
+			x = (i * 7 + f * 13) % (cols - 2);
+			y = (i * 5 + f) % rows;
+			if (cells[y * cols + x].width != 1)
+				continue;
+
+			set_cell(x, y, 2000 + (i + f * 50) % 2000, i * 9 + f);
+			draw_cell(txt, x, y);
+		}
+
+		ret = txt->ops->render(txt);
+		if (ret)
+			return ret;
+
+		ret = compare("partial redraw");
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+static int test_gltex(void)
+{
+	static const EGLint conf_attr[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+		EGL_RED_SIZE, 8,
+		EGL_GREEN_SIZE, 8,
+		EGL_BLUE_SIZE, 8,
+		EGL_NONE
+	};
+	static const EGLint ctx_attr[] = {
+		EGL_CONTEXT_CLIENT_VERSION, 2,
+		EGL_NONE
+	};
+	PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display;
+	EGLint surf_attr[] = {
+		EGL_WIDTH, 0,
+		EGL_HEIGHT, 0,
+		EGL_NONE
+	};
+	struct kmscon_font font;
+	struct kmscon_text txt;
+	EGLDisplay dpy;
+	EGLConfig conf;
+	EGLContext ctx;
+	EGLSurface surf;
+	EGLint major, minor, n;
+	int ret;
+
+	if (gltex_conf.cols < 3 || !gltex_conf.rows) {
+		log_err("invalid screen size %ux%u", gltex_conf.cols,
+			gltex_conf.rows);
+		return -EINVAL;
+	}
+
+	get_platform_display = (void*)
+			eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (!get_platform_display) {
+		log_notice("no EGL platform support, skipping test");
+		return TEST_SKIP;
+	}
+
+	dpy = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,
+				   EGL_DEFAULT_DISPLAY, NULL);
+	if (dpy == EGL_NO_DISPLAY || !eglInitialize(dpy, &major, &minor)) {
+		log_notice("no surfaceless EGL display, skipping test");
+		return TEST_SKIP;
+	}
+
+	if (!eglBindAPI(EGL_OPENGL_ES_API) ||
+	    !eglChooseConfig(dpy, conf_attr, &conf, 1, &n) || n < 1) {
+		log_notice("no EGL config for OpenGLES2, skipping test");
+		ret = TEST_SKIP;
+		goto err_dpy;
+	}
+
+	ctx = eglCreateContext(dpy, conf, EGL_NO_CONTEXT, ctx_attr);
+	if (ctx == EGL_NO_CONTEXT) {
+		log_notice("cannot create OpenGLES2 context, skipping test");
+		ret = TEST_SKIP;
+		goto err_dpy;
+	}
+
+	surf_attr[1] = gltex_conf.cols * FONT_W;
+	surf_attr[3] = gltex_conf.rows * FONT_H;
+	surf = eglCreatePbufferSurface(dpy, conf, surf_attr);
+	if (surf == EGL_NO_SURFACE) {
+		log_err("cannot create EGL pbuffer surface");
+		ret = -EFAULT;
+		goto err_ctx;
+	}
+
+	if (!eglMakeCurrent(dpy, surf, surf, ctx)) {
+		log_err("cannot activate EGL context");
+		ret = -EFAULT;
+		goto err_surf;
+	}
+
+	log_notice("running on %s", glGetString(GL_RENDERER));
+
+	cells = calloc(gltex_conf.cols * gltex_conf.rows, sizeof(*cells));
+	if (!cells) {
+		ret = -ENOMEM;
+		goto err_current;
+	}
+
+	memset(&font, 0, sizeof(font));
+	font.attr.width = FONT_W;
+	font.attr.height = FONT_H;
+
+	memset(&txt, 0, sizeof(txt));
+	txt.ops = &kmscon_text_gltex_ops;
+	txt.font = &font;
+	txt.bold_font = &font;
+	txt.disp = (struct uterm_display*)&dummy_display;
+
+	ret = txt.ops->init(&txt);
+	if (ret)
+		goto err_cells;
+
+	ret = txt.ops->set(&txt);
+	if (ret)
+		goto err_txt;
+
+	ret = run_frames(&txt);
+
+	txt.ops->unset(&txt);
+err_txt:
+	txt.ops->destroy(&txt);
+err_cells:
+	free(cells);
+	free_glyphs();
+err_current:
+	eglMakeCurrent(dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+err_surf:
+	eglDestroySurface(dpy, surf);
+err_ctx:
+	eglDestroyContext(dpy, ctx);
+err_dpy:
+	eglTerminate(dpy);
+	return ret;
+}
+
+static void print_help()
+{
+	/*
+	 * Usage/Help information
+	 * This should be scaled to a maximum of 80 characters per line:
+	 *
+	 * 80 char line:
+	 *       |   10   |    20   |    30   |    40   |    50   |    60   |    70   |    80   |
+	 *      "12345678901234567890123456789012345678901234567890123456789012345678901234567890\n"
+	 * 80 char line starting with tab:
+	 *       |10|    20   |    30   |    40   |    50   |    60   |    70   |    80   |
+	 *      "\t901234567890123456789012345678901234567890123456789012345678901234567890\n"
+	 */
+	fprintf(stderr,
+		"Usage:\n"
+		"\t%1$s [options]\n"
+		"\t%1$s -h [options]\n"
+		"\n"
+		"You can prefix boolean options with \"no-\" to negate it. If an argument is\n"
+		"given multiple times, only the last argument matters if not otherwise stated.\n"
+		"\n"
+		"General Options:\n"
+		TEST_HELP
+		"\n"
+		"Gltex Options:\n"
+		"\t    --cols <num>            [97]    Columns of the test screen\n"
+		"\t    --rows <num>            [29]    Rows of the test screen\n"
+		"\t    --frames <num>          [5]     Number of partial redraws\n"
+		"\t    --max-diff <num>        [1]     Allowed difference per channel\n",
+		"test_gltex");
+	/*
+	 * 80 char line:
+	 *       |   10   |    20   |    30   |    40   |    50   |    60   |    70   |    80   |
+	 *      "12345678901234567890123456789012345678901234567890123456789012345678901234567890\n"
+	 * 80 char line starting with tab:
+	 *       |10|    20   |    30   |    40   |    50   |    60   |    70   |    80   |
+	 *      "\t901234567890123456789012345678901234567890123456789012345678901234567890\n"
+	 */
+}
+
+struct conf_option options[] = {
+	TEST_OPTIONS,
+	CONF_OPTION_UINT(0, "cols", &gltex_conf.cols, 97),
+	CONF_OPTION_UINT(0, "rows", &gltex_conf.rows, 29),
+	CONF_OPTION_UINT(0, "frames", &gltex_conf.frames, 5),
+	CONF_OPTION_UINT(0, "max-diff", &gltex_conf.max_diff, 1),
+};
+
+int main(int argc, char **argv)
+{
+	struct ev_eloop *eloop;
+	int ret;
+	size_t onum;
+
+	onum = sizeof(options) / sizeof(*options);
+	ret = test_prepare(options, onum, argc, argv, &eloop);
+	if (ret)
+		goto err_fail;
+
+	ret = test_gltex();
+
+	test_exit(options, onum, eloop);
+	if (ret == TEST_SKIP)
+		return ret;
+err_fail:
+	if (ret != -ECANCELED)
+		test_fail(ret);
+	return abs(ret);
+}
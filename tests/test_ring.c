@@ -0,0 +1,223 @@
+/*
+ * test_ring - Test the circular memory ring
+ *
+ * Copyright (c) 2011-2013 David Herrmann <dh.herrmann@googlemail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Test the circular memory ring
+ * This runs random writes and drops against a ring and a plain linear buffer
+ * and compares the content of both after each step. The sizes are chosen so
+ * the ring wraps around and grows while wrapped. It fails if the content ever
+ * differs.
+ */
+
+static void print_help();
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include "shl_log.h"
+#include "shl_ring.h"
+#include "test_include.h"
+
+#define RING_MAX (1024 * 1024)
+#define RANDOM_RUNS 20000
+
+struct {
+	unsigned int seed;
+} ring_conf;
+
+static int compare(struct shl_ring *ring, const char *ref, size_t len,
+		   unsigned int run)
+{
+	struct iovec vec[2];
+	size_t num, i, off = 0;
+
+	if (shl_ring_get_used(ring) != len) {
+		log_err("run %u: ring holds %zu bytes instead of %zu",
+			run, shl_ring_get_used(ring), len);
+		return -EFAULT;
+	}
+
+	num = shl_ring_peek(ring, vec);
+	if (!len != !num) {
+		log_err("run %u: ring returned %zu iovecs for %zu bytes",
+			run, num, len);
+		return -EFAULT;
+	}
+
+	for (i = 0; i < num; ++i) {
+		if (!vec[i].iov_len || off + vec[i].iov_len > len ||
+		    memcmp(vec[i].iov_base, &ref[off], vec[i].iov_len)) {
+			log_err("run %u: content of iovec %zu differs", run, i);
+			return -EFAULT;
+		}
+		off += vec[i].iov_len;
+	}
+
+	if (off != len) {
+		log_err("run %u: iovecs hold %zu bytes instead of %zu",
+			run, off, len);
+		return -EFAULT;
+	}
+
+	return 0;
+}
+
+static void fill(char *buf, size_t len, unsigned int *seq)
+{
+	size_t i;
+
+	for (i = 0; i < len; ++i)
+		buf[i] = (*seq)++ * 7 + 3;
+}
+
+static int test_ring(void)
+{
+	struct shl_ring *ring;
+	char *ref, *tmp;
+	size_t len = 0, num;
+	unsigned int run, seq = 0;
+	int ret;
+
+	ref = malloc(RING_MAX);
+	tmp = malloc(RING_MAX);
+	if (!ref || !tmp) {
+		ret = -ENOMEM;
+		goto err_free;
+	}
+
+	ret = shl_ring_new(&ring);
+	if (ret)
+		goto err_free;
+
+	srand(ring_conf.seed);
+	for (run = 0; run < RANDOM_RUNS; ++run) {
+		/* mostly small chunks with a large paste now and then */
+		if (rand() % 100)
+			num = rand() % 1500 + 1;
+		else
+			num = rand() % (RING_MAX / 4) + 1;
+
+		switch (rand() % 2) {
+		case 0:
+			if (len + num > RING_MAX)
+				break;
+			fill(tmp, num, &seq);
+			ret = shl_ring_write(ring, tmp, num);
+			if (ret)
+				goto err_ring;
+			memcpy(&ref[len], tmp, num);
+			len += num;
+			break;
+		default:
+			if (num > len)
+				num = len;
+			shl_ring_drop(ring, num);
+			memmove(ref, &ref[num], len - num);
+			len -= num;
+			break;
+		}
+
+		ret = compare(ring, ref, len, run);
+		if (ret)
+			goto err_ring;
+	}
+
+	shl_ring_flush(ring);
+	ret = compare(ring, ref, 0, run);
+
+err_ring:
+	shl_ring_free(ring);
+err_free:
+	free(tmp);
+	free(ref);
+	if (!ret)
+		log_notice("ring: %u random runs passed", RANDOM_RUNS);
+	return ret;
+}
+
+static void print_help()
+{
+	/*
+	 * Usage/Help information
+	 * This should be scaled to a maximum of 80 characters per line:
+	 *
+	 * 80 char line:
+	 *       |   10   |    20   |    30   |    40   |    50   |    60   |    70   |    80   |
+	 *      "12345678901234567890123456789012345678901234567890123456789012345678901234567890\n"
+	 * 80 char line starting with tab:
+	 *       |10|    20   |    30   |    40   |    50   |    60   |    70   |    80   |
+	 *      "\t901234567890123456789012345678901234567890123456789012345678901234567890\n"
+	 */
+	fprintf(stderr,
+		"Usage:\n"
+		"\t%1$s [options]\n"
+		"\t%1$s -h [options]\n"
+		"\n"
+		"You can prefix boolean options with \"no-\" to negate it. If an argument is\n"
+		"given multiple times, only the last argument matters if not otherwise stated.\n"
+		"\n"
+		"General Options:\n"
+		TEST_HELP
+		"\n"
+		"Ring Options:\n"
+		"\t    --seed <seed>           [1]     Seed for random operations\n",
+		"test_ring");
+	/*
+	 * 80 char line:
+	 *       |   10   |    20   |    30   |    40   |    50   |    60   |    70   |    80   |
+	 *      "12345678901234567890123456789012345678901234567890123456789012345678901234567890\n"
+	 * 80 char line starting with tab:
+	 *       |10|    20   |    30   |    40   |    50   |    60   |    70   |    80   |
+	 *      "\t901234567890123456789012345678901234567890123456789012345678901234567890\n"
+	 */
+}
+
+struct conf_option options[] = {
+	TEST_OPTIONS,
+	CONF_OPTION_UINT(0, "seed", &ring_conf.seed, 1),
+};
+
+int main(int argc, char **argv)
+{
+	struct ev_eloop *eloop;
+	int ret;
+	size_t onum;
+
+	onum = sizeof(options) / sizeof(*options);
+	ret = test_prepare(options, onum, argc, argv, &eloop);
+	if (ret)
+		goto err_fail;
+
+	ret = test_ring();
+
+	test_exit(options, onum, eloop);
+err_fail:
+	if (ret != -ECANCELED)
+		test_fail(ret);
+	return abs(ret);
+}